@@ -0,0 +1,1119 @@
+#include "stdafx.h"
+
+#include "direct_sound.h"
+#include "resource.h"
+
+// A headless front end for the direct_sound library.
+//
+// Plays or renders one of the sources the dialog offers for a given duration, rate and buffer size
+// and prints how the buffer fills performed. As it doesn't need a window (and with --device virtual
+// or offline not even a sound device), it can be run from scripts and under a profiler.
+
+namespace {
+
+constexpr std::array<size_t, 8> c_dur_toneladder = {{264, 297, 330, 352, 396, 440, 495, 528}};
+constexpr std::array<int, 8> guitar_c_dur_toneladder = {{
+	IDR_GUITAR_264,
+	IDR_GUITAR_297,
+	IDR_GUITAR_330,
+	IDR_GUITAR_352,
+	IDR_GUITAR_396,
+	IDR_GUITAR_440,
+	IDR_GUITAR_495,
+	IDR_GUITAR_528,
+}};
+
+// The rate all of the bundled recordings were made at.
+constexpr size_t recording_samples_per_second = 22050;
+
+using ProviderFunction = direct_sound::buffer_trait<int16_t, 2>::ProviderFunction;
+using voice_allocator = direct_sound::voice_allocator<2, direct_sound::sine_voice<2>, direct_sound::sampler_voice<2>, direct_sound::pluck_voice<2>, direct_sound::pluck_bank<2>, direct_sound::additive_voice<2>>;
+
+constexpr wchar_t usage[] = LR"(usage: htw-avgp-cli [options]
+
+  --source NAME       sine, ladder, pcm, series, voices, fixed, guitar, pluck, strum,
+                      additive, expression or layered (default: sine)
+                        sine    a single sine tone at --frequency, in fixed point
+                        ladder  the C major tone ladder, one note per half buffer
+                        pcm     the bundled sample sound, looped
+                        series  the guitar tone ladder recordings
+                        voices  a C major triad of sine voices, mixed by a voice_allocator
+                        fixed   the same triad computed in Q15 fixed point, compared against
+                                double precision
+                        guitar  all notes of the tone ladder at once, pitched from a single
+                                guitar recording by looping sampler voices
+                        pluck   the same notes as plucked strings, one pluck_voice each
+                        strum   the same plucked strings, rendered together by a pluck_bank
+                        additive  a C major triad of additive voices with --partials each
+                        expression  an enveloped, panned sine at --frequency, composed from
+                                    expression templates into a single loop
+                        layered   the same sine, envelope and pan as a std::function per stage,
+                                  for comparing the fill times (e.g. with --device offline
+                                  --samples 2205 --duration 100)
+  --frequency HZ      frequency of the sine, expression and layered sources (default: 440);
+                      whole numbers only for the sine
+  --partials N        partials per voice of the additive source (default: 32)
+  --duration SECONDS  how long to play or render (default: 5)
+  --rate HZ           sample rate (default: 44100, or 22050 for recordings)
+  --samples N         samples per half of the double buffer (default: rate / 20)
+  --mode MODE         notifications or play_cursor (default: notifications)
+  --device NAME       virtual, directsound or offline (default: virtual)
+                        virtual      simulated device, see --clock-ratio
+                        directsound  the primary sound driver
+                        offline      render as fast as possible without any device
+  --clock-ratio R     speed of the virtual device's clock relative to real time (default: 1)
+  --wav PATH          write the output into a WAV file (virtual and offline only)
+  --reverb SECONDS    convolve the output with a room impulse response that long (the voice
+                      sources convolve their mix before it is converted to 16 bits)
+  --reverb-block N    frames per partition of the impulse response (default: 256)
+  --reverb-head N     partitions convolved on the render thread, the others on a
+                      worker thread (default: all on the render thread)
+  --cache DIR         render the output once into a cache directory and play it from
+                      there, so that later runs with the same options skip synthesis
+  --latency N         instead of playing --source, press N piano keys at irregular intervals
+                      on the virtual device and print the latency from each press until its
+                      note is played, for both modes and --samples (default: 128 to 2205)
+  --graph N           instead of playing --source, render N voices on a piano, a ladder and a
+                      PCM bus through a render_graph offline, once for each thread count up to
+                      the number of cores, and print how the rendering scales; exits with 2
+                      if the output differs between thread counts
+  --drift PPM         instead of playing --source, play a tone of their own on each of two virtual
+                      devices through a multi_output, the second one's clock PPM parts per million
+                      faster (or slower, if negative), and print how the follower's drift
+                      estimate converges each second
+  --pool N            instead of playing --source, start and stop it N times on the virtual device
+                      through a buffer_pool, like the dialog's PCM sound button, and check that
+                      the buffers are recycled; exits with 2 if they aren't
+  --golden PATH       instead of playing --source, render 1 s of every source offline at 64,
+                      441 and 2205 samples per block and compare the hashes to those in PATH
+                      (e.g. cli/golden.txt), or the output to the reference WAV an entry names;
+                      exits with 3 on any mismatch or missing entry
+  --write-golden PATH the same, but write the hashes into PATH and the reference WAVs next to it
+)";
+
+class options {
+public:
+	std::wstring source = L"sine";
+	double frequency = 440.0;
+	size_t partials = 32;
+	double duration = 5.0;
+	size_t samples_per_second = 0;
+	size_t samples = 0;
+	direct_sound::fill_mode mode = direct_sound::fill_mode::notifications;
+	std::wstring device = L"virtual";
+	double clock_ratio = 1.0;
+	std::optional<std::filesystem::path> wav;
+	double reverb = 0.0;
+	size_t reverb_block = 256;
+	size_t reverb_head = 0;
+	std::optional<std::filesystem::path> cache;
+	size_t latency = 0;
+	size_t graph = 0;
+	double drift = 0.0;
+	size_t pool = 0;
+	std::optional<std::filesystem::path> golden;
+	bool write_golden = false;
+};
+
+double parse_number(const std::wstring& name, const wchar_t* value) {
+	wchar_t* end = nullptr;
+	const auto result = std::wcstod(value, &end);
+
+	if (end == value || *end != L'\0' || !(result > 0.0)) {
+		throw std::invalid_argument(string_format("invalid value for %s: %s", string_wide_to_utf8(name).c_str(), string_wide_to_utf8(value).c_str()));
+	}
+
+	return result;
+}
+
+// Like parse_number(), for deviations which may also be negative, but not 0 or -1e6 and below.
+double parse_ppm(const std::wstring& name, const wchar_t* value) {
+	wchar_t* end = nullptr;
+	const auto result = std::wcstod(value, &end);
+
+	if (end == value || *end != L'\0' || result == 0.0 || !(std::abs(result) < 1e6)) {
+		throw std::invalid_argument(string_format("invalid value for %s: %s", string_wide_to_utf8(name).c_str(), string_wide_to_utf8(value).c_str()));
+	}
+
+	return result;
+}
+
+options parse_options(int argc, wchar_t** argv) {
+	options result;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::wstring name = argv[i];
+
+		if (i + 1 >= argc) {
+			throw std::invalid_argument(string_format("missing value for %s", string_wide_to_utf8(name).c_str()));
+		}
+
+		const auto value = argv[++i];
+
+		if (name == L"--source") {
+			result.source = value;
+		} else if (name == L"--frequency") {
+			result.frequency = parse_number(name, value);
+		} else if (name == L"--partials") {
+			result.partials = size_t(parse_number(name, value));
+		} else if (name == L"--duration") {
+			result.duration = parse_number(name, value);
+		} else if (name == L"--rate") {
+			result.samples_per_second = size_t(parse_number(name, value));
+		} else if (name == L"--samples") {
+			result.samples = size_t(parse_number(name, value));
+		} else if (name == L"--mode") {
+			if (std::wstring(value) == L"notifications") {
+				result.mode = direct_sound::fill_mode::notifications;
+			} else if (std::wstring(value) == L"play_cursor") {
+				result.mode = direct_sound::fill_mode::play_cursor;
+			} else {
+				throw std::invalid_argument(string_format("invalid value for --mode: %s", string_wide_to_utf8(value).c_str()));
+			}
+		} else if (name == L"--device") {
+			result.device = value;
+		} else if (name == L"--clock-ratio") {
+			result.clock_ratio = parse_number(name, value);
+		} else if (name == L"--wav") {
+			result.wav = value;
+		} else if (name == L"--reverb") {
+			result.reverb = parse_number(name, value);
+		} else if (name == L"--reverb-block") {
+			result.reverb_block = size_t(parse_number(name, value));
+		} else if (name == L"--reverb-head") {
+			result.reverb_head = size_t(parse_number(name, value));
+		} else if (name == L"--cache") {
+			result.cache = value;
+		} else if (name == L"--latency") {
+			result.latency = size_t(parse_number(name, value));
+		} else if (name == L"--graph") {
+			result.graph = size_t(parse_number(name, value));
+		} else if (name == L"--drift") {
+			result.drift = parse_ppm(name, value);
+		} else if (name == L"--pool") {
+			result.pool = size_t(parse_number(name, value));
+		} else if (name == L"--golden" || name == L"--write-golden") {
+			result.golden = value;
+			result.write_golden = name == L"--write-golden";
+		} else {
+			throw std::invalid_argument(string_format("unknown option: %s", string_wide_to_utf8(name).c_str()));
+		}
+	}
+
+	return result;
+}
+
+std::vector<byte> load_rcdata_as_vector(int name) {
+	const auto resource = load_resource(RT_RCDATA, name);
+	return std::vector<byte>(resource.begin(), resource.end());
+}
+
+// The sine voices of the voices source at the same level, but computed in fixed point and without a voice_allocator.
+ProviderFunction create_fixed_triad(const options& o) {
+	std::vector<direct_sound::fixed_voice<int16_t, 2>> voices;
+	for (size_t i = 0; i < 3; ++i) {
+		voices.emplace_back(double(c_dur_toneladder[i * 2]), o.samples_per_second, -1000, 0.0);
+	}
+	return direct_sound::create_fixed_voices_provider<int16_t, 2>(std::move(voices));
+}
+
+constexpr auto expression_attack = std::chrono::milliseconds(10);
+constexpr auto expression_decay = std::chrono::milliseconds(200);
+constexpr float expression_sustain = 0.5f;
+constexpr float expression_pan = 0.3f;
+
+ProviderFunction create_expression(const options& o) {
+	using namespace direct_sound::expressions;
+	return sine(o.frequency) * envelope(expression_attack, expression_decay, expression_sustain) | pan(expression_pan) | to<int16_t, 2>();
+}
+
+// The expression source's pipeline with a std::function per stage, each rendering the whole block before the next
+// one runs, like nested providers do. It uses the same signals, so its output is identical.
+ProviderFunction create_layered_expression(const options& o) {
+	using mono_function = std::function<void(direct_sound::mix_frame<1>*, size_t)>;
+
+	direct_sound::expressions::sine tone(o.frequency);
+	direct_sound::expressions::envelope shape(expression_attack, expression_decay, expression_sustain);
+	tone.prepare(double(o.samples_per_second));
+	shape.prepare(double(o.samples_per_second));
+
+	mono_function oscillator = [tone](direct_sound::mix_frame<1>* frames, size_t count) mutable {
+		for (size_t i = 0; i < count; ++i) {
+			frames[i] = tone.next();
+		}
+	};
+
+	mono_function enveloped = [oscillator, shape](direct_sound::mix_frame<1>* frames, size_t count) mutable {
+		oscillator(frames, count);
+
+		for (size_t i = 0; i < count; ++i) {
+			frames[i][0] *= shape.next()[0];
+		}
+	};
+
+	const auto angle = (double(expression_pan) + 1.0) * M_PI / 4.0;
+	std::function<void(direct_sound::mix_frame<2>*, size_t)> panned = [enveloped, left = float(std::cos(angle)), right = float(std::sin(angle)), mono = std::vector<direct_sound::mix_frame<1>>()](direct_sound::mix_frame<2>* frames, size_t count) mutable {
+		if (mono.size() < count) {
+			mono.resize(count);
+		}
+
+		enveloped(mono.data(), count);
+
+		for (size_t i = 0; i < count; ++i) {
+			frames[i] = {mono[i][0] * left, mono[i][0] * right};
+		}
+	};
+
+	return [panned, mix = std::vector<direct_sound::mix_frame<2>>()](direct_sound::buffer_trait<int16_t, 2>::SpanPairType spans, direct_sound::buffer_info) mutable {
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			if (mix.size() < size) {
+				mix.resize(size);
+			}
+
+			panned(mix.data(), size);
+			direct_sound::detail::convert_frames<int16_t, 2>(mix.data(), span.data(), size);
+		}
+	};
+}
+
+// Offline renders have no deadline, and dropping voices over budget would make their output depend on timing.
+// The same goes for renders into the cache, which are offline regardless of the device.
+double voice_budget(const options& o) {
+	return o.device == L"offline" || o.cache ? 0.0 : 0.5;
+}
+
+// Fills in the rate and buffer size of `o.source` if they weren't given.
+void fill_in_defaults(options& o) {
+	const bool recording = o.source == L"pcm" || o.source == L"series";
+
+	if (o.samples_per_second == 0) {
+		o.samples_per_second = recording ? recording_samples_per_second : 44100;
+	}
+	if (o.samples == 0) {
+		o.samples = o.samples_per_second / 20;
+	}
+}
+
+// The sources mixing their voices with a voice_allocator, which can convolve the mix before it's converted.
+bool is_voice_source(const options& o) {
+	return o.source == L"voices" || o.source == L"guitar" || o.source == L"pluck" || o.source == L"strum" || o.source == L"additive";
+}
+
+// Creates the provider for `o.source` and fills in the rate and buffer size if they weren't given.
+// The voice sources convolve their mix with `room`, if given. The others must be wrapped with create_convolution_provider().
+ProviderFunction create_source(options& o, const std::shared_ptr<direct_sound::convolver<2>>& room = nullptr) {
+	fill_in_defaults(o);
+
+	std::function<void(direct_sound::mix_frame<2>*, size_t, size_t)> process;
+	if (room) {
+		process = [room](direct_sound::mix_frame<2>* frames, size_t count, size_t) {
+			room->process(frames, count);
+		};
+	}
+
+	if (o.source == L"sine") {
+		// The sine is computed in fixed point and only supports whole frequencies.
+		if (o.frequency != std::floor(o.frequency)) {
+			throw std::invalid_argument(string_format("invalid value for --frequency: %f (the sine source only supports whole frequencies)", o.frequency));
+		}
+		return direct_sound::create_sine_wave_provider<int16_t, 2>(size_t(o.frequency));
+	}
+	if (o.source == L"ladder") {
+		return direct_sound::create_sine_wave_toneladder_provider<int16_t, 2>(std::vector<size_t>(c_dur_toneladder.begin(), c_dur_toneladder.end()));
+	}
+	if (o.source == L"pcm") {
+		return direct_sound::create_pcm_provider<int16_t, 2>(load_rcdata_as_vector(IDR_SAMPLE_SOUND), true);
+	}
+	if (o.source == L"series") {
+		std::vector<std::vector<byte>> pcms;
+		for (const auto rc : guitar_c_dur_toneladder) {
+			pcms.emplace_back(load_rcdata_as_vector(rc));
+		}
+		return direct_sound::create_pcm_series_provider<int16_t, 2>(std::move(pcms));
+	}
+	if (o.source == L"voices") {
+		auto voices = std::make_shared<voice_allocator>(8, direct_sound::steal_policy::oldest, voice_budget(o));
+		for (size_t i = 0; i < 3; ++i) {
+			const auto id = voices->note_on(direct_sound::sine_voice<2>(double(c_dur_toneladder[i * 2]), o.samples_per_second));
+			voices->set_volume(id, -1000);
+		}
+		return direct_sound::create_voice_allocator_provider<int16_t>(std::move(voices), nullptr, process);
+	}
+	if (o.source == L"fixed") {
+		return create_fixed_triad(o);
+	}
+	if (o.source == L"guitar" || o.source == L"pluck" || o.source == L"strum") {
+		// Compares streaming a recording to synthesizing the strings, in CPU time (see the fill times) and in memory.
+		// All strings are given a decay as long as the run, so that none of them finishes early.
+		std::vector<double> frequencies(c_dur_toneladder.begin(), c_dur_toneladder.end());
+		direct_sound::pluck_parameters parameters;
+		parameters.decay = o.duration;
+
+		auto voices = std::make_shared<voice_allocator>(frequencies.size(), direct_sound::steal_policy::oldest, voice_budget(o));
+		std::vector<voice_allocator::VoiceType> notes;
+		size_t bytes = 0;
+
+		if (o.source == L"guitar") {
+			const auto resource = load_resource(RT_RCDATA, IDR_GUITAR_264);
+			const gsl::span<const int16_t> pcm(reinterpret_cast<const int16_t*>(resource.data()), resource.size() / ptrdiff_t(sizeof(int16_t)));
+			const auto sample = std::make_shared<const direct_sound::sampler_sample>(pcm, 2, recording_samples_per_second, 264.0);
+
+			for (const auto frequency : frequencies) {
+				notes.emplace_back(direct_sound::sampler_voice<2>(sample, frequency, o.samples_per_second, true));
+			}
+			bytes = sample->size_bytes() + notes.size() * sizeof(direct_sound::sampler_voice<2>);
+		} else if (o.source == L"pluck") {
+			// The same seeds the pluck_bank of the strum source derives for its strings.
+			for (size_t i = 0; i < frequencies.size(); ++i) {
+				auto p = parameters;
+				p.seed = parameters.seed + uint32_t(i) * 0x9e3779b9u;
+				const direct_sound::pluck_voice<2> voice(frequencies[i], o.samples_per_second, p);
+				bytes += voice.size_bytes();
+				notes.emplace_back(voice);
+			}
+		} else {
+			const direct_sound::pluck_bank<2> bank(frequencies, o.samples_per_second, parameters);
+			bytes = bank.size_bytes();
+			notes.emplace_back(bank);
+		}
+
+		for (auto& note : notes) {
+			voices->set_volume(voices->note_on(std::move(note)), -1800);
+		}
+
+		std::printf("source state: %zu bytes\n", bytes);
+		return direct_sound::create_voice_allocator_provider<int16_t>(std::move(voices), nullptr, process);
+	}
+	if (o.source == L"additive") {
+		auto voices = std::make_shared<voice_allocator>(8, direct_sound::steal_policy::oldest, voice_budget(o));
+		const auto partials = direct_sound::create_harmonic_partials(o.partials);
+
+		for (size_t i = 0; i < 3; ++i) {
+			const direct_sound::additive_voice<2> voice(double(c_dur_toneladder[i * 2]), o.samples_per_second, partials);
+
+			// Partials above the Nyquist frequency are dropped, which would skew the throughput reported.
+			if (voice.partials() < o.partials) {
+				throw std::invalid_argument(string_format("only %zu of the %zu partials of %zu Hz are below the Nyquist frequency", voice.partials(), o.partials, c_dur_toneladder[i * 2]));
+			}
+
+			voices->set_volume(voices->note_on(voice), -1000);
+		}
+
+		return direct_sound::create_voice_allocator_provider<int16_t>(std::move(voices), nullptr, process);
+	}
+
+	if (o.source == L"expression") {
+		return create_expression(o);
+	}
+	if (o.source == L"layered") {
+		return create_layered_expression(o);
+	}
+
+	throw std::invalid_argument(string_format("unknown source: %s", string_wide_to_utf8(o.source).c_str()));
+}
+
+// The time spent in each invocation of a provider, in seconds.
+// Fills of a single buffer never overlap, which is why no lock is needed.
+// Only as many fills as were reserved for are recorded, so that recording them never allocates. The others are counted.
+class fill_times {
+public:
+	std::vector<double> durations;
+	std::vector<size_t> frames;
+	size_t dropped = 0;
+};
+
+ProviderFunction create_timed_provider(ProviderFunction provider, std::shared_ptr<fill_times> times) {
+	return [provider, times](direct_sound::buffer_trait<int16_t, 2>::SpanPairType spans, direct_sound::buffer_info info) {
+		const auto start = std::chrono::steady_clock::now();
+		provider(spans, info);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (times->durations.size() == times->durations.capacity()) {
+			++times->dropped;
+			return;
+		}
+
+		times->durations.push_back(std::chrono::duration<double>(end - start).count());
+		times->frames.push_back(size_t(spans[0].size() + spans[1].size()));
+	};
+}
+
+void print_fill_times(const fill_times& times, size_t samples_per_second) {
+	if (times.durations.empty()) {
+		std::printf("fill time: no fills\n");
+		return;
+	}
+
+	auto sorted = times.durations;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	double max_load = 0.0;
+	size_t total_frames = 0;
+
+	for (size_t i = 0; i < times.durations.size(); ++i) {
+		total += times.durations[i];
+		total_frames += times.frames[i];
+
+		if (times.frames[i]) {
+			max_load = std::max(max_load, times.durations[i] * double(samples_per_second) / double(times.frames[i]));
+		}
+	}
+
+	const auto percentile = [&sorted](double p) {
+		return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))] * 1e6;
+	};
+
+	std::printf("fill time: min %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n", sorted.front() * 1e6, percentile(0.5), percentile(0.99), sorted.back() * 1e6);
+	std::printf("fill load: average %.3f%%, max %.3f%% of the playback duration\n", total_frames ? 100.0 * total * double(samples_per_second) / double(total_frames) : 0.0, 100.0 * max_load);
+
+	if (times.dropped) {
+		std::printf("fill time: %zu later fills not recorded\n", times.dropped);
+	}
+}
+
+void print_statistics(const direct_sound::fill_statistics& stats) {
+	std::printf("fills: %llu, frames written %llu, played %llu, underruns %llu\n", stats.fills, stats.frames_written, stats.frames_played, stats.underruns);
+	std::printf("ahead of play cursor: last %lld, min %lld, max %lld frames\n", stats.last_ahead, stats.fills ? stats.min_ahead : 0, stats.fills ? stats.max_ahead : 0);
+	std::printf("clock drift: %.1f ppm\n", stats.drift_ppm);
+}
+
+// Renders up to a second of the fixed source and compares it to the same triad computed in double precision.
+void print_fixed_point_error(const options& o) {
+	const auto frames = size_t(std::min(o.duration, 1.0) * double(o.samples_per_second));
+	const auto output = direct_sound::render_offline<int16_t, 2>(create_fixed_triad(o), {o.samples_per_second, o.samples * 2}, frames, o.samples);
+	const auto amplitude = double(direct_sound::attenuation_to_gain(-1000)) * 32768.0;
+
+	double max_error = 0.0;
+	double sum = 0.0;
+
+	for (size_t i = 0; i < output.size(); ++i) {
+		double expected = 0.0;
+		for (size_t note = 0; note < 3; ++note) {
+			expected += std::sin(2.0 * M_PI * double(c_dur_toneladder[note * 2]) * double(i) / double(o.samples_per_second));
+		}
+
+		const auto error = std::abs(double(output[i][0]) - expected * amplitude);
+		max_error = std::max(max_error, error);
+		sum += error * error;
+	}
+
+	std::printf("fixed point error: max %.2f LSB, rms %.2f LSB against double precision\n", max_error, output.empty() ? 0.0 : std::sqrt(sum / double(output.size())));
+}
+
+int render(const options& o, ProviderFunction provider, const std::shared_ptr<fill_times>& times) {
+	const auto frames = size_t(o.duration * double(o.samples_per_second));
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto output = direct_sound::render_offline<int16_t, 2>(provider, {o.samples_per_second, o.samples * 2}, frames, o.samples);
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("rendered %zu frames in %.3f s (%.1fx real time), hash %016llx\n", output.size(), elapsed, o.duration / elapsed, direct_sound::hash_samples(output));
+	print_fill_times(*times, o.samples_per_second);
+
+	if (o.wav) {
+		direct_sound::wav_writer writer(*o.wav, direct_sound::wave_format(2, 16, o.samples_per_second));
+		writer.write({reinterpret_cast<const byte*>(output.data()), ptrdiff_t(output.size() * sizeof(output[0]))});
+	}
+
+	return 0;
+}
+
+int play(const options& o, const direct_sound::backend& backend, ProviderFunction provider, const std::shared_ptr<fill_times>& times, double clock_ratio) {
+	direct_sound::fill_statistics stats;
+
+	{
+		direct_sound::double_buffer<int16_t, 2> buffer(backend, o.samples_per_second, o.samples, provider, o.mode);
+		buffer.play(true);
+		std::this_thread::sleep_for(std::chrono::duration<double>(o.duration / clock_ratio));
+		buffer.stop();
+		stats = buffer.statistics();
+	}
+
+	print_statistics(stats);
+	print_fill_times(*times, o.samples_per_second);
+
+	// Lets scripts detect runs that didn't keep up.
+	return stats.underruns ? 2 : 0;
+}
+
+int run_on_device(const options& o, ProviderFunction provider, const std::shared_ptr<fill_times>& times) {
+	if (o.device == L"offline") {
+		return render(o, std::move(provider), times);
+	}
+
+	if (o.device == L"virtual") {
+		direct_sound::virtual_device device(o.clock_ratio);
+
+		if (o.wav) {
+			device.start_capture(*o.wav, direct_sound::wave_format(2, 16, o.samples_per_second));
+		}
+
+		const auto result = play(o, device, std::move(provider), times, o.clock_ratio);
+		device.stop_capture();
+		return result;
+	}
+
+	if (o.device == L"directsound") {
+		if (o.wav) {
+			throw std::invalid_argument("--wav is not supported with --device directsound");
+		}
+
+		winrt::init_apartment();
+
+		// DirectSound needs a window for its cooperative level, even though it's never shown.
+		auto hwnd = GetConsoleWindow();
+		if (!hwnd) {
+			hwnd = GetDesktopWindow();
+		}
+
+		direct_sound::context context(hwnd);
+		return play(o, context, std::move(provider), times, 1.0);
+	}
+
+	throw std::invalid_argument(string_format("unknown device: %s", string_wide_to_utf8(o.device).c_str()));
+}
+
+// Must be incremented whenever the output of any source changes, so that renders of the old output aren't played anymore.
+constexpr uint32_t cache_version = 2;
+
+// Everything the output depends on. The device, mode and the convolution's threading don't change it.
+direct_sound::render_key create_key(const options& o) {
+	direct_sound::render_key key("htw-avgp-cli");
+	key.add(cache_version);
+	key.add(string_wide_to_utf8(o.source)).add(o.frequency).add(o.partials).add(o.duration);
+	key.add(direct_sound::buffer_info{o.samples_per_second, o.samples * 2});
+	key.add(o.reverb).add(o.reverb_block);
+	return key;
+}
+
+// Measures the latency of key presses for each buffer size and fill mode. Each press stops the previous note and starts
+// the next one, like clicking the dialog's piano keys does.
+int run_latency(options o) {
+	if (o.device != L"virtual" || o.clock_ratio != 1.0) {
+		throw std::invalid_argument("--latency only supports --device virtual at --clock-ratio 1");
+	}
+
+	if (o.samples_per_second == 0) {
+		o.samples_per_second = 44100;
+	}
+
+	const auto sizes = o.samples ? std::vector<size_t>{o.samples} : std::vector<size_t>{128, 256, 512, 1024, 2205};
+	const std::array<direct_sound::fill_mode, 2> modes = {{direct_sound::fill_mode::notifications, direct_sound::fill_mode::play_cursor}};
+
+	std::printf("latency of %zu key presses, %zu Hz, device virtual\n", o.latency, o.samples_per_second);
+	std::printf("%8s  %-13s  %8s  %8s  %8s  %8s  %8s  %9s\n", "samples", "mode", "min ms", "median", "p95", "p99", "max", "underruns");
+
+	direct_sound::virtual_device device;
+	int result = 0;
+
+	for (const auto samples : sizes) {
+		for (const auto mode : modes) {
+			auto voices = std::make_shared<voice_allocator>(4);
+			auto probe = std::make_shared<direct_sound::latency_probe>();
+			direct_sound::fill_statistics stats;
+
+			{
+				direct_sound::double_buffer<int16_t, 2> buffer(device, o.samples_per_second, samples, direct_sound::create_latency_provider<int16_t, 2>(direct_sound::create_voice_allocator_provider<int16_t>(voices), probe), mode);
+				buffer.play(true);
+
+				direct_sound::voice_id id = 0;
+
+				for (size_t i = 0; i < o.latency; ++i) {
+					// Irregular intervals, so that the presses land at all phases of the fills.
+					std::this_thread::sleep_for(std::chrono::milliseconds(7 + i * 13 % 41));
+
+					probe->mark();
+					voices->note_off(id);
+					id = voices->note_on(direct_sound::sine_voice<2>(double(c_dur_toneladder[i % c_dur_toneladder.size()]), o.samples_per_second));
+				}
+
+				// Gives the last press time to reach a fill.
+				std::this_thread::sleep_for(std::chrono::duration<double>(2.0 * double(samples) / double(o.samples_per_second) + 0.01));
+				buffer.stop();
+				stats = buffer.statistics();
+			}
+
+			const auto latency = probe->stats();
+			std::printf("%8zu  %-13s  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %9llu\n", samples, mode == direct_sound::fill_mode::notifications ? "notifications" : "play_cursor", latency.min * 1e3, latency.median * 1e3, latency.p95 * 1e3, latency.p99 * 1e3, latency.max * 1e3, stats.underruns);
+
+			if (stats.underruns) {
+				result = 2;
+			}
+		}
+	}
+
+	return result;
+}
+
+// Builds a render_graph with `voices` voices spread over 3 buses: plucked strings on the piano bus,
+// additive voices on the ladder bus and looping guitar samples on the PCM bus. Without voices,
+// only the buses are rendered, which measures the graph's own overhead.
+std::shared_ptr<direct_sound::render_graph<2>> create_graph(const options& o, size_t threads, size_t voices) {
+	// Rendered offline, so without a CPU budget: No source is ever dropped and the output is the same for any number of threads.
+	auto graph = std::make_shared<direct_sound::render_graph<2>>(threads, 0.0);
+
+	// Keeps the sum of all voices from clipping.
+	auto controls = std::make_shared<direct_sound::gain_pan>();
+	controls->set_volume(std::max(direct_sound::volume_min, int(-2000.0 * std::log10(double(voices + 1)))));
+	graph->set_master_controls(controls);
+
+	const auto piano = graph->add_bus(graph->master);
+	const auto ladder = graph->add_bus(graph->master);
+	const auto pcm = graph->add_bus(graph->master);
+
+	if (voices == 0) {
+		return graph;
+	}
+
+	const auto resource = load_resource(RT_RCDATA, IDR_GUITAR_264);
+	const gsl::span<const int16_t> samples(reinterpret_cast<const int16_t*>(resource.data()), resource.size() / ptrdiff_t(sizeof(int16_t)));
+	const auto sample = std::make_shared<const direct_sound::sampler_sample>(samples, 2, recording_samples_per_second, 264.0);
+	const auto partials = direct_sound::create_harmonic_partials(8);
+
+	direct_sound::pluck_parameters parameters;
+	parameters.decay = o.duration;
+
+	for (size_t i = 0; i < voices; ++i) {
+		const auto frequency = double(c_dur_toneladder[i % c_dur_toneladder.size()]) * (1.0 + double(i / c_dur_toneladder.size()) * 0.001);
+
+		// Each source owns its voice, which only ever renders on one thread at a time.
+		if (i % 3 == 0) {
+			parameters.seed = uint32_t(i + 1);
+			graph->add_source(piano, [voice = direct_sound::pluck_voice<2>(frequency, o.samples_per_second, parameters)](direct_sound::mix_frame<2>* frames, size_t count, size_t) mutable {
+				voice.render(frames, count);
+			});
+		} else if (i % 3 == 1) {
+			graph->add_source(ladder, [voice = direct_sound::additive_voice<2>(frequency, o.samples_per_second, partials)](direct_sound::mix_frame<2>* frames, size_t count, size_t) mutable {
+				voice.render(frames, count);
+			});
+		} else {
+			graph->add_source(pcm, [voice = direct_sound::sampler_voice<2>(sample, frequency, o.samples_per_second, true)](direct_sound::mix_frame<2>* frames, size_t count, size_t) mutable {
+				voice.render(frames, count);
+			});
+		}
+	}
+
+	return graph;
+}
+
+// Renders the same graph with 1, 2, 4, ... threads up to the number of cores. The speedup is relative to a single thread,
+// the overhead is what each thread spent per block on anything but rendering, and the sync column that of an empty graph.
+// Exits with 2 if the output of any thread count differs from that of a single thread.
+int run_graph(options o) {
+	if (o.samples_per_second == 0) {
+		o.samples_per_second = 44100;
+	}
+	if (o.samples == 0) {
+		o.samples = o.samples_per_second / 20;
+	}
+
+	const auto cores = size_t(std::max(1u, std::thread::hardware_concurrency()));
+	const auto frames = size_t(o.duration * double(o.samples_per_second));
+
+	std::vector<size_t> thread_counts;
+	for (size_t threads = 1; threads < cores; threads *= 2) {
+		thread_counts.push_back(threads);
+	}
+	thread_counts.push_back(cores);
+
+	std::printf("render graph: %zu voices on 3 buses, %zu Hz, %zu samples per block, %zu cores\n", o.graph, o.samples_per_second, o.samples, cores);
+	std::printf("%8s  %10s  %8s  %12s  %12s  %12s  %16s\n", "threads", "real time", "speedup", "overhead us", "sync us", "steals/block", "hash");
+
+	double single = 0.0;
+	uint64_t single_hash = 0;
+	int result = 0;
+
+	for (const auto threads : thread_counts) {
+		const auto graph = create_graph(o, threads, o.graph);
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto output = direct_sound::render_offline<int16_t, 2>(direct_sound::create_render_graph_provider<int16_t, 2>(graph), {o.samples_per_second, o.samples * 2}, frames, o.samples);
+		const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const auto stats = graph->stats();
+
+		const auto empty = create_graph(o, threads, 0);
+		direct_sound::render_offline<int16_t, 2>(direct_sound::create_render_graph_provider<int16_t, 2>(empty), {o.samples_per_second, o.samples * 2}, frames, o.samples);
+
+		const auto hash = direct_sound::hash_samples(output);
+
+		if (threads == 1) {
+			single = elapsed;
+			single_hash = hash;
+		}
+
+		std::printf("%8zu  %9.1fx  %8.2f  %12.1f  %12.1f  %12.1f  %016llx\n", threads, o.duration / elapsed, single / elapsed, stats.overhead.count() * 1e6, empty->stats().overhead.count() * 1e6, stats.blocks ? double(stats.steals) / double(stats.blocks) : 0.0, hash);
+
+		if (hash != single_hash) {
+			std::printf("the output of %zu threads differs from that of a single thread\n", threads);
+			result = 2;
+		}
+	}
+
+	return result;
+}
+
+// Plays a sine of its own on each of two virtual devices, through a bus per device, the follower's clock `o.drift` ppm
+// faster than the master's (slower, if negative), and prints the follower's statistics once per second. Exits with 2 if the estimate, averaged over the second half of the run
+// to smooth out scheduling jitter, isn't within 15% of the actual drift.
+int run_drift(options o) {
+	if (o.samples_per_second == 0) {
+		o.samples_per_second = 44100;
+	}
+	if (o.samples == 0) {
+		o.samples = o.samples_per_second / 20;
+	}
+
+	direct_sound::virtual_device master;
+	direct_sound::virtual_device follower(1.0 + o.drift * 1e-6);
+
+	const auto bus = [](double frequency) -> direct_sound::buffer_trait<float, 2>::ProviderFunction {
+		return [tone = direct_sound::expressions::sine(frequency, 0.5f), samples_per_second = size_t(0)](direct_sound::buffer_trait<float, 2>::SpanPairType spans, direct_sound::buffer_info info) mutable {
+			if (info.samples_per_second != samples_per_second) {
+				tone.prepare(double(info.samples_per_second));
+				samples_per_second = info.samples_per_second;
+			}
+
+			for (const auto span : spans) {
+				for (auto& frame : span) {
+					frame.fill(tone.next()[0]);
+				}
+			}
+		};
+	};
+
+	direct_sound::multi_output<int16_t, 2> output({&master, &follower}, o.samples_per_second, o.samples, std::vector<direct_sound::buffer_trait<float, 2>::ProviderFunction>{bus(440.0), bus(660.0)});
+
+	std::printf("drift of %.1f ppm, %zu Hz, %zu samples per half\n", o.drift, o.samples_per_second, o.samples);
+	std::printf("%8s  %12s  %12s  %10s  %9s  %9s\n", "seconds", "estimate ppm", "ratio - 1", "level", "underruns", "overruns");
+
+	output.play(true);
+
+	const auto seconds = size_t(std::ceil(o.duration));
+	double sum = 0.0;
+
+	for (size_t second = 1; second <= seconds; ++second) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		const auto stats = output.output_statistics(1);
+		std::printf("%8zu  %12.1f  %12.1f  %10.1f  %9zu  %9zu\n", second, stats.drift_ppm, (stats.ratio - 1.0) * 1e6, stats.level, stats.underruns, stats.overruns);
+
+		if (second > seconds / 2) {
+			sum += stats.drift_ppm;
+		}
+	}
+
+	output.stop();
+
+	const auto average = sum / double(seconds - seconds / 2);
+	std::printf("average estimate over the second half: %.1f ppm\n", average);
+	return std::abs(average - o.drift) <= 0.15 * std::abs(o.drift) ? 0 : 2;
+}
+
+// Starts and stops `o.source` `o.pool` times through a buffer_pool on a virtual device, then plays more of it at once
+// than the pool keeps idle. Prints how long starting a sound took and exits with 2 if the buffers weren't reused,
+// a recycled buffer wasn't silent and rewound, or more than max_idle buffers were kept.
+int run_pool(options o) {
+	constexpr size_t max_idle = 2;
+
+	const auto provider = create_source(o);
+	direct_sound::virtual_device device;
+	direct_sound::buffer_pool pool(device, max_idle);
+
+	int result = 0;
+	const auto check = [&result](bool ok, const char* what) {
+		std::printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+		if (!ok) {
+			result = 2;
+		}
+	};
+
+	std::printf("source %s, %zu Hz, %zu samples per half, up to %zu idle buffers\n", string_wide_to_utf8(o.source).c_str(), o.samples_per_second, o.samples, max_idle);
+
+	std::vector<double> start_times;
+	start_times.reserve(o.pool);
+
+	for (size_t i = 0; i < o.pool; ++i) {
+		const auto start = std::chrono::steady_clock::now();
+		direct_sound::double_buffer<int16_t, 2> sound(pool, o.samples_per_second, o.samples, provider, o.mode);
+		sound.play(true);
+		start_times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		sound.stop();
+	}
+
+	const auto reused_average = o.pool > 1 ? std::accumulate(start_times.begin() + 1, start_times.end(), 0.0) / double(o.pool - 1) : 0.0;
+	std::printf("start: %.3f ms created, %.3f ms reused on average\n", start_times.front() * 1e3, reused_average * 1e3);
+
+	auto stats = pool.stats();
+	std::printf("%zu created, %zu reused, %zu idle\n", stats.created, stats.reused, stats.idle);
+	check(stats.created == 1 && stats.reused == o.pool - 1, "sounds after the first reuse its buffer");
+	check(stats.idle == 1, "the buffer is idle after the last sound");
+
+	{
+		const direct_sound::wave_format format(2, 16, o.samples_per_second);
+		const auto bytes = o.samples * 2 * format.block_align();
+		const auto buffer = pool.create_buffer(format, bytes);
+
+		bool silent = true;
+		const auto regions = buffer->lock(0, bytes);
+		for (const auto region : regions) {
+			silent = silent && std::all_of(region.begin(), region.end(), [](byte value) { return value == 0; });
+		}
+		buffer->unlock(regions);
+
+		check(pool.stats().reused == o.pool, "a recycled buffer is handed out again");
+		check(buffer->position().first == 0, "a recycled buffer is rewound");
+		check(silent, "a recycled buffer is silent");
+	}
+
+	{
+		std::vector<direct_sound::double_buffer<int16_t, 2>> sounds;
+		for (size_t i = 0; i < max_idle + 2; ++i) {
+			sounds.emplace_back(pool, o.samples_per_second, o.samples, provider, o.mode);
+			sounds.back().play(true);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+
+	stats = pool.stats();
+	std::printf("after %zu sounds at once: %zu created, %zu reused, %zu idle\n", max_idle + 2, stats.created, stats.reused, stats.idle);
+	check(stats.created == max_idle + 2, "sounds beyond the idle buffers create new ones");
+	check(stats.idle == max_idle, "no more than max_idle buffers are kept");
+
+	return result;
+}
+
+constexpr std::array<const wchar_t*, 12> golden_sources = {{L"sine", L"ladder", L"pcm", L"series", L"voices", L"fixed", L"guitar", L"pluck", L"strum", L"additive", L"expression", L"layered"}};
+constexpr std::array<size_t, 3> golden_block_sizes = {{64, 441, 2205}};
+constexpr double golden_duration = 1.0;
+
+// The sources synthesized in floating point, whose output depends on the compiler's code generation. Instead of
+// by their hashes, these are compared to a reference WAV, rendered at the first block size, within golden_tolerance.
+constexpr std::array<const wchar_t*, 5> golden_reference_sources = {{L"voices", L"additive", L"pluck", L"strum", L"expression"}};
+constexpr double golden_tolerance = 8.0;
+
+// Renders every source at every golden block size and compares the output to the entries in `o.golden`,
+// or writes them into it. Sources without an entry fail the run just like mismatching ones.
+int run_golden(const options& o) {
+	using SampleType = direct_sound::buffer_trait<int16_t, 2>::SampleType;
+
+	class entry {
+	public:
+		std::string source;
+		size_t samples = 0;
+		uint64_t hash = 0;
+		// The reference WAV, relative to the golden file. Empty for sources compared by their hash.
+		std::string reference;
+	};
+
+	const auto directory = o.golden->parent_path();
+
+	std::vector<entry> expected;
+
+	if (!o.write_golden) {
+		std::ifstream file(*o.golden);
+		if (!file) {
+			throw std::invalid_argument(string_format("failed to open %s", o.golden->u8string().c_str()));
+		}
+
+		for (std::string line; std::getline(file, line);) {
+			char source[64];
+			char reference[256] = {};
+			entry e;
+
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			if (std::sscanf(line.c_str(), "%63s %zu %llx %255s", source, &e.samples, &e.hash, reference) < 3) {
+				throw std::runtime_error(string_format("invalid line in %s: %s", o.golden->u8string().c_str(), line.c_str()));
+			}
+
+			e.source = source;
+			e.reference = reference;
+			expected.push_back(e);
+		}
+	}
+
+	std::vector<entry> actual;
+	size_t mismatches = 0;
+	size_t missing = 0;
+
+	for (const auto name : golden_sources) {
+		for (const auto samples : golden_block_sizes) {
+			options source_options;
+			source_options.source = name;
+			source_options.samples = samples;
+			source_options.duration = golden_duration;
+			source_options.device = L"offline";
+
+			const auto provider = create_source(source_options);
+			const auto frames = size_t(golden_duration * double(source_options.samples_per_second));
+			const auto output = direct_sound::render_offline<int16_t, 2>(provider, {source_options.samples_per_second, samples * 2}, frames, samples);
+			const direct_sound::wave_format format(2, 16, source_options.samples_per_second);
+
+			entry e{string_wide_to_utf8(name), samples, direct_sound::hash_samples(output), {}};
+			std::string result = "written";
+
+			if (o.write_golden) {
+				if (std::find(golden_reference_sources.begin(), golden_reference_sources.end(), std::wstring_view(name)) != golden_reference_sources.end()) {
+					e.reference = "golden/" + e.source + ".wav";
+
+					if (samples == golden_block_sizes[0]) {
+						std::filesystem::create_directories(directory / "golden");
+						direct_sound::wav_writer writer(directory / e.reference, format);
+						writer.write({reinterpret_cast<const byte*>(output.data()), ptrdiff_t(output.size() * sizeof(SampleType))});
+						writer.close();
+					}
+				}
+			} else {
+				const auto it = std::find_if(expected.begin(), expected.end(), [&e](const entry& x) { return x.source == e.source && x.samples == e.samples; });
+
+				if (it == expected.end()) {
+					result = "MISSING";
+					++missing;
+				} else if (!it->reference.empty()) {
+					const auto deviation = direct_sound::max_deviation(output, direct_sound::read_wav<SampleType>(directory / it->reference, format));
+					result = string_format("%s, deviation %.0f", deviation <= golden_tolerance ? "ok" : "MISMATCH", deviation);
+					mismatches += deviation <= golden_tolerance ? 0 : 1;
+				} else if (it->hash == e.hash) {
+					result = "ok";
+				} else {
+					result = "MISMATCH";
+					++mismatches;
+				}
+			}
+
+			std::printf("%-10s %5zu  %016llx  %s\n", e.source.c_str(), e.samples, e.hash, result.c_str());
+			actual.push_back(std::move(e));
+		}
+	}
+
+	if (o.write_golden) {
+		std::ofstream file(*o.golden);
+		file << "# Hashes of 1 s of each source's output, rendered offline by htw-avgp-cli --write-golden.\n";
+		file << "# The ladder changes its note every half buffer, so its hashes differ between block sizes by design.\n";
+		file << string_format("# Entries naming a reference WAV are compared to it within %.0f LSB instead, and their hashes are informational.\n", golden_tolerance);
+		file << "# source  samples per block  hash  [reference]\n";
+
+		for (const auto& e : actual) {
+			file << string_format("%s %zu %016llx%s%s\n", e.source.c_str(), e.samples, e.hash, e.reference.empty() ? "" : " ", e.reference.c_str());
+		}
+
+		if (!file) {
+			throw std::runtime_error(string_format("failed to write %s", o.golden->u8string().c_str()));
+		}
+
+		return 0;
+	}
+
+	std::printf("%zu mismatches, %zu missing\n", mismatches, missing);
+	return mismatches || missing ? 3 : 0;
+}
+
+int run(options o) {
+	if (o.golden) {
+		return run_golden(o);
+	}
+	if (o.drift != 0.0) {
+		return run_drift(std::move(o));
+	}
+	if (o.pool) {
+		return run_pool(std::move(o));
+	}
+	if (o.latency) {
+		return run_latency(std::move(o));
+	}
+	if (o.graph) {
+		return run_graph(std::move(o));
+	}
+
+	fill_in_defaults(o);
+
+	auto times = std::make_shared<fill_times>();
+	std::shared_ptr<direct_sound::convolver<2>> room;
+
+	if (o.reverb > 0.0) {
+		room = std::make_shared<direct_sound::convolver<2>>(direct_sound::create_room_impulse_response(o.reverb, o.samples_per_second), o.reverb_block, o.reverb_head, 1.0f, 0.3f);
+	}
+
+	auto provider = create_source(o, room);
+
+	if (room) {
+		if (!is_voice_source(o)) {
+			provider = direct_sound::create_convolution_provider<int16_t, 2>(std::move(provider), room);
+		}
+		std::printf("reverb: %zu partitions of %zu frames\n", room->partitions(), room->latency());
+	}
+
+	if (o.cache) {
+		direct_sound::render_cache cache(*o.cache);
+		const auto frames = size_t(o.duration * double(o.samples_per_second));
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto render = cache.render<int16_t, 2>(create_key(o), std::move(provider), {o.samples_per_second, o.samples * 2}, frames, o.samples);
+		const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::printf("cache %s in %.1f ms\n", cache.stats().hits ? "hit" : "miss, rendered", elapsed * 1e3);
+		provider = direct_sound::create_cached_provider<int16_t, 2>(render, false);
+	}
+
+	// Reserve enough room for a fill per 1/8 half buffer, so that recording them doesn't allocate.
+	const auto expected_fills = size_t(o.duration * double(o.samples_per_second) / double(std::max<size_t>(1, o.samples / 8))) + 16;
+	times->durations.reserve(expected_fills);
+	times->frames.reserve(expected_fills);
+	provider = create_timed_provider(std::move(provider), times);
+
+	const auto mode = o.mode == direct_sound::fill_mode::notifications ? "notifications" : "play_cursor";
+	std::printf("source %s, %zu Hz, %zu samples per half, %s, device %s\n", string_wide_to_utf8(o.source).c_str(), o.samples_per_second, o.samples, mode, string_wide_to_utf8(o.device).c_str());
+
+	const auto result = run_on_device(o, std::move(provider), times);
+
+	if (room) {
+		const auto stats = room->stats();
+		std::printf("reverb: %llu blocks, %llu late\n", stats.blocks, stats.late_blocks);
+	}
+
+	if (o.source == L"fixed") {
+		print_fixed_point_error(o);
+	}
+
+	if (o.source == L"additive") {
+		const auto seconds = std::accumulate(times->durations.begin(), times->durations.end(), 0.0);
+		const auto frames = std::accumulate(times->frames.begin(), times->frames.end(), size_t(0));
+		std::printf("additive: %.1f million partials per second\n", seconds > 0.0 ? double(frames) * double(3 * o.partials) / seconds / 1e6 : 0.0);
+	}
+
+	return result;
+}
+
+} // namespace
+
+int wmain(int argc, wchar_t** argv) {
+	if (!AfxWinInit(GetModuleHandleW(nullptr), nullptr, GetCommandLineW(), 0)) {
+		std::fprintf(stderr, "failed to initialize MFC\n");
+		return 1;
+	}
+
+	if (argc == 2 && (std::wstring(argv[1]) == L"--help" || std::wstring(argv[1]) == L"-h")) {
+		std::fwprintf(stdout, L"%s", usage);
+		return 0;
+	}
+
+	try {
+		return run(parse_options(argc, argv));
+	} catch (const std::invalid_argument& e) {
+		std::fprintf(stderr, "%s\n\n", e.what());
+		std::fwprintf(stderr, L"%s", usage);
+		return 1;
+	} catch (const std::exception& e) {
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	} catch (const winrt::hresult_error& e) {
+		std::fwprintf(stderr, L"error: %s\n", e.message().c_str());
+		return 1;
+	}
+}
@@ -39,6 +39,10 @@ BOOL MainApp::InitInstance() {
 		TRACE(traceAppMsg, 0, "Warning: if you are using MFC controls on the dialog, you cannot #define _AFX_NO_MFC_CONTROLS_IN_DIALOGS.\n");
 	}
 
+#if DIRECT_SOUND_TRACING
+	direct_sound::trace::export_chrome_trace("htw-avgp.trace.json");
+#endif
+
 	// Delete the shell manager created above.
 	pShellManager.release();
 
@@ -10,10 +10,15 @@ static std::vector<byte> load_rcdata_as_vector(int name) {
 	return data;
 }
 
+// The root note of the recording used by the guitar sampler.
+static constexpr int guitar_sample_resource = IDR_GUITAR_264;
+static constexpr double guitar_sample_frequency = 264.0;
+
 BEGIN_MESSAGE_MAP(MainDialog, CDialog)
 	ON_WM_PAINT()
 	ON_WM_QUERYDRAGICON()
 	ON_WM_HSCROLL()
+	ON_WM_TIMER()
 	ON_BN_CLICKED(IDC_C_DUR_TONELADDER, &MainDialog::OnBnClickedCDurToneladder)
 	ON_BN_CLICKED(IDC_C_DUR_TRIAD, &MainDialog::OnBnClickedCDurTriad)
 	ON_BN_CLICKED(IDC_PCM_SOUND, &MainDialog::OnBnClickedPcmSound)
@@ -49,6 +54,36 @@ BOOL MainDialog::OnInitDialog() {
 
 	ds = direct_sound::context(m_hWnd);
 
+	voices = std::make_shared<voice_allocator>(voices_polyphony, direct_sound::steal_policy::oldest);
+	voices_sequencer = std::make_shared<sequencer>(voices);
+
+	// The room is convolved with the mix before it's converted, so that the clipping it adds is counted too.
+	const auto process = [room = voices_room, meter = voices_meter](direct_sound::mix_frame<2>* frames, size_t count, size_t) {
+		room->process(frames, count);
+		meter->count_clipped(frames, count);
+	};
+
+	direct_sound::buffer_trait<int16_t, 2>::ProviderFunction voices_provider = direct_sound::create_meter_provider<int16_t, 2>(direct_sound::create_voice_allocator_provider<int16_t>(voices_sequencer, master, process), voices_meter);
+	if (voices_latency) {
+		voices_provider = direct_sound::create_latency_provider<int16_t, 2>(std::move(voices_provider), voices_latency);
+	}
+
+	voices_buffer = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
+		ds,
+		voices_samples_per_second,
+		voices_samples_per_second / 20,
+		std::move(voices_provider),
+		direct_sound::fill_mode::play_cursor
+	);
+	voices_buffer->play(true);
+
+	if (prewarm_on_startup) {
+		start_prewarm();
+	}
+
+	GetWindowTextW(m_title);
+	SetTimer(meter_timer, 100, nullptr);
+
 	return TRUE; // return TRUE unless you set the focus to a control
 }
 
@@ -97,95 +132,195 @@ void MainDialog::OnHScroll(UINT code, UINT pos, CScrollBar* scrollBar) {
 	}
 
 	auto value = reinterpret_cast<CSliderCtrl*>(scrollBar)->GetPos();
-	auto set_volume_pan = [id, value](std::unique_ptr<direct_sound::playable>& buffer) {
-		if (!buffer) {
-			return;
-		}
-
-		switch (id) {
-		case IDC_VOLUME_SLIDER:
-			buffer->set_volume(value);
-			break;
-		case IDC_PAN_SLIDER:
-			buffer->set_pan(value);
-			break;
-		}
-	};
 
-	set_volume_pan(c_dur_toneladder_buffer);
+	if (voices_latency) {
+		voices_latency->mark();
+	}
+
+	switch (id) {
+	case IDC_VOLUME_SLIDER:
+		master->set_volume(value);
+		break;
+	case IDC_PAN_SLIDER:
+		master->set_pan(value);
+		break;
+	}
+}
 
-	for (auto& buffer : piano_buffers) {
-		set_volume_pan(buffer);
+const std::shared_ptr<const direct_sound::sampler_sample>& MainDialog::get_guitar_sample() {
+	if (!guitar_sample) {
+		const auto resource = load_resource(RT_RCDATA, guitar_sample_resource);
+		const gsl::span<const int16_t> pcm(reinterpret_cast<const int16_t*>(resource.data()), resource.size() / ptrdiff_t(sizeof(int16_t)));
+		guitar_sample = std::make_shared<const direct_sound::sampler_sample>(pcm, 2, 22050, guitar_sample_frequency);
 	}
+
+	return guitar_sample;
+}
+
+// Loads and renders everything the buttons need on all cores, so that none of them has to on its first click.
+void MainDialog::start_prewarm() {
+	startup.add("guitar sample", [this]() {
+		get_guitar_sample();
+	});
+
+	for (size_t i = 0; i < sine_loops.size(); ++i) {
+		startup.add(string_format("sine loop %zu Hz", c_dur_toneladder[i]), [this, i]() {
+			sine_loops[i] = std::make_shared<const direct_sound::sine_loop>(double(c_dur_toneladder[i]), voices_samples_per_second);
+		});
+	}
+
+	startup.add("pcm sound", [this]() {
+		pcm_sound = load_rcdata_as_vector(IDR_SAMPLE_SOUND);
+	});
+
+	startup.start();
+
+	// The PCM sound's buffer is created right here instead, as DirectSound is used from the UI thread only.
+	const direct_sound::wave_format format(2, 16, pcm_sound_samples_per_second, false);
+	ds_pool.reserve(format, pcm_sound_samples_per_second * 2 * format.block_align(), 1);
+}
+
+// Waits for the startup tasks. Whatever a failed task should have loaded is still missing afterwards,
+// and is loaded on its first use instead, just like without prewarm_on_startup.
+void MainDialog::wait_for_prewarm() {
+	try {
+		startup.wait();
+	} catch (const std::exception& e) {
+		TRACE(traceAppMsg, 0, "Warning: loading on startup failed, loading on first use instead: %s\n", e.what());
+	} catch (...) {
+		TRACE(traceAppMsg, 0, "Warning: loading on startup failed, loading on first use instead.\n");
+	}
+}
+
+// Writes how long each startup task took to the debugger's output, once all of them are done.
+void MainDialog::trace_prewarm_timings() {
+	if (startup_timings_traced || !startup.ready()) {
+		return;
+	}
+
+	for (const auto& timing : startup.timings()) {
+		TRACE(traceAppMsg, 0, "Startup: %s took %.1f ms\n", timing.name.c_str(), timing.duration.count() * 1000.0);
+	}
+	startup_timings_traced = true;
+}
+
+// Creates a voice playing the note of c_dur_toneladder at index `note`.
+MainDialog::voice_allocator::VoiceType MainDialog::create_voice(size_t note) {
+	wait_for_prewarm();
+
+	const auto frequency = c_dur_toneladder[note];
+
+	if (use_guitar_sound) {
+		return direct_sound::sampler_voice<2>(get_guitar_sample(), double(frequency), voices_samples_per_second, true);
+	}
+
+	auto& loop = sine_loops[note];
+	if (!loop) {
+		loop = std::make_shared<const direct_sound::sine_loop>(double(frequency), voices_samples_per_second);
+	}
+
+	return direct_sound::wavetable_voice<2>(loop->table());
+}
+
+// Like create_voice(), but instead of a pure sine tone the triad plays a richer one, made up of several harmonics.
+MainDialog::voice_allocator::VoiceType MainDialog::create_triad_voice(size_t note) {
+	if (use_guitar_sound) {
+		return create_voice(note);
+	}
+
+	return direct_sound::additive_voice<2>(double(c_dur_toneladder[note]), voices_samples_per_second, triad_partials);
+}
+
+void MainDialog::OnTimer(UINT_PTR id) {
+	switch (id) {
+	case toneladder_timer:
+		schedule_toneladder();
+		break;
+	case meter_timer:
+		update_meter();
+		break;
+	}
+
+	CDialog::OnTimer(id);
+}
+
+// Keeps a full round of the tone ladder scheduled ahead of the sequencer's position.
+// The timer only needs to fire often enough for that, the notes themselves play sample-accurately.
+void MainDialog::schedule_toneladder() {
+	const auto position = voices_sequencer->position();
+	const auto note_samples = use_guitar_sound ? guitar_toneladder_note_samples : sine_toneladder_note_samples;
+	const auto horizon = position + note_samples * c_dur_toneladder.size();
+
+	// Start over from the current position if the timer fell behind (or on the first call).
+	if (toneladder_next < position) {
+		toneladder_next = position;
+	}
+
+	for (; toneladder_next < horizon; toneladder_next += note_samples) {
+		const auto note = voices_sequencer->note_on(toneladder_next, create_voice(toneladder_index));
+		voices_sequencer->note_off(toneladder_next + note_samples, note);
+		toneladder_index = (toneladder_index + 1) % c_dur_toneladder.size();
+	}
+}
+
+// Shows the output level of the voices in the title bar, so that clipping from too many voices becomes visible.
+void MainDialog::update_meter() {
+	const auto readings = voices_meter->readings();
+	const auto peak = std::max(readings.peak[0], readings.peak[1]);
+	const auto clipped = readings.clipped[0] + readings.clipped[1];
+
+	CString title;
+	title.Format(L"%s - Peak %.1f dB, %llu samples clipped", m_title.GetString(), std::max(-99.9f, direct_sound::level_to_db(peak)), clipped);
+
+	if (voices_latency) {
+		// The probe can't see the room's delay, as the convolver adds it inside the provider.
+		const auto room = double(voices_room->latency()) / double(voices_samples_per_second);
+		const auto latency = voices_latency->stats();
+		title.AppendFormat(L", latency median %.1f ms, max %.1f ms (including %.1f ms of the room)", (latency.median + room) * 1e3, (latency.max + room) * 1e3, room * 1e3);
+	}
+
+	if (startup.ready()) {
+		title.AppendFormat(L", ready in %.0f ms", startup.time_to_ready().count() * 1000.0);
+		trace_prewarm_timings();
+	} else if (startup.started()) {
+		title.AppendFormat(L", loading %zu/%zu", startup.done(), startup.total());
+	}
+
+	SetWindowTextW(title);
 }
 
 void MainDialog::OnBnClickedCDurToneladder() {
 	auto button = static_cast<CButton*>(GetDlgItem(IDC_C_DUR_TONELADDER));
 	auto isChecked = (button->GetState() & BST_CHECKED) == BST_CHECKED;
 
+	KillTimer(toneladder_timer);
+	voices_sequencer->clear();
+	toneladder_next = 0;
+	toneladder_index = 0;
+
 	if (!isChecked) {
-		c_dur_toneladder_buffer.reset();
 		return;
 	}
 
-	if (use_guitar_sound) {
-		std::vector<std::vector<byte>> pcms;
-		for (auto rc : guitar_c_dur_toneladder) {
-			pcms.emplace_back(load_rcdata_as_vector(rc));
-		}
-
-		c_dur_toneladder_buffer = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
-			ds,
-			22050,
-			22050,
-			direct_sound::create_pcm_series_provider<int16_t, 2>(pcms)
-		);
-	} else {
-		std::vector<size_t> toneladder(c_dur_toneladder.begin(), c_dur_toneladder.end());
-		c_dur_toneladder_buffer = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
-			ds,
-			44100,
-			44100 / 4,
-			direct_sound::create_sine_wave_toneladder_provider<int16_t, 2>(toneladder)
-		);
-	}
-
-	c_dur_toneladder_buffer->play(true);
+	schedule_toneladder();
+	SetTimer(toneladder_timer, 250, nullptr);
 }
 
 void MainDialog::OnBnClickedCDurTriad() {
 	auto button = static_cast<CButton*>(GetDlgItem(IDC_C_DUR_TRIAD));
 	auto isChecked = (button->GetState() & BST_CHECKED) == BST_CHECKED;
 
-	if (!isChecked) {
-		for (auto& buffer : c_dur_triad_buffer) {
-			buffer.reset();
-		}
-		return;
+	for (auto& id : c_dur_triad_voices) {
+		voices->note_off(id);
+		id = 0;
 	}
 
-	for (size_t i = 0; i < c_dur_triad_buffer.size(); ++i) {
-		if (use_guitar_sound) {
-			const auto pcm = load_rcdata_as_vector(guitar_c_dur_toneladder[i * 2]);
-			c_dur_triad_buffer[i] = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
-				ds,
-				22050,
-				22050,
-				direct_sound::create_pcm_provider<int16_t, 2>(pcm, true)
-			);
-		} else {
-			auto tone = c_dur_toneladder[i * 2];
-			c_dur_triad_buffer[i] = std::make_unique<direct_sound::single_buffer<int16_t, 2>>(
-				ds,
-				44100,
-				44100,
-				direct_sound::create_sine_wave_provider<int16_t, 2>(tone)
-			);
-		}
+	if (!isChecked) {
+		return;
 	}
 
-	for (auto& buffer : c_dur_triad_buffer) {
-		buffer->play(true);
+	for (size_t i = 0; i < c_dur_triad_voices.size(); ++i) {
+		c_dur_triad_voices[i] = voices->note_on(create_triad_voice(i * 2));
 	}
 }
 
@@ -198,12 +333,22 @@ void MainDialog::OnBnClickedPcmSound() {
 		return;
 	}
 
-	const auto pcm = load_rcdata_as_vector(IDR_SAMPLE_SOUND);
+	wait_for_prewarm();
+
+	if (pcm_sound.empty()) {
+		pcm_sound = load_rcdata_as_vector(IDR_SAMPLE_SOUND);
+	}
+
+	// The recording is played in the same room as the voices, but can't share their convolver: It runs at another rate
+	// and each convolver may only be used by a single buffer's thread. A new one also starts out without the last tail.
+	// Each fill spans dozens of blocks, which a worker thread couldn't get ahead of, so all partitions are convolved inline.
+	const auto room = std::make_shared<direct_sound::convolver<2>>(direct_sound::create_room_impulse_response(0.8, pcm_sound_samples_per_second), 256, 0, 1.0f, 0.2f);
+
 	pcm_buffer = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
-		ds,
-		22050,
-		22050,
-		direct_sound::create_pcm_provider<int16_t, 2>(pcm, true)
+		ds_pool,
+		pcm_sound_samples_per_second,
+		pcm_sound_samples_per_second,
+		direct_sound::create_convolution_provider<int16_t, 2>(direct_sound::create_pcm_provider<int16_t, 2>(pcm_sound, true), room)
 	);
 	pcm_buffer->play(true);
 }
@@ -217,29 +362,18 @@ void MainDialog::OnBnClickedPiano(UINT sender) {
 	auto button = static_cast<CButton*>(GetDlgItem(sender));
 	auto isChecked = (button->GetState() & BST_CHECKED) == BST_CHECKED;
 	auto index = sender - IDC_PIANO_264;
+	auto& id = piano_voices[index];
+
+	if (voices_latency) {
+		voices_latency->mark();
+	}
+
+	voices->note_off(id);
+	id = 0;
 
 	if (!isChecked) {
-		piano_buffers[index].reset();
 		return;
 	}
 
-	if (use_guitar_sound) {
-		const auto pcm = load_rcdata_as_vector(guitar_c_dur_toneladder[index]);
-		piano_buffers[index] = std::make_unique<direct_sound::double_buffer<int16_t, 2>>(
-			ds,
-			22050,
-			22050,
-			direct_sound::create_pcm_provider<int16_t, 2>(pcm, true)
-		);
-	} else {
-		auto tone = c_dur_toneladder[index];
-		piano_buffers[index] = std::make_unique<direct_sound::single_buffer<int16_t, 2>>(
-			ds,
-			44100,
-			44100,
-			direct_sound::create_sine_wave_provider<int16_t, 2>(tone)
-		);
-	}
-
-	piano_buffers[index]->play(true);
+	id = voices->note_on(create_voice(index));
 }
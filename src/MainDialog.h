@@ -18,25 +18,74 @@ private:
 		495, // h
 		528, // c
 	}};
-	static constexpr std::array<int, 8> guitar_c_dur_toneladder = {{
-		IDR_GUITAR_264,
-		IDR_GUITAR_297,
-		IDR_GUITAR_330,
-		IDR_GUITAR_352,
-		IDR_GUITAR_396,
-		IDR_GUITAR_440,
-		IDR_GUITAR_495,
-		IDR_GUITAR_528,
-	}};
+
+	using voice_allocator = direct_sound::voice_allocator<2, direct_sound::wavetable_voice<2>, direct_sound::sampler_voice<2>, direct_sound::additive_voice<2>>;
+	using sequencer = direct_sound::sequencer<voice_allocator>;
+
+	static constexpr size_t voices_samples_per_second = 44100;
+	static constexpr size_t voices_polyphony = 16;
+	// The note lengths of the tone ladders before they were sequenced: The guitar recordings are a second long,
+	// the sine tone ladder changed its note every quarter second.
+	static constexpr size_t guitar_toneladder_note_samples = voices_samples_per_second;
+	static constexpr size_t sine_toneladder_note_samples = voices_samples_per_second / 4;
+	static constexpr UINT_PTR toneladder_timer = 1;
+	static constexpr UINT_PTR meter_timer = 2;
+	// Loads and renders all sounds on startup, in parallel, instead of on their first use.
+	static constexpr bool prewarm_on_startup = true;
+	// Measures the latency from the piano keys and the sliders until the voices are played, shown in the title bar.
+	static constexpr bool measure_latency = false;
+	static constexpr size_t pcm_sound_samples_per_second = 22050;
 
 	HICON m_hIcon;
+	CString m_title;
 	direct_sound::context ds;
-	std::unique_ptr<direct_sound::playable> c_dur_toneladder_buffer;
-	std::array<std::unique_ptr<direct_sound::playable>, 3> c_dur_triad_buffer;
+	// Recycles the buffers of sounds toggled on and off, instead of creating new ones each time.
+	direct_sound::buffer_pool ds_pool{ds};
 	std::unique_ptr<direct_sound::playable> pcm_buffer;
-	std::array<std::unique_ptr<direct_sound::playable>, 9> piano_buffers;
 	bool use_guitar_sound = false;
 
+	// The volume and pan sliders, applied while rendering the tone ladder and the voices.
+	std::shared_ptr<direct_sound::gain_pan> master = std::make_shared<direct_sound::gain_pan>();
+
+	// The tone ladder, the triad and the piano keys share a single buffer into which all their voices are mixed.
+	// The tone ladder's notes are scheduled ahead of time on the sequencer, the others are played right away.
+	std::shared_ptr<voice_allocator> voices;
+	std::shared_ptr<sequencer> voices_sequencer;
+	std::unique_ptr<direct_sound::playable> voices_buffer;
+	std::shared_ptr<direct_sound::meter<int16_t, 2>> voices_meter = std::make_shared<direct_sound::meter<int16_t, 2>>();
+	std::shared_ptr<direct_sound::latency_probe> voices_latency = measure_latency ? std::make_shared<direct_sound::latency_probe>() : nullptr;
+	// A small room the voices' mix is played in. The partitions after the first 12, more than a fill, are convolved on a worker thread.
+	std::shared_ptr<direct_sound::convolver<2>> voices_room = std::make_shared<direct_sound::convolver<2>>(direct_sound::create_room_impulse_response(0.8, voices_samples_per_second), 256, 12, 1.0f, 0.2f);
+	uint64_t toneladder_next = 0;
+	size_t toneladder_index = 0;
+	std::array<direct_sound::voice_id, 3> c_dur_triad_voices = {};
+	std::array<direct_sound::voice_id, c_dur_toneladder.size()> piano_voices = {};
+
+	// A single guitar recording, pitch-shifted to any note of the piano.
+	std::shared_ptr<const direct_sound::sampler_sample> guitar_sample;
+
+	// The shortest seamless loop of each note's sine tone, shared by all voices playing it.
+	std::array<std::shared_ptr<const direct_sound::sine_loop>, c_dur_toneladder.size()> sine_loops;
+
+	// The harmonics of the triad's organ-like tone.
+	std::vector<direct_sound::additive_partial> triad_partials = direct_sound::create_harmonic_partials(16, 1.5);
+
+	std::vector<byte> pcm_sound;
+
+	// Fills guitar_sample, sine_loops and pcm_sound on startup. Must be declared after them,
+	// as its destructor waits for its tasks. Anything using them must call wait_for_prewarm() first.
+	direct_sound::prewarm startup;
+	bool startup_timings_traced = false;
+
+	const std::shared_ptr<const direct_sound::sampler_sample>& get_guitar_sample();
+	void start_prewarm();
+	void wait_for_prewarm();
+	void trace_prewarm_timings();
+	voice_allocator::VoiceType create_voice(size_t note);
+	voice_allocator::VoiceType create_triad_voice(size_t note);
+	void schedule_toneladder();
+	void update_meter();
+
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX) override;
 	virtual BOOL OnInitDialog() override;
@@ -44,6 +93,7 @@ protected:
 	afx_msg void OnPaint();
 	afx_msg HCURSOR OnQueryDragIcon();
 	afx_msg void OnHScroll(UINT code, UINT pos, CScrollBar* scrollBar);
+	afx_msg void OnTimer(UINT_PTR id);
 	afx_msg void OnBnClickedCDurToneladder();
 	afx_msg void OnBnClickedCDurTriad();
 	afx_msg void OnBnClickedPcmSound();
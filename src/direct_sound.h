@@ -2,6 +2,30 @@
 
 #include "stdafx.h"
 
+#include "direct_sound_trace.h"
+#include "direct_sound_backend.h"
 #include "direct_sound_context.h"
+#include "direct_sound_pool.h"
 #include "direct_sound_buffers.h"
+#include "direct_sound_fixed.h"
 #include "direct_sound_providers.h"
+#include "direct_sound_parameters.h"
+#include "direct_sound_sampler.h"
+#include "direct_sound_voices.h"
+#include "direct_sound_graph.h"
+#include "direct_sound_wavetable.h"
+#include "direct_sound_pluck.h"
+#include "direct_sound_additive.h"
+#include "direct_sound_channels.h"
+#include "direct_sound_expressions.h"
+#include "direct_sound_queue.h"
+#include "direct_sound_sequencer.h"
+#include "direct_sound_multi_output.h"
+#include "direct_sound_fft.h"
+#include "direct_sound_convolution.h"
+#include "direct_sound_meter.h"
+#include "direct_sound_latency.h"
+#include "direct_sound_render.h"
+#include "direct_sound_cache.h"
+#include "direct_sound_virtual_device.h"
+#include "direct_sound_prewarm.h"
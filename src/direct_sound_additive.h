@@ -0,0 +1,256 @@
+#pragma once
+
+namespace direct_sound {
+
+// A sine partial of an additive_voice.
+class additive_partial {
+public:
+	// Frequency relative to the voice's, e.g. 2 for the first overtone of a harmonic sound.
+	double ratio = 1.0;
+	// Peak level, linear.
+	double amplitude = 1.0;
+	// Time constant of the attack in seconds, 0 starting at full level.
+	double attack = 0.005;
+	// Seconds until the partial decayed by 60 dB, 0 sustaining it forever.
+	double decay = 0.0;
+};
+
+// Creates `count` harmonics with levels falling off by 1/n^rolloff and normalized to sum up to 1, so that they never clip.
+// With a decay, the n-th harmonic decays n times as fast as the fundamental, which makes the tone mellower over time.
+inline std::vector<additive_partial> create_harmonic_partials(size_t count, double rolloff = 1.0, double decay = 0.0, double attack = 0.005) {
+	if (count == 0) {
+		throw std::invalid_argument("count must not be 0");
+	}
+
+	std::vector<additive_partial> result(count);
+	double sum = 0.0;
+
+	for (size_t i = 0; i < count; ++i) {
+		const auto n = double(i + 1);
+		auto& partial = result[i];
+		partial.ratio = n;
+		partial.amplitude = 1.0 / std::pow(n, rolloff);
+		partial.attack = attack;
+		partial.decay = decay / n;
+		sum += partial.amplitude;
+	}
+
+	for (auto& partial : result) {
+		partial.amplitude /= sum;
+	}
+
+	return result;
+}
+
+namespace detail {
+
+// Voices finish once all of their partials decayed below this level, which is -80 dBFS.
+constexpr double additive_silence = 1e-4;
+
+// Envelopes below this are flushed to 0.
+constexpr float additive_tiny = 1e-10f;
+
+} // namespace detail
+
+// Sums up any number of sine partials, each with its own attack and decay envelope.
+//
+// The partials are computed 4 at a time with SSE2. Instead of calling sin() per sample, each one is
+// a recursive oscillator: A phasor rotated by the partial's phase increment with every sample, which is
+// a complex multiplication. The envelopes are recursive as well, a multiplication per sample each.
+// The rounding errors of the rotation would slowly change the phasor's length, which is why it's
+// renormalized every 256 frames since the voice started, however the blocks are split.
+// Partials at or above the Nyquist frequency are dropped, as they'd alias.
+template<size_t ChannelCount>
+class additive_voice {
+public:
+	additive_voice() = default;
+
+	explicit additive_voice(double frequency, size_t samples_per_second, const std::vector<additive_partial>& partials) {
+		if (!(frequency > 0.0) || samples_per_second == 0) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+
+		const auto rate = double(samples_per_second);
+		bool sustained = false;
+		double remaining = 0.0;
+
+		for (const auto& partial : partials) {
+			if (!(partial.ratio > 0.0) || !(partial.amplitude >= 0.0) || !(partial.attack >= 0.0) || !(partial.decay >= 0.0)) {
+				throw std::invalid_argument(string_format("invalid partial: ratio %f, amplitude %f, attack %f, decay %f", partial.ratio, partial.amplitude, partial.attack, partial.decay));
+			}
+
+			const auto f = frequency * partial.ratio;
+			if (f >= rate / 2.0 || partial.amplitude == 0.0) {
+				continue;
+			}
+
+			if (m_partials % 4 == 0) {
+				m_groups.emplace_back();
+			}
+
+			auto& g = m_groups.back();
+			const auto lane = m_partials % 4;
+			const auto w = 2.0 * M_PI * f / rate;
+
+			g.re[lane] = 1.0f;
+			g.im[lane] = 0.0f;
+			g.cos[lane] = float(std::cos(w));
+			g.sin[lane] = float(std::sin(w));
+			g.amplitude[lane] = float(partial.amplitude);
+			g.attack[lane] = partial.attack > 0.0 ? 1.0f : 0.0f;
+			g.attack_step[lane] = partial.attack > 0.0 ? float(std::exp(-1.0 / (partial.attack * rate))) : 0.0f;
+			g.decay[lane] = 1.0f;
+			g.decay_step[lane] = partial.decay > 0.0 ? float(std::pow(10.0, -3.0 / (partial.decay * rate))) : 1.0f;
+			++m_partials;
+
+			// The voice finishes once all of its partials decayed below detail::additive_silence.
+			if (partial.decay > 0.0) {
+				remaining = std::max(remaining, partial.decay * std::log10(partial.amplitude / detail::additive_silence) / 3.0);
+			} else {
+				sustained = true;
+			}
+		}
+
+		if (m_partials == 0) {
+			throw std::invalid_argument(string_format("no partial of %f Hz is below the Nyquist frequency", frequency));
+		}
+
+		m_remaining = sustained ? std::numeric_limits<uint64_t>::max() : uint64_t(remaining * rate) + 1;
+	}
+
+	size_t partials() const {
+		return m_partials;
+	}
+
+	bool finished() const {
+		return m_remaining == 0;
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		// The partials are summed up in chunks on the stack, which end at multiples of chunk_size frames since
+		// the voice started. Only there are the phasors renormalized, so that any split into blocks sounds the same.
+		alignas(16) float sum[chunk_size * 4];
+
+		for (size_t done = 0; done < count;) {
+			const auto offset = size_t(m_position % chunk_size);
+			const auto n = std::min(count - done, chunk_size - offset);
+			const bool renormalize = offset + n == chunk_size;
+
+			std::fill(sum, sum + n * 4, 0.0f);
+
+			for (auto& g : m_groups) {
+				render_group(g, sum, n, renormalize);
+			}
+
+			// Each sample's 4 lanes hold the sums of every 4th partial.
+			for (size_t i = 0; i < n; ++i) {
+				const auto lanes = &sum[i * 4];
+				frames[done + i].fill((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+			}
+
+			m_position += n;
+			done += n;
+		}
+
+		m_remaining -= std::min<uint64_t>(m_remaining, count);
+	}
+
+private:
+	static constexpr size_t chunk_size = 256;
+
+	class group {
+	public:
+		std::array<float, 4> re = {};
+		std::array<float, 4> im = {};
+		std::array<float, 4> cos = {};
+		std::array<float, 4> sin = {};
+		std::array<float, 4> amplitude = {};
+		std::array<float, 4> attack = {};
+		std::array<float, 4> attack_step = {};
+		std::array<float, 4> decay = {};
+		std::array<float, 4> decay_step = {};
+	};
+
+	// Adds the 4 partials of `g` to the lanes of `sum`.
+	void render_group(group& g, float* sum, size_t count, bool renormalize) noexcept {
+#if DIRECT_SOUND_SSE2
+		const auto c = _mm_loadu_ps(g.cos.data());
+		const auto s = _mm_loadu_ps(g.sin.data());
+		const auto amplitude = _mm_loadu_ps(g.amplitude.data());
+		const auto attack_step = _mm_loadu_ps(g.attack_step.data());
+		const auto decay_step = _mm_loadu_ps(g.decay_step.data());
+		const auto one = _mm_set1_ps(1.0f);
+
+		auto re = _mm_loadu_ps(g.re.data());
+		auto im = _mm_loadu_ps(g.im.data());
+		auto attack = _mm_loadu_ps(g.attack.data());
+		auto decay = _mm_loadu_ps(g.decay.data());
+
+		for (size_t i = 0; i < count; ++i) {
+			const auto envelope = _mm_mul_ps(_mm_mul_ps(amplitude, decay), _mm_sub_ps(one, attack));
+			_mm_storeu_ps(sum + i * 4, _mm_add_ps(_mm_loadu_ps(sum + i * 4), _mm_mul_ps(im, envelope)));
+
+			const auto next_re = _mm_sub_ps(_mm_mul_ps(re, c), _mm_mul_ps(im, s));
+			im = _mm_add_ps(_mm_mul_ps(re, s), _mm_mul_ps(im, c));
+			re = next_re;
+			attack = _mm_mul_ps(attack, attack_step);
+			decay = _mm_mul_ps(decay, decay_step);
+		}
+
+		if (renormalize) {
+			// A Newton step towards 1/sqrt(length^2), which is accurate enough as the length is always close to 1.
+			const auto length = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+			const auto scale = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(3.0f), length), _mm_set1_ps(0.5f));
+			re = _mm_mul_ps(re, scale);
+			im = _mm_mul_ps(im, scale);
+
+			// Left alone, both envelopes would end up as denormals, which are very slow to compute with.
+			const auto tiny = _mm_set1_ps(detail::additive_tiny);
+			attack = _mm_and_ps(attack, _mm_cmpgt_ps(attack, tiny));
+			decay = _mm_and_ps(decay, _mm_cmpgt_ps(decay, tiny));
+		}
+
+		_mm_storeu_ps(g.re.data(), re);
+		_mm_storeu_ps(g.im.data(), im);
+		_mm_storeu_ps(g.attack.data(), attack);
+		_mm_storeu_ps(g.decay.data(), decay);
+#else
+		for (size_t lane = 0; lane < 4; ++lane) {
+			auto re = g.re[lane];
+			auto im = g.im[lane];
+			auto attack = g.attack[lane];
+			auto decay = g.decay[lane];
+
+			for (size_t i = 0; i < count; ++i) {
+				sum[i * 4 + lane] += im * g.amplitude[lane] * decay * (1.0f - attack);
+
+				const auto next_re = re * g.cos[lane] - im * g.sin[lane];
+				im = re * g.sin[lane] + im * g.cos[lane];
+				re = next_re;
+				attack *= g.attack_step[lane];
+				decay *= g.decay_step[lane];
+			}
+
+			if (renormalize) {
+				const auto scale = (3.0f - (re * re + im * im)) * 0.5f;
+				re *= scale;
+				im *= scale;
+				attack = attack > detail::additive_tiny ? attack : 0.0f;
+				decay = decay > detail::additive_tiny ? decay : 0.0f;
+			}
+
+			g.re[lane] = re;
+			g.im[lane] = im;
+			g.attack[lane] = attack;
+			g.decay[lane] = decay;
+		}
+#endif
+	}
+
+	std::vector<group> m_groups;
+	uint64_t m_position = 0;
+	size_t m_partials = 0;
+	uint64_t m_remaining = 0;
+};
+
+} // namespace direct_sound
@@ -0,0 +1,88 @@
+#pragma once
+
+namespace direct_sound {
+
+// Volume is specified in hundredths of a decibel and pan as the attenuation of the opposite channel,
+// both in the value ranges DirectSound uses (DSBVOLUME_MIN/MAX and DSBPAN_LEFT/RIGHT).
+constexpr int volume_min = -10000;
+constexpr int volume_max = 0;
+constexpr int pan_left = -10000;
+constexpr int pan_right = 10000;
+
+// Converts a volume or pan attenuation from hundredths of a decibel into a linear gain.
+inline float attenuation_to_gain(int hundredths_db) noexcept {
+	return hundredths_db <= volume_min ? 0.0f : float(std::pow(10.0, double(hundredths_db) / 2000.0));
+}
+
+class wave_format {
+public:
+	constexpr wave_format() : channels(0), bits_per_sample(0), samples_per_second(0), floating_point(false) {
+	}
+
+	constexpr wave_format(size_t channels, size_t bits_per_sample, size_t samples_per_second, bool floating_point = false) : channels(channels), bits_per_sample(bits_per_sample), samples_per_second(samples_per_second), floating_point(floating_point) {
+	}
+
+	constexpr size_t block_align() const {
+		return channels * bits_per_sample / 8;
+	}
+
+	constexpr size_t bytes_per_second() const {
+		return samples_per_second * block_align();
+	}
+
+	constexpr bool operator==(const wave_format& other) const {
+		return channels == other.channels && bits_per_sample == other.bits_per_sample && samples_per_second == other.samples_per_second && floating_point == other.floating_point;
+	}
+
+	constexpr bool operator!=(const wave_format& other) const {
+		return !(*this == other);
+	}
+
+	size_t channels;
+	size_t bits_per_sample;
+	size_t samples_per_second;
+	bool floating_point;
+};
+
+// A ring buffer owned by a backend, which is played back by the output device.
+// All offsets and lengths are in bytes.
+class backend_buffer {
+public:
+	using RegionPairType = std::array<gsl::span<byte>, 2>;
+
+	virtual ~backend_buffer() {}
+
+	virtual size_t size_bytes() const = 0;
+
+	// Like IDirectSoundBuffer8::Lock(), the second region is non-empty if the range wraps around the end of the buffer.
+	virtual RegionPairType lock(size_t offset, size_t length) = 0;
+	virtual void unlock(const RegionPairType& regions) = 0;
+
+	virtual void play(bool looping) = 0;
+	virtual void stop() = 0;
+	virtual void set_volume(int volume) = 0;
+	// Has no effect on buffers with more than two channels, which DirectSound can't pan.
+	virtual void set_pan(int pan) = 0;
+
+	// Returns the play and write cursor. Data between the two is about to be played and must not be written.
+	virtual std::pair<size_t, size_t> position() const = 0;
+
+	// Moves the play cursor of a stopped buffer, e.g. back to the start before reusing it.
+	virtual void set_position(size_t offset) = 0;
+
+	// Calls `callback` from a background thread whenever playback reaches one of the `offsets`.
+	// Replaces any previous notifications and waits for running callbacks to finish, which is why it must
+	// not be called from within a callback. Passing no offsets removes all notifications, which is allowed
+	// at any time. New offsets may only be set while the buffer is stopped, as DirectSound refuses them otherwise.
+	virtual void set_notifications(std::vector<size_t> offsets, std::function<void()> callback) = 0;
+};
+
+// An output device, creating the buffers which it then plays back.
+class backend {
+public:
+	virtual ~backend() {}
+
+	virtual std::unique_ptr<backend_buffer> create_buffer(const wave_format& format, size_t bytes) const = 0;
+};
+
+} // namespace direct_sound
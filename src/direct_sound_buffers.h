@@ -2,40 +2,6 @@
 
 namespace direct_sound {
 
-namespace detail {
-
-class handle_deleter {
-public:
-	constexpr handle_deleter() {}
-	handle_deleter(handle_deleter&&) = default;
-	handle_deleter& operator=(handle_deleter&&) = default;
-	handle_deleter(const handle_deleter&) = default;
-	handle_deleter& operator=(const handle_deleter&) = default;
-
-	void operator()(HANDLE handle) const {
-		if (!CloseHandle(handle)) {
-			winrt::throw_last_error();
-		}
-	};
-};
-
-class wait_handle_deleter {
-public:
-	constexpr wait_handle_deleter() {}
-	wait_handle_deleter(wait_handle_deleter&&) = default;
-	wait_handle_deleter& operator=(wait_handle_deleter&&) = default;
-	wait_handle_deleter(const wait_handle_deleter&) = default;
-	wait_handle_deleter& operator=(const wait_handle_deleter&) = default;
-
-	void operator()(HANDLE handle) const {
-		if (!UnregisterWaitEx(handle, INVALID_HANDLE_VALUE)) {
-			winrt::throw_last_error();
-		}
-	};
-};
-
-} // namespace detail
-
 class playable {
 public:
 	virtual ~playable() {}
@@ -51,7 +17,7 @@ class buffer_lock {
 public:
 	using SpanPairType = std::array<gsl::span<SampleType>, 2>;
 
-	explicit buffer_lock(winrt::com_ptr<IDirectSoundBuffer8> buffer, SpanPairType spans) noexcept : m_buffer(std::move(buffer)), m_spans(spans) {
+	explicit buffer_lock(std::shared_ptr<backend_buffer> buffer, backend_buffer::RegionPairType regions) noexcept : m_buffer(std::move(buffer)), m_regions(regions) {
 	}
 
 	buffer_lock(buffer_lock&&) = default;
@@ -62,20 +28,21 @@ public:
 
 	~buffer_lock() {
 		if (m_buffer) {
-			m_buffer->Unlock(
-				static_cast<void*>(m_spans[0].data()), static_cast<DWORD>(m_spans[0].size_bytes()),
-				static_cast<void*>(m_spans[1].data()), static_cast<DWORD>(m_spans[1].size_bytes())
-			);
+			DIRECT_SOUND_TRACE_SCOPE("Unlock", m_buffer.get(), trace::no_half, size_t(m_regions[0].size() + m_regions[1].size()) / sizeof(SampleType));
+			m_buffer->unlock(m_regions);
 		}
 	}
 
 	SpanPairType spans() const {
-		return m_spans;
+		return {{
+			{reinterpret_cast<SampleType*>(m_regions[0].data()), ptrdiff_t(size_t(m_regions[0].size()) / sizeof(SampleType))},
+			{reinterpret_cast<SampleType*>(m_regions[1].data()), ptrdiff_t(size_t(m_regions[1].size()) / sizeof(SampleType))},
+		}};
 	}
 
 private:
-	winrt::com_ptr<IDirectSoundBuffer8> m_buffer;
-	SpanPairType m_spans;
+	std::shared_ptr<backend_buffer> m_buffer;
+	backend_buffer::RegionPairType m_regions;
 };
 
 class buffer_info {
@@ -88,6 +55,10 @@ public:
 
 	size_t samples_per_second;
 	size_t samples;
+
+	// The samples queued in front of the play cursor when a provider is invoked, i.e. how long until the first
+	// sample it writes is played. Set by double_buffer, 0 wherever there's no play cursor, like when rendering offline.
+	size_t samples_ahead = 0;
 };
 
 template<typename ValueType, size_t ChannelCount>
@@ -101,72 +72,71 @@ public:
 	using ProviderFunction = std::function<void(SpanPairType spans, buffer_info info)>;
 };
 
+// Intermediate, unclipped sample format used by voices before they are converted to a buffer's ValueType.
+template<size_t ChannelCount>
+using mix_frame = typename buffer_trait<float, ChannelCount>::SampleType;
+
 template<typename ValueType, size_t ChannelCount>
 class single_buffer : public buffer_trait<ValueType, ChannelCount>, public playable {
 public:
 	explicit single_buffer() noexcept {
 	}
 
-	explicit single_buffer(const context& context, size_t samples_per_second, size_t samples, ProviderFunction provider = nullptr) {
+	explicit single_buffer(const backend& backend, size_t samples_per_second, size_t samples, ProviderFunction provider = nullptr) {
 		if (samples_per_second < 128 || samples_per_second > 192000) {
 			throw std::invalid_argument(string_format("invalid argument for samples_per_second: %zu > 192000", samples_per_second));
 		}
 
 		const auto block_align = ChannelCount * sizeof(ValueType);
-		const auto bytes_per_sec = samples_per_second * block_align;
-		const auto buffer_bytes = samples * block_align;
 
 		if (samples > std::numeric_limits<DWORD>::max() / block_align) {
 			throw std::invalid_argument(string_format("invalid argument for samples (overflow): %zu", samples));
 		}
 
-		WAVEFORMATEX format = {};
-		format.wFormatTag = WAVE_FORMAT_PCM;
-		format.nChannels = WORD(ChannelCount);
-		format.wBitsPerSample = WORD(sizeof(ValueType) * 8);
-		format.nSamplesPerSec = DWORD(samples_per_second);
-		format.nBlockAlign = WORD(block_align);
-		format.nAvgBytesPerSec = DWORD(bytes_per_sec);
-
-		DSBUFFERDESC description = {};
-		description.dwSize = sizeof(description);
-		description.dwFlags = DSBCAPS_CTRLFREQUENCY | DSBCAPS_CTRLPAN | DSBCAPS_CTRLVOLUME | DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_GLOBALFOCUS;
-		description.dwBufferBytes = DWORD(buffer_bytes);
-		description.lpwfxFormat = &format;
-
-		m_com = context.create_sound_buffer(description);
+		const wave_format format(ChannelCount, sizeof(ValueType) * 8, samples_per_second, std::is_floating_point_v<ValueType>);
+
+		m_buffer = backend.create_buffer(format, samples * block_align);
 		m_info = buffer_info(samples_per_second, samples);
 
+		// The backend hands out pointers into a single allocation, so checking
+		// the alignment of the whole buffer once here covers every later lock.
+		auto lock = lock_samples(0, samples);
+		const auto spans = lock.spans();
+
+		constexpr auto align_mask = alignof(SampleType)-1;
+		if ((size_t(spans[0].data()) & align_mask) != 0 || (size_t(spans[1].data()) & align_mask) != 0) {
+			throw std::runtime_error("bad buffer alignment");
+		}
+
 		if (provider) {
-			auto lock = lock_samples(0, samples);
-			provider(lock.spans(), m_info);
+			provider(spans, m_info);
 		}
 	}
 
 	void play(bool looping = false) override {
-		winrt::check_hresult(m_com->Play(0, 0, looping ? DSBPLAY_LOOPING : 0));
+		m_buffer->play(looping);
 	}
 
 	void stop() override {
-		winrt::check_hresult(m_com->Stop());
+		m_buffer->stop();
 	}
 
 	void set_volume(int volume) override {
-		if (volume < DSBVOLUME_MIN || volume > DSBVOLUME_MAX) {
+		if (volume < volume_min || volume > volume_max) {
 			throw std::invalid_argument(string_format("invalid argument for volume: %i", volume));
 		}
-		winrt::check_hresult(m_com->SetVolume(LONG(volume)));
+		m_buffer->set_volume(volume);
 	}
 
 	void set_pan(int pan) override {
-		if (pan < DSBPAN_LEFT || pan > DSBPAN_RIGHT) {
+		if (pan < pan_left || pan > pan_right) {
 			throw std::invalid_argument(string_format("invalid argument for pan: %i", pan));
 		}
-		winrt::check_hresult(m_com->SetPan(LONG(pan)));
+		m_buffer->set_pan(pan);
 	}
 
-	const winrt::com_ptr<IDirectSoundBuffer8>& com() const {
-		return m_com;
+	backend_buffer& buffer() const {
+		return *m_buffer;
 	}
 
 	buffer_info info() const {
@@ -182,32 +152,8 @@ public:
 	}
 
 	buffer_lock<SampleType> lock_samples(size_t offset, size_t length) const {
-		offset *= sizeof(SampleType);
-		length *= sizeof(SampleType);
-
-		if (offset > std::numeric_limits<DWORD>::max()) {
-			throw std::invalid_argument(string_format("invalid argument for offset (overflow): %zu", offset));
-		}
-		if (length > std::numeric_limits<DWORD>::max()) {
-			throw std::invalid_argument(string_format("invalid argument for length (overflow): %zu", length));
-		}
-
-		void* base1; DWORD len1;
-		void* base2; DWORD len2;
-		winrt::check_hresult(m_com->Lock(DWORD(offset), DWORD(length), &base1, &len1, &base2, &len2, 0));
-
-		// Initialize `lock` early in order for the buffer to be unlocked if any exceptions are thrown below.
-		buffer_lock<SampleType> lock(m_com, {{
-			{static_cast<SampleType*>(base1), ptrdiff_t(len1 / sizeof(SampleType))},
-			{static_cast<SampleType*>(base2), ptrdiff_t(len2 / sizeof(SampleType))},
-		}});
-
-		constexpr auto align_mask = alignof(SampleType)-1;
-		if ((size_t(base1) & align_mask) != 0 || (size_t(base2) & align_mask) != 0) {
-			throw std::runtime_error("bad buffer alignment");
-		}
-
-		return lock;
+		DIRECT_SOUND_TRACE_SCOPE("lock_samples", m_buffer.get(), trace::no_half, length);
+		return buffer_lock<SampleType>(m_buffer, m_buffer->lock(offset * sizeof(SampleType), length * sizeof(SampleType)));
 	}
 
 	buffer_lock<SampleType> lock_duration(std::chrono::duration<double> offset, std::chrono::duration<double> seconds) const {
@@ -215,10 +161,42 @@ public:
 	}
 
 private:
-	winrt::com_ptr<IDirectSoundBuffer8> m_com;
+	std::shared_ptr<backend_buffer> m_buffer;
 	buffer_info m_info;
 };
 
+// Determines what drives the refilling of a double_buffer.
+enum class fill_mode {
+	// Position notifications at the start and the middle of the ring, each refilling a whole half.
+	notifications,
+
+	// A dedicated thread polling the play cursor a few times per half and topping the ring up to exactly
+	// `samples` samples ahead of it. Doesn't depend on the delivery of any events and, since each fill
+	// only writes what has been played since the last one, keeps the latency at a steady `samples`.
+	play_cursor,
+};
+
+// Counters describing how well a double_buffer keeps up with playback.
+// Frames are counted in samples (i.e. frames of ChannelCount values).
+class fill_statistics {
+public:
+	uint64_t fills = 0;
+	uint64_t frames_written = 0;
+	uint64_t frames_played = 0;
+
+	// Number of times playback overtook the writer and stale data was played.
+	uint64_t underruns = 0;
+
+	// How far the written data was ahead of the play cursor, sampled before each fill.
+	int64_t last_ahead = 0;
+	int64_t min_ahead = std::numeric_limits<int64_t>::max();
+	int64_t max_ahead = std::numeric_limits<int64_t>::min();
+
+	// The deviation of the device's sample clock from the nominal rate, measured as frames played over the
+	// time passed on the steady_clock since playback started. Converges as playback continues.
+	double drift_ppm = 0.0;
+};
+
 template<typename ValueType, size_t ChannelCount>
 class double_buffer : public buffer_trait<ValueType, ChannelCount>, public playable {
 private:
@@ -228,35 +206,30 @@ public:
 	explicit double_buffer() noexcept {
 	}
 
-	explicit double_buffer(const context& context, size_t samples_per_second, size_t samples, ProviderFunction provider) : m_shared(std::make_unique<shared>(Buffer(context, samples_per_second, samples * 2), std::move(provider))) {
-		{
-			HANDLE handle = CreateEvent(nullptr, false, false, nullptr);
+	explicit double_buffer(const backend& backend, size_t samples_per_second, size_t samples, ProviderFunction provider, fill_mode mode = fill_mode::notifications) : m_shared(std::make_unique<shared>(Buffer(backend, samples_per_second, samples * 2), std::move(provider), mode)) {
+		const auto shared = m_shared.get();
 
-			if (!handle) {
-				winrt::throw_last_error();
-			}
-
-			m_notify_handle.reset(handle);
+		if (mode == fill_mode::notifications) {
+			shared->buffer.buffer().set_notifications({0, shared->buffer.buffer_bytes() / 2}, [shared]() {
+				shared->fill();
+			});
+		} else {
+			shared->start_polling();
 		}
+	}
 
-		{
-			HANDLE handle;
-
-			if (!RegisterWaitForSingleObject(&handle, m_notify_handle.get(), &wait_callback, m_shared.get(), INFINITE, WT_EXECUTEDEFAULT)) {
-				winrt::throw_last_error();
-			}
+	double_buffer(double_buffer&&) = default;
 
-			m_wait_handle.reset(handle);
+	double_buffer& operator=(double_buffer&& other) {
+		if (this != &other) {
+			clear_notifications();
+			m_shared = std::move(other.m_shared);
 		}
+		return *this;
+	}
 
-		{
-			std::array<DSBPOSITIONNOTIFY, 2> positions{{
-				{0, m_notify_handle.get()},
-				{DWORD(m_shared->buffer.buffer_bytes() / 2), m_notify_handle.get()},
-			}};
-			auto notify = m_shared->buffer.com().as<IDirectSoundNotify8>();
-			winrt::check_hresult(notify->SetNotificationPositions(DWORD(positions.size()), positions.data()));
-		}
+	~double_buffer() {
+		clear_notifications();
 	}
 
 	void play(bool looping = false) override {
@@ -265,6 +238,7 @@ public:
 
 	void stop() override {
 		m_shared->buffer.stop();
+		m_shared->reset_clock();
 	}
 
 	void set_volume(int volume) override {
@@ -275,45 +249,202 @@ public:
 		m_shared->buffer.set_pan(pan);
 	}
 
+	fill_statistics statistics() const {
+		std::lock_guard<std::mutex> guard(m_shared->mutex);
+		return m_shared->stats;
+	}
+
 private:
-	// Contains members shared between the double_buffer and the wait_callback().
+	// The notifications must be gone before `m_shared` is, as they refer to it.
+	void clear_notifications() {
+		if (m_shared) {
+			m_shared->buffer.buffer().set_notifications({}, nullptr);
+		}
+	}
+
+	// Contains members shared between the double_buffer and its notification callback or polling thread.
 	class shared {
 	public:
-		explicit shared(Buffer&& buffer, ProviderFunction&& provider) : buffer(std::forward<Buffer>(buffer)), provider(std::forward<ProviderFunction>(provider)) {
-			swap_and_fill();
+		explicit shared(Buffer&& buffer, ProviderFunction&& provider, fill_mode mode) : buffer(std::forward<Buffer>(buffer)), provider(std::forward<ProviderFunction>(provider)), mode(mode) {
+			// Start out with both halves filled, or with `samples` samples of latency when polling.
+			// Each half gets its own provider call, as providers like the tone ladder advance once per call.
+			const auto info = this->buffer.info();
+
+			if (mode == fill_mode::notifications) {
+				write(info.samples / 2);
+				write(info.samples / 2);
+			} else {
+				write(info.samples / 2);
+			}
 		}
 
-		void swap_and_fill() {
-			bool second_half = state.fetch_xor(1);
-			auto info = buffer.info();
-			const auto half_width = info.samples / 2;
+		shared(const shared&) = delete;
+		shared& operator=(const shared&) = delete;
+
+		~shared() {
+			if (poller.joinable()) {
+				{
+					std::lock_guard<std::mutex> guard(mutex);
+					exit = true;
+				}
 
-			auto lock = buffer.lock_samples(second_half ? half_width : 0, half_width);
-			provider(lock.spans(), info);
+				cv.notify_all();
+				poller.join();
+			}
+		}
+
+		void start_polling() {
+			const auto info = buffer.info();
+
+			// Poll 4 times per `samples`, so that the ring never drains below 3/4 of the target latency.
+			const auto period = std::chrono::duration<double>(double(info.samples / 2) / double(info.samples_per_second) / 4.0);
+
+			poller = std::thread([this, period]() {
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (!cv.wait_for(lock, period, [this]() { return exit; })) {
+					fill_locked();
+				}
+			});
+		}
+
+		void fill() {
+			std::lock_guard<std::mutex> guard(mutex);
+			fill_locked();
+		}
+
+		void reset_clock() {
+			std::lock_guard<std::mutex> guard(mutex);
+			clock_start.reset();
 		}
 
 		Buffer buffer;
 		ProviderFunction provider;
+		const fill_mode mode;
 
-		// Always contains the half that should be filled *next*.
-		// 0 = first half
-		// 1 = second half
-		// Since it's assumed that the constructor will call fill_half(false)
-		// this is already set to 1
-		std::atomic<uint_fast8_t> state = 0;
-	};
+		// Guards everything below and serializes fills, as the thread pool may run
+		// callbacks for consecutive notifications concurrently.
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::thread poller;
+		bool exit = false;
 
-	static void NTAPI wait_callback(PVOID context, BOOLEAN) noexcept {
-		static_cast<shared*>(context)->swap_and_fill();
-	}
+		fill_statistics stats;
 
-	std::unique_ptr<shared> m_shared;
+		// The sample offset at which the next fill starts writing.
+		size_t next = 0;
+
+		// The play cursor as of the last fill, in samples.
+		size_t last_play = 0;
+
+		// The time and the number of played frames at which the drift measurement started.
+		std::optional<std::pair<std::chrono::steady_clock::time_point, uint64_t>> clock_start;
+
+	private:
+		// Accounts for the samples played since the last call and refills everything that's due,
+		// using a single lock. Everything is derived from the play cursor instead of counting notifications:
+		// If a notification arrives late or two of them get coalesced, the next call catches up.
+		void fill_locked() {
+			const auto info = buffer.info();
+			const auto half_width = info.samples / 2;
+			const auto [play_bytes, write_bytes] = buffer.buffer().position();
+			const auto play = play_bytes / sizeof(SampleType);
+
+			const auto played = (play + info.samples - last_play) % info.samples;
+			stats.frames_played += played;
+			last_play = play;
+
+			const auto now = std::chrono::steady_clock::now();
+
+			if (!clock_start) {
+				if (played != 0) {
+					clock_start.emplace(now, stats.frames_played);
+				}
+			} else {
+				const auto seconds = std::chrono::duration<double>(now - clock_start->first).count();
+
+				if (seconds > 0.0) {
+					const auto rate = double(stats.frames_played - clock_start->second) / seconds;
+					stats.drift_ppm = (rate / double(info.samples_per_second) - 1.0) * 1e6;
+				}
+			}
+
+			auto ahead = int64_t(stats.frames_written) - int64_t(stats.frames_played);
+			stats.last_ahead = ahead;
+			stats.min_ahead = std::min(stats.min_ahead, ahead);
+			stats.max_ahead = std::max(stats.max_ahead, ahead);
+
+			if (ahead < 0) {
+				++stats.underruns;
+			}
 
-	// The order of these members is important:
-	// The notify handle has to be initialized before the wait handle and they
-	// must be destroyed in reverse order as the latter depends on the former.
-	std::unique_ptr<void, detail::handle_deleter> m_notify_handle;
-	std::unique_ptr<void, detail::wait_handle_deleter> m_wait_handle;
+			size_t length;
+
+			if (mode == fill_mode::notifications) {
+				// Each fill normally refills the half the play cursor just left, which ends where the current half starts.
+				const auto boundary = play / half_width * half_width;
+
+				// With nothing written left to play, `next` might just as well sit on the boundary as when
+				// nothing is due. Resync then and fill everything up to the boundary, which the notification
+				// for the following half continues from as usual.
+				if (ahead <= 0) {
+					resync(play, write_bytes);
+				}
+
+				length = (boundary + info.samples - next) % info.samples;
+
+				// The write cursor only sits on the boundary if it's at the play cursor, i.e. the whole ring is due.
+				if (length == 0 && ahead <= 0) {
+					length = info.samples;
+				}
+			} else {
+				if (ahead < 0) {
+					ahead = resync(play, write_bytes);
+				}
+
+				length = ahead < int64_t(half_width) ? size_t(int64_t(half_width) - ahead) : 0;
+			}
+
+			write(length);
+		}
+
+		// Playback overtook us. Resumes writing at the write cursor, as everything in front
+		// of it is already committed to the device. Returns the number of committed samples.
+		int64_t resync(size_t play, size_t write_bytes) {
+			const auto info = buffer.info();
+			const auto write_cursor = write_bytes / sizeof(SampleType);
+			const auto committed = (write_cursor + info.samples - play) % info.samples;
+
+			next = write_cursor;
+			stats.frames_written = stats.frames_played + committed;
+			return int64_t(committed);
+		}
+
+		void write(size_t length) {
+			if (length == 0) {
+				return;
+			}
+
+			auto info = buffer.info();
+			const auto half_width = info.samples / 2;
+			info.samples_ahead = size_t(std::max<int64_t>(0, int64_t(stats.frames_written) - int64_t(stats.frames_played)));
+
+			DIRECT_SOUND_TRACE_SCOPE("fill", &buffer.buffer(), uint32_t(next / half_width), length);
+
+			auto lock = buffer.lock_samples(next, length);
+
+			{
+				DIRECT_SOUND_TRACE_SCOPE("provider", &buffer.buffer(), uint32_t(next / half_width), length);
+				provider(lock.spans(), info);
+			}
+
+			next = (next + length) % info.samples;
+			stats.frames_written += length;
+			++stats.fills;
+		}
+	};
+
+	std::unique_ptr<shared> m_shared;
 };
 
 } // namespace direct_sound
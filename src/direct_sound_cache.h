@@ -0,0 +1,332 @@
+#pragma once
+
+namespace direct_sound {
+
+// Identifies the output of a deterministic provider: A hash over the provider's type,
+// all parameters its output depends on, and the buffer_info and format it's rendered with.
+// Anything not added to the key must not change the output, or stale renders will be served.
+class render_key {
+public:
+	explicit render_key(std::string_view type) {
+		add(type);
+	}
+
+	render_key& add(std::string_view value) noexcept {
+		add(uint64_t(value.size()));
+		m_hash = fnv1a_hash({reinterpret_cast<const byte*>(value.data()), ptrdiff_t(value.size())}, m_hash);
+		return *this;
+	}
+
+	render_key& add(gsl::span<const byte> value) noexcept {
+		add(uint64_t(value.size()));
+		m_hash = fnv1a_hash(value, m_hash);
+		return *this;
+	}
+
+	// Integers are widened to 64 bits first, so that 32 and 64-bit builds agree on the keys.
+	template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	render_key& add(T value) noexcept {
+		using WideType = std::conditional_t<std::is_floating_point_v<T>, double, std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>;
+		const auto wide = WideType(value);
+		m_hash = fnv1a_hash({reinterpret_cast<const byte*>(&wide), ptrdiff_t(sizeof(wide))}, m_hash);
+		return *this;
+	}
+
+	render_key& add(const buffer_info& info) noexcept {
+		return add(info.samples_per_second).add(info.samples);
+	}
+
+	render_key& add(const wave_format& format) noexcept {
+		return add(format.channels).add(format.bits_per_sample).add(format.samples_per_second).add(format.floating_point);
+	}
+
+	uint64_t value() const noexcept {
+		return m_hash;
+	}
+
+private:
+	uint64_t m_hash = 0xcbf29ce484222325;
+};
+
+namespace detail {
+
+class view_deleter {
+public:
+	void operator()(const void* view) const noexcept {
+		UnmapViewOfFile(view);
+	}
+};
+
+// The start of each file in a render_cache, followed by the PCM data.
+class render_cache_header {
+public:
+	static constexpr uint32_t current_magic = 0x48434344; // "DCCH"
+	static constexpr uint32_t current_version = 1;
+
+	uint32_t magic = current_magic;
+	uint32_t version = current_version;
+	uint64_t key = 0;
+	uint64_t data_bytes = 0;
+	uint32_t channels = 0;
+	uint32_t bits_per_sample = 0;
+	uint32_t samples_per_second = 0;
+	uint32_t floating_point = 0;
+};
+
+} // namespace detail
+
+// A render held by a render_cache. The PCM data is a read-only view of the mapped cache file.
+class cached_render {
+public:
+	explicit cached_render(const std::filesystem::path& path, uint64_t key) {
+		m_file.reset(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+		if (m_file.get() == INVALID_HANDLE_VALUE) {
+			m_file.release();
+			winrt::throw_last_error();
+		}
+
+		LARGE_INTEGER size;
+		winrt::check_bool(GetFileSizeEx(m_file.get(), &size));
+
+		if (size_t(size.QuadPart) < sizeof(detail::render_cache_header)) {
+			throw std::runtime_error("cache file is truncated");
+		}
+
+		m_mapping.reset(CreateFileMappingW(m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+		if (!m_mapping) {
+			winrt::throw_last_error();
+		}
+
+		m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0));
+		if (!m_view) {
+			winrt::throw_last_error();
+		}
+
+		const auto base = static_cast<const byte*>(m_view.get());
+		detail::render_cache_header header;
+		memcpy(&header, base, sizeof(header));
+
+		if (header.magic != header.current_magic || header.version != header.current_version || header.key != key || header.data_bytes != uint64_t(size.QuadPart) - sizeof(header)) {
+			throw std::runtime_error("cache file is invalid");
+		}
+
+		m_format = wave_format(header.channels, header.bits_per_sample, header.samples_per_second, header.floating_point != 0);
+		m_data = {base + sizeof(header), ptrdiff_t(header.data_bytes)};
+
+		if (m_format.block_align() == 0 || size_t(m_data.size()) % m_format.block_align() != 0) {
+			throw std::runtime_error("cache file is invalid");
+		}
+	}
+
+	cached_render(const cached_render&) = delete;
+	cached_render& operator=(const cached_render&) = delete;
+
+	const wave_format& format() const noexcept {
+		return m_format;
+	}
+
+	gsl::span<const byte> data() const noexcept {
+		return m_data;
+	}
+
+	size_t frames() const noexcept {
+		return size_t(m_data.size()) / m_format.block_align();
+	}
+
+private:
+	std::unique_ptr<void, detail::handle_deleter> m_file;
+	std::unique_ptr<void, detail::handle_deleter> m_mapping;
+	std::unique_ptr<const void, detail::view_deleter> m_view;
+	wave_format m_format;
+	gsl::span<const byte> m_data;
+};
+
+// A directory of rendered PCM data, keyed by render_key, which persists across runs.
+//
+// Hits are mapped into memory instead of being read, which makes them almost free: Pages are only
+// loaded from disk (or rather the file system cache) as they're played. Renders are written to a
+// temporary file first and then renamed, so that a crash never leaves a partial file behind.
+// Whenever the cache grows beyond `max_bytes`, the least recently used files are deleted.
+// As their modification time is bumped on every hit, the order survives restarts.
+class render_cache {
+public:
+	class statistics {
+	public:
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+	};
+
+	explicit render_cache(std::filesystem::path directory, size_t max_bytes = size_t(256) << 20) : m_directory(std::move(directory)), m_max_bytes(max_bytes) {
+		std::filesystem::create_directories(m_directory);
+	}
+
+	render_cache(const render_cache&) = delete;
+	render_cache& operator=(const render_cache&) = delete;
+
+	const std::filesystem::path& directory() const noexcept {
+		return m_directory;
+	}
+
+	// Returns the render for `key`, or null if there is none. Invalid files are deleted.
+	std::shared_ptr<const cached_render> find(const render_key& key) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return find_locked(key);
+	}
+
+	std::shared_ptr<const cached_render> store(const render_key& key, const wave_format& format, gsl::span<const byte> data) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		const auto path = path_of(key);
+		auto temporary = path;
+		// Other processes may share the directory, and their thread IDs can be the same as ours.
+		temporary += string_format(".%lu.%lu.tmp", GetCurrentProcessId(), GetCurrentThreadId());
+
+		{
+			detail::render_cache_header header;
+			header.key = key.value();
+			header.data_bytes = uint64_t(data.size());
+			header.channels = uint32_t(format.channels);
+			header.bits_per_sample = uint32_t(format.bits_per_sample);
+			header.samples_per_second = uint32_t(format.samples_per_second);
+			header.floating_point = format.floating_point ? 1 : 0;
+
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+
+			if (!out) {
+				std::error_code ec;
+				std::filesystem::remove(temporary, ec);
+				throw std::runtime_error("failed to write cache file");
+			}
+		}
+
+		std::filesystem::rename(temporary, path);
+		evict(path);
+
+		return std::make_shared<const cached_render>(path, key.value());
+	}
+
+	// Returns the cached render for `key`, rendering `frames` frames with `provider` first if there is none.
+	// The provider is invoked just like by render_offline().
+	template<typename ValueType, size_t ChannelCount>
+	std::shared_ptr<const cached_render> render(const render_key& key, typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, buffer_info info, size_t frames, size_t block_size) {
+		if (auto result = find(key)) {
+			return result;
+		}
+
+		const auto output = render_offline<ValueType, ChannelCount>(std::move(provider), info, frames, block_size);
+		const wave_format format(ChannelCount, sizeof(ValueType) * 8, info.samples_per_second, std::is_floating_point_v<ValueType>);
+		return store(key, format, {reinterpret_cast<const byte*>(output.data()), ptrdiff_t(output.size() * sizeof(output[0]))});
+	}
+
+	statistics stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_statistics;
+	}
+
+private:
+	std::filesystem::path path_of(const render_key& key) const {
+		return m_directory / string_format("%016llx.pcm", static_cast<unsigned long long>(key.value()));
+	}
+
+	std::shared_ptr<const cached_render> find_locked(const render_key& key) {
+		const auto path = path_of(key);
+		std::error_code ec;
+
+		if (!std::filesystem::exists(path, ec)) {
+			++m_statistics.misses;
+			return nullptr;
+		}
+
+		// Marks the file as recently used for evict().
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+		try {
+			auto result = std::make_shared<const cached_render>(path, key.value());
+			++m_statistics.hits;
+			return result;
+		} catch (...) {
+			std::filesystem::remove(path, ec);
+			++m_statistics.misses;
+			return nullptr;
+		}
+	}
+
+	// Deletes the least recently used files until the cache fits into m_max_bytes again, always keeping `keep`.
+	// Files which can't be deleted, e.g. because they're still mapped, are skipped.
+	void evict(const std::filesystem::path& keep) {
+		class entry {
+		public:
+			std::filesystem::path path;
+			std::filesystem::file_time_type time;
+			uintmax_t size;
+		};
+
+		std::vector<entry> entries;
+		uintmax_t total = 0;
+		std::error_code ec;
+
+		for (const auto& it : std::filesystem::directory_iterator(m_directory, ec)) {
+			if (it.path().extension() != ".pcm") {
+				continue;
+			}
+
+			const auto size = it.file_size(ec);
+			const auto time = it.last_write_time(ec);
+			if (ec) {
+				continue;
+			}
+
+			entries.push_back({it.path(), time, size});
+			total += size;
+		}
+
+		if (total <= m_max_bytes) {
+			return;
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+			return a.time < b.time;
+		});
+
+		for (const auto& e : entries) {
+			if (total <= m_max_bytes) {
+				break;
+			}
+
+			if (e.path != keep && std::filesystem::remove(e.path, ec)) {
+				total -= e.size;
+				++m_statistics.evictions;
+			}
+		}
+	}
+
+	std::filesystem::path m_directory;
+	size_t m_max_bytes;
+
+	// Guards everything below and serializes all file system accesses.
+	mutable std::mutex m_mutex;
+	statistics m_statistics;
+};
+
+// Plays a cached render, which must have been rendered with the same ValueType and ChannelCount.
+template<typename ValueType, size_t ChannelCount>
+auto create_cached_provider(std::shared_ptr<const cached_render> render, bool looping) {
+	if (!render) {
+		throw std::invalid_argument("render must not be null");
+	}
+	if (render->format().channels != ChannelCount || render->format().bits_per_sample != sizeof(ValueType) * 8 || render->format().floating_point != std::is_floating_point_v<ValueType>) {
+		throw std::invalid_argument(string_format("invalid argument for render (format): %zu channels, %zu bits, %s", render->format().channels, render->format().bits_per_sample, render->format().floating_point ? "floating point" : "integer"));
+	}
+
+	size_t pcm_pos = 0;
+
+	return [render, looping, pcm_pos](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		UNREFERENCED_PARAMETER(info);
+		pcm_pos = detail::fill_with_pcm<ValueType, ChannelCount>(spans, render->data(), pcm_pos, looping);
+	};
+}
+
+} // namespace direct_sound
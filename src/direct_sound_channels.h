@@ -0,0 +1,394 @@
+#pragma once
+
+namespace direct_sound {
+
+// Speaker layouts in the default WAVEFORMATEXTENSIBLE channel order:
+//   stereo: FL FR
+//   5.1:    FL FR FC LFE BL BR
+//   7.1:    FL FR FC LFE BL BR SL SR
+enum class channel_layout {
+	mono,
+	stereo,
+	surround_5_1,
+	surround_7_1,
+};
+
+constexpr size_t channel_count(channel_layout layout) {
+	switch (layout) {
+	case channel_layout::mono:
+		return 1;
+	case channel_layout::stereo:
+		return 2;
+	case channel_layout::surround_5_1:
+		return 6;
+	case channel_layout::surround_7_1:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+// A runtime sized mixing matrix, mapping `inputs` channels onto `outputs` channels:
+//   out[o] = sum over i of (in[i] * coefficient(o, i))
+class channel_matrix {
+public:
+	explicit channel_matrix() noexcept {
+	}
+
+	explicit channel_matrix(size_t inputs, size_t outputs) : m_inputs(inputs), m_outputs(outputs), m_coefficients(inputs * outputs) {
+		if (inputs < 1 || inputs > 12 || outputs < 1 || outputs > 12) {
+			throw std::invalid_argument(string_format("invalid matrix size: %zu inputs, %zu outputs", inputs, outputs));
+		}
+	}
+
+	// `coefficients` are given row by row, i.e. one row of `inputs` values per output channel.
+	explicit channel_matrix(size_t inputs, size_t outputs, std::initializer_list<float> coefficients) : channel_matrix(inputs, outputs) {
+		if (coefficients.size() != m_coefficients.size()) {
+			throw std::invalid_argument(string_format("invalid coefficient count: %zu != %zu", coefficients.size(), m_coefficients.size()));
+		}
+
+		std::copy(coefficients.begin(), coefficients.end(), m_coefficients.begin());
+	}
+
+	// Places a mono signal on the channels a listener expects it on:
+	// Both fronts for stereo and the center speaker for surround layouts.
+	static channel_matrix upmix(channel_layout to) {
+		channel_matrix m(1, channel_count(to));
+
+		switch (to) {
+		case channel_layout::mono:
+			m(0, 0) = 1.0f;
+			break;
+		case channel_layout::stereo:
+			m(0, 0) = 1.0f;
+			m(1, 0) = 1.0f;
+			break;
+		case channel_layout::surround_5_1:
+		case channel_layout::surround_7_1:
+			m(2, 0) = 1.0f;
+			break;
+		}
+
+		return m;
+	}
+
+	// ITU-R BS.775 style downmixes. The LFE channel is dropped.
+	// The results are not normalized and might thus clip if all inputs are at full scale.
+	static channel_matrix downmix(channel_layout from, channel_layout to) {
+		constexpr float g = 0.70710678f; // -3 dB
+
+		if (from == to) {
+			const auto n = channel_count(from);
+			channel_matrix m(n, n);
+			for (size_t i = 0; i < n; ++i) {
+				m(i, i) = 1.0f;
+			}
+			return m;
+		}
+
+		switch (from) {
+		case channel_layout::stereo:
+			if (to == channel_layout::mono) {
+				return channel_matrix(2, 1, {0.5f, 0.5f});
+			}
+			break;
+		case channel_layout::surround_5_1:
+			if (to == channel_layout::stereo) {
+				return channel_matrix(6, 2, {
+					1.0f, 0.0f, g, 0.0f, g, 0.0f,
+					0.0f, 1.0f, g, 0.0f, 0.0f, g,
+				});
+			}
+			if (to == channel_layout::mono) {
+				return channel_matrix(6, 1, {g, g, 1.0f, 0.0f, 0.5f, 0.5f});
+			}
+			break;
+		case channel_layout::surround_7_1:
+			if (to == channel_layout::stereo) {
+				return channel_matrix(8, 2, {
+					1.0f, 0.0f, g, 0.0f, g, 0.0f, g, 0.0f,
+					0.0f, 1.0f, g, 0.0f, 0.0f, g, 0.0f, g,
+				});
+			}
+			if (to == channel_layout::surround_5_1) {
+				return channel_matrix(8, 6, {
+					1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+					0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+					0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+					0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+					0.0f, 0.0f, 0.0f, 0.0f, g, 0.0f, g, 0.0f,
+					0.0f, 0.0f, 0.0f, 0.0f, 0.0f, g, 0.0f, g,
+				});
+			}
+			break;
+		default:
+			break;
+		}
+
+		throw std::invalid_argument(string_format("unsupported downmix: %zu to %zu channels", channel_count(from), channel_count(to)));
+	}
+
+	size_t inputs() const {
+		return m_inputs;
+	}
+
+	size_t outputs() const {
+		return m_outputs;
+	}
+
+	float& operator()(size_t output, size_t input) {
+		return m_coefficients[output * m_inputs + input];
+	}
+
+	float operator()(size_t output, size_t input) const {
+		return m_coefficients[output * m_inputs + input];
+	}
+
+	// The generic fallback for channel counts only known at runtime.
+	// Both `in` and `out` are interleaved and must not overlap.
+	void apply(const float* in, float* out, size_t frames) const noexcept {
+		for (size_t frame = 0; frame < frames; ++frame, in += m_inputs, out += m_outputs) {
+			for (size_t o = 0; o < m_outputs; ++o) {
+				const auto row = m_coefficients.data() + o * m_inputs;
+				float sum = 0.0f;
+
+				for (size_t i = 0; i < m_inputs; ++i) {
+					sum += in[i] * row[i];
+				}
+
+				out[o] = sum;
+			}
+		}
+	}
+
+private:
+	size_t m_inputs = 0;
+	size_t m_outputs = 0;
+	std::vector<float> m_coefficients;
+};
+
+namespace detail {
+
+// Distributes a mono signal onto ChannelCount channels, each scaled by its own gain.
+template<size_t ChannelCount>
+void upmix_mono(const float* mono, mix_frame<ChannelCount>* out, size_t frames, const std::array<float, ChannelCount>& gains) noexcept {
+	size_t i = 0;
+
+#if DIRECT_SOUND_SSE2
+	if constexpr (ChannelCount == 2) {
+		// Turns 4 mono values [a b c d] into the 8 interleaved values [a a b b] [c c d d].
+		const auto g = _mm_set_ps(gains[1], gains[0], gains[1], gains[0]);
+		const auto dst = reinterpret_cast<float*>(out);
+
+		for (; i + 4 <= frames; i += 4) {
+			const auto m = _mm_loadu_ps(mono + i);
+			_mm_storeu_ps(dst + i * 2, _mm_mul_ps(_mm_unpacklo_ps(m, m), g));
+			_mm_storeu_ps(dst + i * 2 + 4, _mm_mul_ps(_mm_unpackhi_ps(m, m), g));
+		}
+	}
+#endif
+
+	// With ChannelCount known at compile time the inner loop is fully unrolled.
+	for (; i < frames; ++i) {
+		const auto value = mono[i];
+
+		for (size_t channel = 0; channel < ChannelCount; ++channel) {
+			out[i][channel] = value * gains[channel];
+		}
+	}
+}
+
+// The compile time sized counterpart to channel_matrix::apply().
+// `matrix` must be OutputCount x InputCount.
+template<size_t InputCount, size_t OutputCount>
+void mix_channels(const mix_frame<InputCount>* in, mix_frame<OutputCount>* out, size_t frames, const channel_matrix& matrix) noexcept {
+	std::array<std::array<float, InputCount>, OutputCount> m;
+
+	for (size_t o = 0; o < OutputCount; ++o) {
+		for (size_t i = 0; i < InputCount; ++i) {
+			m[o][i] = matrix(o, i);
+		}
+	}
+
+	for (size_t frame = 0; frame < frames; ++frame) {
+		for (size_t o = 0; o < OutputCount; ++o) {
+			float sum = 0.0f;
+
+			for (size_t i = 0; i < InputCount; ++i) {
+				sum += in[frame][i] * m[o][i];
+			}
+
+			out[frame][o] = sum;
+		}
+	}
+}
+
+template<size_t OutputCount>
+using channel_mixer = void(*)(const float* in, mix_frame<OutputCount>* out, size_t frames, const channel_matrix& matrix);
+
+template<size_t InputCount, size_t OutputCount>
+void mix_interleaved(const float* in, mix_frame<OutputCount>* out, size_t frames, const channel_matrix& matrix) noexcept {
+	mix_channels<InputCount, OutputCount>(reinterpret_cast<const mix_frame<InputCount>*>(in), out, frames, matrix);
+}
+
+template<size_t OutputCount>
+void apply_interleaved(const float* in, mix_frame<OutputCount>* out, size_t frames, const channel_matrix& matrix) noexcept {
+	matrix.apply(in, out->data(), frames);
+}
+
+// Picks the mix_channels() instantiation for the input counts of the channel layouts,
+// falling back to channel_matrix::apply() for all others.
+template<size_t OutputCount>
+channel_mixer<OutputCount> select_channel_mixer(size_t inputs) noexcept {
+	switch (inputs) {
+	case 1:
+		return &mix_interleaved<1, OutputCount>;
+	case 2:
+		return &mix_interleaved<2, OutputCount>;
+	case 6:
+		return &mix_interleaved<6, OutputCount>;
+	case 8:
+		return &mix_interleaved<8, OutputCount>;
+	default:
+		return &apply_interleaved<OutputCount>;
+	}
+}
+
+} // namespace detail
+
+// Renders a mono float provider once and distributes the result onto all ChannelCount channels.
+// Compared to a provider rendering all channels itself this does 1/ChannelCount of the synthesis work.
+template<typename ValueType, size_t ChannelCount>
+auto create_upmix_provider(typename buffer_trait<float, 1>::ProviderFunction mono_provider, std::array<float, ChannelCount> gains) {
+	if (!mono_provider) {
+		throw std::invalid_argument("mono_provider must not be null");
+	}
+
+	std::vector<mix_frame<1>> mono;
+	std::vector<mix_frame<ChannelCount>> mix;
+
+	return [mono_provider, gains, mono, mix](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		const auto size0 = size_t(spans[0].size());
+		const auto size1 = size_t(spans[1].size());
+
+		if (mono.size() < size0 + size1) {
+			mono.resize(size0 + size1);
+			mix.resize(size0 + size1);
+		}
+
+		// Render both halves in one go, to keep the mono provider's state continuous.
+		mono_provider({{
+			{mono.data(), ptrdiff_t(size0)},
+			{mono.data() + size0, ptrdiff_t(size1)},
+		}}, info);
+
+		detail::upmix_mono<ChannelCount>(mono.data()->data(), mix.data(), size0 + size1, gains);
+		detail::convert_frames<ValueType, ChannelCount>(mix.data(), spans[0].data(), size0);
+		detail::convert_frames<ValueType, ChannelCount>(mix.data() + size0, spans[1].data(), size1);
+	};
+}
+
+// Mixes a provider rendering InputCount channels into the buffer's ChannelCount channels.
+template<typename ValueType, size_t ChannelCount, size_t InputCount>
+auto create_channel_matrix_provider(typename buffer_trait<float, InputCount>::ProviderFunction input_provider, channel_matrix matrix) {
+	if (!input_provider) {
+		throw std::invalid_argument("input_provider must not be null");
+	}
+	if (matrix.inputs() != InputCount || matrix.outputs() != ChannelCount) {
+		throw std::invalid_argument(string_format("matrix size mismatch: %zux%zu", matrix.inputs(), matrix.outputs()));
+	}
+
+	std::vector<mix_frame<InputCount>> input;
+	std::vector<mix_frame<ChannelCount>> mix;
+
+	return [input_provider, matrix, input, mix](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		const auto size0 = size_t(spans[0].size());
+		const auto size1 = size_t(spans[1].size());
+
+		if (input.size() < size0 + size1) {
+			input.resize(size0 + size1);
+			mix.resize(size0 + size1);
+		}
+
+		input_provider({{
+			{input.data(), ptrdiff_t(size0)},
+			{input.data() + size0, ptrdiff_t(size1)},
+		}}, info);
+
+		detail::mix_channels<InputCount, ChannelCount>(input.data(), mix.data(), size0 + size1, matrix);
+		detail::convert_frames<ValueType, ChannelCount>(mix.data(), spans[0].data(), size0);
+		detail::convert_frames<ValueType, ChannelCount>(mix.data() + size0, spans[1].data(), size1);
+	};
+}
+
+// Like the above, for providers whose channel count is only known at runtime, e.g. that of a decoded file.
+// `input_provider` overwrites `frames` interleaved frames of matrix.inputs() channels each.
+template<typename ValueType, size_t ChannelCount>
+auto create_channel_matrix_provider(std::function<void(float* samples, size_t frames, buffer_info info)> input_provider, channel_matrix matrix) {
+	if (!input_provider) {
+		throw std::invalid_argument("input_provider must not be null");
+	}
+	if (matrix.inputs() == 0 || matrix.outputs() != ChannelCount) {
+		throw std::invalid_argument(string_format("matrix size mismatch: %zux%zu", matrix.inputs(), matrix.outputs()));
+	}
+
+	// The input is rendered in chunks of this many frames, so that fills of any size don't allocate.
+	static constexpr size_t chunk_size = 256;
+
+	const auto mixer = detail::select_channel_mixer<ChannelCount>(matrix.inputs());
+	std::vector<float> input(chunk_size * matrix.inputs());
+
+	return [input_provider, matrix, mixer, input](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		mix_frame<ChannelCount> mix[chunk_size];
+
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(size - done, chunk_size);
+				input_provider(input.data(), n, info);
+				mixer(input.data(), mix, n, matrix);
+				detail::convert_frames<ValueType, ChannelCount>(mix, span.data() + done, n);
+				done += n;
+			}
+		}
+	};
+}
+
+// Picks the double_buffer instantiation matching a layout only known at runtime
+// and feeds it from a mono provider via its default up-mix.
+template<typename ValueType>
+std::unique_ptr<playable> create_layout_buffer(const context& context, channel_layout layout, size_t samples_per_second, size_t samples, typename buffer_trait<float, 1>::ProviderFunction mono_provider) {
+	const auto matrix = channel_matrix::upmix(layout);
+
+	auto create = [&](auto channels) -> std::unique_ptr<playable> {
+		constexpr size_t ChannelCount = decltype(channels)::value;
+
+		std::array<float, ChannelCount> gains;
+		for (size_t channel = 0; channel < ChannelCount; ++channel) {
+			gains[channel] = matrix(channel, 0);
+		}
+
+		return std::make_unique<double_buffer<ValueType, ChannelCount>>(
+			context,
+			samples_per_second,
+			samples,
+			create_upmix_provider<ValueType, ChannelCount>(std::move(mono_provider), gains)
+		);
+	};
+
+	switch (layout) {
+	case channel_layout::mono:
+		return create(std::integral_constant<size_t, 1>());
+	case channel_layout::stereo:
+		return create(std::integral_constant<size_t, 2>());
+	case channel_layout::surround_5_1:
+		return create(std::integral_constant<size_t, 6>());
+	case channel_layout::surround_7_1:
+		return create(std::integral_constant<size_t, 8>());
+	default:
+		throw std::invalid_argument("invalid channel layout");
+	}
+}
+
+} // namespace direct_sound
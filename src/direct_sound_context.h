@@ -16,15 +16,226 @@ inline constexpr GUID const& guid_of<IDirectSoundNotify8>() noexcept {
 
 namespace direct_sound {
 
-class context {
+static_assert(volume_min == DSBVOLUME_MIN && volume_max == DSBVOLUME_MAX);
+static_assert(pan_left == DSBPAN_LEFT && pan_right == DSBPAN_RIGHT);
+
+namespace detail {
+
+class handle_deleter {
+public:
+	constexpr handle_deleter() {}
+	handle_deleter(handle_deleter&&) = default;
+	handle_deleter& operator=(handle_deleter&&) = default;
+	handle_deleter(const handle_deleter&) = default;
+	handle_deleter& operator=(const handle_deleter&) = default;
+
+	void operator()(HANDLE handle) const {
+		if (!CloseHandle(handle)) {
+			winrt::throw_last_error();
+		}
+	};
+};
+
+class wait_handle_deleter {
+public:
+	constexpr wait_handle_deleter() {}
+	wait_handle_deleter(wait_handle_deleter&&) = default;
+	wait_handle_deleter& operator=(wait_handle_deleter&&) = default;
+	wait_handle_deleter(const wait_handle_deleter&) = default;
+	wait_handle_deleter& operator=(const wait_handle_deleter&) = default;
+
+	void operator()(HANDLE handle) const {
+		if (!UnregisterWaitEx(handle, INVALID_HANDLE_VALUE)) {
+			winrt::throw_last_error();
+		}
+	};
+};
+
+// The speaker assignment for the channel orders documented in direct_sound_channels.h.
+constexpr DWORD speaker_mask(size_t channels) {
+	switch (channels) {
+	case 6:
+		return KSAUDIO_SPEAKER_5POINT1;
+	case 8:
+		return KSAUDIO_SPEAKER_7POINT1_SURROUND;
+	default:
+		return 0;
+	}
+}
+
+} // namespace detail
+
+// The DirectSound implementation of backend_buffer.
+class sound_buffer : public backend_buffer {
+public:
+	// `pannable` is whether the buffer was created with DSBCAPS_CTRLPAN.
+	explicit sound_buffer(winrt::com_ptr<IDirectSoundBuffer8> com, size_t bytes, bool pannable = true) noexcept : m_com(std::move(com)), m_bytes(bytes), m_pannable(pannable) {
+	}
+
+	sound_buffer(const sound_buffer&) = delete;
+	sound_buffer& operator=(const sound_buffer&) = delete;
+
+	size_t size_bytes() const override {
+		return m_bytes;
+	}
+
+	RegionPairType lock(size_t offset, size_t length) override {
+		// m_bytes fits into a DWORD, which makes this the only overflow check needed.
+		if (offset >= m_bytes || length > m_bytes) {
+			throw std::invalid_argument(string_format("invalid lock range: %zu + %zu > %zu", offset, length, m_bytes));
+		}
+
+		void* base1; DWORD len1;
+		void* base2; DWORD len2;
+		winrt::check_hresult(m_com->Lock(DWORD(offset), DWORD(length), &base1, &len1, &base2, &len2, 0));
+
+		return {{
+			{static_cast<byte*>(base1), ptrdiff_t(len1)},
+			{static_cast<byte*>(base2), ptrdiff_t(len2)},
+		}};
+	}
+
+	void unlock(const RegionPairType& regions) override {
+		m_com->Unlock(
+			static_cast<void*>(regions[0].data()), static_cast<DWORD>(regions[0].size()),
+			static_cast<void*>(regions[1].data()), static_cast<DWORD>(regions[1].size())
+		);
+	}
+
+	void play(bool looping) override {
+		winrt::check_hresult(m_com->Play(0, 0, looping ? DSBPLAY_LOOPING : 0));
+	}
+
+	void stop() override {
+		winrt::check_hresult(m_com->Stop());
+	}
+
+	void set_volume(int volume) override {
+		winrt::check_hresult(m_com->SetVolume(LONG(volume)));
+	}
+
+	// DirectSound only pans mono and stereo buffers. For any other buffer this does nothing,
+	// so that code which resets the pan of every buffer (like buffer_pool) keeps working.
+	void set_pan(int pan) override {
+		if (m_pannable) {
+			winrt::check_hresult(m_com->SetPan(LONG(pan)));
+		}
+	}
+
+	std::pair<size_t, size_t> position() const override {
+		DWORD play;
+		DWORD write;
+		winrt::check_hresult(m_com->GetCurrentPosition(&play, &write));
+		return {size_t(play), size_t(write)};
+	}
+
+	void set_position(size_t offset) override {
+		winrt::check_hresult(m_com->SetCurrentPosition(DWORD(offset)));
+	}
+
+	void set_notifications(std::vector<size_t> offsets, std::function<void()> callback) override {
+		// The callback is only ever invoked while holding m_callback_mutex,
+		// which is why this waits for any running callbacks.
+		{
+			std::lock_guard<std::mutex> lock(m_callback_mutex);
+			m_callback = nullptr;
+		}
+
+		// The notification positions, the event and the wait stay registered without a callback.
+		// Setting them up is comparatively expensive and a recycled buffer (see buffer_pool)
+		// usually gets the same offsets again, in which case only the callback is swapped.
+		if (offsets.empty() || !callback) {
+			return;
+		}
+
+		if (offsets != m_offsets || !m_wait_handle) {
+			m_wait_handle.reset();
+			m_offsets.clear();
+
+			if (!m_notify_handle) {
+				HANDLE handle = CreateEvent(nullptr, false, false, nullptr);
+
+				if (!handle) {
+					winrt::throw_last_error();
+				}
+
+				m_notify_handle.reset(handle);
+			}
+
+			{
+				std::vector<DSBPOSITIONNOTIFY> positions;
+				positions.reserve(offsets.size());
+
+				for (const auto offset : offsets) {
+					positions.push_back({DWORD(offset), m_notify_handle.get()});
+				}
+
+				winrt::check_hresult(m_com.as<IDirectSoundNotify8>()->SetNotificationPositions(DWORD(positions.size()), positions.data()));
+			}
+
+			{
+				HANDLE handle;
+
+				if (!RegisterWaitForSingleObject(&handle, m_notify_handle.get(), &wait_callback, this, INFINITE, WT_EXECUTEDEFAULT)) {
+					winrt::throw_last_error();
+				}
+
+				m_wait_handle.reset(handle);
+			}
+
+			m_offsets = std::move(offsets);
+		}
+
+		std::lock_guard<std::mutex> lock(m_callback_mutex);
+		m_callback = std::move(callback);
+	}
+
+	const winrt::com_ptr<IDirectSoundBuffer8>& com() const {
+		return m_com;
+	}
+
+private:
+	static void NTAPI wait_callback(PVOID context, BOOLEAN) noexcept {
+		const auto self = static_cast<sound_buffer*>(context);
+		std::lock_guard<std::mutex> lock(self->m_callback_mutex);
+
+		if (self->m_callback) {
+			self->m_callback();
+		}
+	}
+
+	winrt::com_ptr<IDirectSoundBuffer8> m_com;
+	size_t m_bytes;
+	bool m_pannable;
+	std::vector<size_t> m_offsets;
+	std::mutex m_callback_mutex;
+	std::function<void()> m_callback;
+
+	// The order of these members is important:
+	// The notify handle has to be initialized before the wait handle and they
+	// must be destroyed in reverse order as the latter depends on the former.
+	std::unique_ptr<void, detail::handle_deleter> m_notify_handle;
+	std::unique_ptr<void, detail::wait_handle_deleter> m_wait_handle;
+};
+
+// An output device as reported by DirectSoundEnumerate().
+class device_info {
+public:
+	// Empty for the primary sound driver.
+	std::optional<GUID> guid;
+	std::wstring description;
+};
+
+class context : public backend {
 public:
 	explicit context() {
 	}
 
-	explicit context(HWND hwnd) {
+	// Opens the primary sound driver, or the device identified by `device`.
+	explicit context(HWND hwnd, const std::optional<GUID>& device = std::nullopt) {
 		{
 			winrt::check_hresult(CoCreateInstance(CLSID_DirectSound8, nullptr, CLSCTX_INPROC_SERVER, IID_IDirectSound8, m_com.put_void()));
-			winrt::check_hresult(m_com->Initialize(nullptr));
+			winrt::check_hresult(m_com->Initialize(device ? &*device : nullptr));
 			winrt::check_hresult(m_com->SetCooperativeLevel(hwnd, DSSCL_PRIORITY));
 		}
 
@@ -38,12 +249,62 @@ public:
 		m_primary->SetVolume(DSBVOLUME_MIN);
 	}
 
+	static std::vector<device_info> enumerate_devices() {
+		std::vector<device_info> devices;
+
+		winrt::check_hresult(DirectSoundEnumerateW([](LPGUID guid, LPCWSTR description, LPCWSTR, LPVOID context) -> BOOL {
+			auto& devices = *static_cast<std::vector<device_info>*>(context);
+			devices.push_back({guid ? std::optional<GUID>(*guid) : std::nullopt, description});
+			return TRUE;
+		}, &devices));
+
+		return devices;
+	}
+
 	winrt::com_ptr<IDirectSoundBuffer8> create_sound_buffer(const DSBUFFERDESC& description) const {
 		winrt::com_ptr<IDirectSoundBuffer> com;
 		winrt::check_hresult(m_com->CreateSoundBuffer(&description, com.put(), nullptr));
 		return com.as<IDirectSoundBuffer8>();
 	}
 
+	std::unique_ptr<backend_buffer> create_buffer(const wave_format& format, size_t bytes) const override {
+		if (bytes > std::numeric_limits<DWORD>::max()) {
+			throw std::invalid_argument(string_format("invalid argument for bytes (overflow): %zu", bytes));
+		}
+
+		// Layouts with more than 2 channels need WAVEFORMATEXTENSIBLE to specify their speaker assignment.
+		const bool extensible = format.channels > 2;
+
+		WAVEFORMATEXTENSIBLE wfx = {};
+		wfx.Format.wFormatTag = extensible ? WAVE_FORMAT_EXTENSIBLE : format.floating_point ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+		wfx.Format.nChannels = WORD(format.channels);
+		wfx.Format.wBitsPerSample = WORD(format.bits_per_sample);
+		wfx.Format.nSamplesPerSec = DWORD(format.samples_per_second);
+		wfx.Format.nBlockAlign = WORD(format.block_align());
+		wfx.Format.nAvgBytesPerSec = DWORD(format.bytes_per_second());
+
+		if (extensible) {
+			wfx.Format.cbSize = WORD(sizeof(wfx) - sizeof(wfx.Format));
+			wfx.Samples.wValidBitsPerSample = wfx.Format.wBitsPerSample;
+			wfx.dwChannelMask = detail::speaker_mask(format.channels);
+			wfx.SubFormat = format.floating_point ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+		}
+
+		// CreateSoundBuffer() fails with DSERR_INVALIDPARAM when asked for panning on a buffer with more than two channels.
+		const bool pannable = format.channels <= 2;
+
+		DSBUFFERDESC description = {};
+		description.dwSize = sizeof(description);
+		description.dwFlags = DSBCAPS_CTRLFREQUENCY | DSBCAPS_CTRLVOLUME | DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_GLOBALFOCUS;
+		if (pannable) {
+			description.dwFlags |= DSBCAPS_CTRLPAN;
+		}
+		description.dwBufferBytes = DWORD(bytes);
+		description.lpwfxFormat = &wfx.Format;
+
+		return std::make_unique<sound_buffer>(create_sound_buffer(description), bytes, pannable);
+	}
+
 private:
 	winrt::com_ptr<IDirectSound8> m_com;
 	winrt::com_ptr<IDirectSoundBuffer> m_primary;
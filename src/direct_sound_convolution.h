@@ -0,0 +1,423 @@
+#pragma once
+
+namespace direct_sound {
+
+// Creates the impulse response of a diffuse room: Noise decaying by 60 dB over `seconds`,
+// independent for each channel and normalized to unit energy, so that a wet signal is about as loud as the dry one.
+inline std::vector<std::vector<float>> create_room_impulse_response(double seconds, size_t samples_per_second, size_t channels = 2, uint32_t seed = 1) {
+	if (!(seconds > 0.0) || samples_per_second == 0) {
+		throw std::invalid_argument(string_format("invalid argument for seconds: %f", seconds));
+	}
+	if (channels < 1 || channels > 12) {
+		throw std::invalid_argument(string_format("invalid argument for channels: %zu", channels));
+	}
+
+	const auto length = std::max<size_t>(1, size_t(seconds * double(samples_per_second)));
+	const auto decay = std::pow(10.0, -3.0 / double(length));
+	auto state = seed ? seed : 0x9e3779b9u;
+
+	std::vector<std::vector<float>> result(channels, std::vector<float>(length));
+
+	for (auto& channel : result) {
+		double envelope = 1.0;
+		double energy = 0.0;
+
+		for (auto& value : channel) {
+			// xorshift32
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+
+			value = float((double(state) / double(std::numeric_limits<uint32_t>::max()) * 2.0 - 1.0) * envelope);
+			energy += double(value) * double(value);
+			envelope *= decay;
+		}
+
+		const auto scale = float(1.0 / std::sqrt(energy));
+		for (auto& value : channel) {
+			value *= scale;
+		}
+	}
+
+	return result;
+}
+
+// Convolves frames with an impulse response of arbitrary length, e.g. that of a room or a guitar cabinet.
+//
+// The impulse response is split into partitions of `block_size` samples, whose spectra are computed up front.
+// Each block of input is transformed once and kept in a frequency domain delay line, and the output
+// is the inverse transform of the sum of the products of the last blocks' spectra and the partitions
+// (uniformly partitioned overlap-save). This keeps the cost per block proportional to the
+// number of partitions, rather than to the length of the impulse response, with a constant latency
+// of block_size frames, which both the wet and the dry signal are delayed by.
+//
+// The products for partition j only need input that's j blocks old. With `head_partitions` > 0, all
+// partitions after the first head_partitions are therefore summed up by a worker thread, which has
+// head_partitions blocks of time to do so. The render thread only computes the head and waits for
+// the worker if it fell behind that far (counted as a late block). As all blocks of a fill are processed
+// back to back, the head should span at least the frames of a fill to give the worker any slack.
+//
+// A mono impulse response applies to all channels. Two channels sharing one are transformed
+// together, as the real and imaginary part of the same complex input.
+template<size_t ChannelCount>
+class convolver {
+public:
+	class statistics {
+	public:
+		uint64_t blocks = 0;
+		// Blocks for which the render thread had to wait for the worker thread.
+		uint64_t late_blocks = 0;
+	};
+
+	// `impulse_response` holds either a single channel or ChannelCount channels, as normalized floats at the output's rate.
+	explicit convolver(const std::vector<std::vector<float>>& impulse_response, size_t block_size = 256, size_t head_partitions = 0, float dry = 0.0f, float wet = 1.0f) : m_block_size(block_size), m_fft(block_size * 2), m_dry(dry), m_wet(wet) {
+		if (impulse_response.size() != 1 && impulse_response.size() != ChannelCount) {
+			throw std::invalid_argument(string_format("invalid argument for impulse_response (channel count): %zu", impulse_response.size()));
+		}
+
+		size_t length = 0;
+		for (const auto& channel : impulse_response) {
+			length = std::max(length, channel.size());
+		}
+
+		if (length == 0) {
+			throw std::invalid_argument("impulse_response must not be empty");
+		}
+
+		const auto n = m_fft.size();
+		m_partitions = (length + block_size - 1) / block_size;
+		m_head_partitions = head_partitions < m_partitions ? head_partitions : 0;
+
+		if (impulse_response.size() == 1) {
+			for (size_t channel = 0; channel < ChannelCount; channel += 2) {
+				m_lanes.push_back({channel, channel + 1 < ChannelCount ? channel + 1 : no_channel, 0});
+			}
+		} else {
+			for (size_t channel = 0; channel < ChannelCount; ++channel) {
+				m_lanes.push_back({channel, no_channel, channel});
+			}
+		}
+
+		// The spectra of all partitions, `n` bins each, one after the other for each channel of the impulse response.
+		m_filter_re.resize(impulse_response.size() * m_partitions * n);
+		m_filter_im.resize(m_filter_re.size());
+
+		for (size_t channel = 0; channel < impulse_response.size(); ++channel) {
+			const auto& ir = impulse_response[channel];
+
+			for (size_t j = 0; j < m_partitions; ++j) {
+				const auto re = &m_filter_re[(channel * m_partitions + j) * n];
+				const auto im = &m_filter_im[(channel * m_partitions + j) * n];
+				const auto begin = std::min(ir.size(), j * block_size);
+				const auto end = std::min(ir.size(), begin + block_size);
+
+				std::copy(ir.begin() + begin, ir.begin() + end, re);
+				m_fft.forward(re, im);
+			}
+		}
+
+		const auto lanes = m_lanes.size();
+		m_input_re.resize(lanes * n);
+		m_input_im.resize(lanes * n);
+		m_delay_re.resize(lanes * m_partitions * n);
+		m_delay_im.resize(m_delay_re.size());
+		m_sum_re.resize(n);
+		m_sum_im.resize(n);
+		m_output.resize(block_size);
+
+		if (m_head_partitions) {
+			m_tail_re.resize(m_head_partitions * lanes * n);
+			m_tail_im.resize(m_tail_re.size());
+			m_thread = std::thread([this]() {
+				run();
+			});
+		}
+	}
+
+	convolver(const convolver&) = delete;
+	convolver& operator=(const convolver&) = delete;
+
+	~convolver() {
+		if (m_thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_exit = true;
+			}
+
+			m_cv.notify_all();
+			m_thread.join();
+		}
+	}
+
+	size_t latency() const noexcept {
+		return m_block_size;
+	}
+
+	size_t partitions() const noexcept {
+		return m_partitions;
+	}
+
+	// Linear gains of the unprocessed and the convolved signal. Can be called from any thread.
+	void set_mix(float dry, float wet) noexcept {
+		m_dry.store(dry, std::memory_order_relaxed);
+		m_wet.store(wet, std::memory_order_relaxed);
+	}
+
+	statistics stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_statistics;
+	}
+
+	// Replaces `count` frames with their convolution, delayed by latency() frames.
+	void process(mix_frame<ChannelCount>* frames, size_t count) {
+		const auto n = m_fft.size();
+		const auto dry = m_dry.load(std::memory_order_relaxed);
+		const auto wet = m_wet.load(std::memory_order_relaxed);
+
+		for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+			auto& out = m_output[m_position];
+
+			for (size_t l = 0; l < m_lanes.size(); ++l) {
+				const auto& lane = m_lanes[l];
+				const auto re = &m_input_re[l * n];
+				const auto im = &m_input_im[l * n];
+
+				// The first half of the input holds the previous block, which is what the output is currently at.
+				const auto a = (*frame)[lane.re];
+				(*frame)[lane.re] = re[m_position] * dry + out[lane.re] * wet;
+				re[m_block_size + m_position] = a;
+
+				if (lane.im != no_channel) {
+					const auto b = (*frame)[lane.im];
+					(*frame)[lane.im] = im[m_position] * dry + out[lane.im] * wet;
+					im[m_block_size + m_position] = b;
+				}
+			}
+
+			if (++m_position == m_block_size) {
+				m_position = 0;
+				process_block();
+			}
+		}
+	}
+
+private:
+	static constexpr size_t no_channel = std::numeric_limits<size_t>::max();
+
+	class lane {
+	public:
+		size_t re;
+		size_t im;
+		size_t filter;
+	};
+
+	// Adds the products of the spectra `x` and `h` to `sum`, all of them `n` complex values in split form.
+	static void multiply_add(const float* xr, const float* xi, const float* hr, const float* hi, float* sr, float* si, size_t n) noexcept {
+		size_t k = 0;
+
+#if DIRECT_SOUND_SSE2
+		for (; k + 4 <= n; k += 4) {
+			const auto ar = _mm_loadu_ps(xr + k);
+			const auto ai = _mm_loadu_ps(xi + k);
+			const auto br = _mm_loadu_ps(hr + k);
+			const auto bi = _mm_loadu_ps(hi + k);
+
+			_mm_storeu_ps(sr + k, _mm_add_ps(_mm_loadu_ps(sr + k), _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi))));
+			_mm_storeu_ps(si + k, _mm_add_ps(_mm_loadu_ps(si + k), _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br))));
+		}
+#endif
+
+		for (; k < n; ++k) {
+			sr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+			si[k] += xr[k] * hi[k] + xi[k] * hr[k];
+		}
+	}
+
+	// Sums the products of partitions [first, last) with the delay line, as of the block numbered `block`, into `sr`/`si`.
+	// Partitions which would need input from before the first block are skipped.
+	void sum_partitions(size_t l, uint64_t block, size_t first, size_t last, float* sr, float* si) const noexcept {
+		const auto n = m_fft.size();
+		const auto filter = m_lanes[l].filter;
+
+		for (size_t j = first; j < last && j <= block; ++j) {
+			const auto slot = size_t((block - j) % m_partitions);
+			const auto x = (l * m_partitions + slot) * n;
+			const auto h = (filter * m_partitions + j) * n;
+			multiply_add(&m_delay_re[x], &m_delay_im[x], &m_filter_re[h], &m_filter_im[h], sr, si, n);
+		}
+	}
+
+	void process_block() {
+		const auto n = m_fft.size();
+		const auto block = m_blocks;
+		const auto slot = size_t(block % m_partitions);
+		const auto head = m_head_partitions ? m_head_partitions : m_partitions;
+
+		// The sum of the worker's tail partitions for this block is only needed once the head is done.
+		if (m_head_partitions && block >= m_head_partitions) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			if (m_done <= block - m_head_partitions) {
+				++m_statistics.late_blocks;
+				m_cv.wait(lock, [&]() { return m_done > block - m_head_partitions; });
+			}
+		}
+
+		for (size_t l = 0; l < m_lanes.size(); ++l) {
+			const auto& lane = m_lanes[l];
+			const auto re = &m_input_re[l * n];
+			const auto im = &m_input_im[l * n];
+			const auto x = (l * m_partitions + slot) * n;
+			const auto delay_re = &m_delay_re[x];
+			const auto delay_im = &m_delay_im[x];
+
+			std::copy(re, re + n, delay_re);
+			std::copy(im, im + n, delay_im);
+			m_fft.forward(delay_re, delay_im);
+
+			// Overlap-save: The next block's input starts with this one.
+			std::copy(re + m_block_size, re + n, re);
+			std::copy(im + m_block_size, im + n, im);
+
+			if (m_head_partitions) {
+				const auto t = (size_t(block % m_head_partitions) * m_lanes.size() + l) * n;
+				std::copy(&m_tail_re[t], &m_tail_re[t] + n, m_sum_re.begin());
+				std::copy(&m_tail_im[t], &m_tail_im[t] + n, m_sum_im.begin());
+			} else {
+				std::fill(m_sum_re.begin(), m_sum_re.end(), 0.0f);
+				std::fill(m_sum_im.begin(), m_sum_im.end(), 0.0f);
+			}
+
+			sum_partitions(l, block, 0, head, m_sum_re.data(), m_sum_im.data());
+			m_fft.inverse(m_sum_re.data(), m_sum_im.data());
+
+			// Only the second half is free of the circular convolution's wrap-around.
+			for (size_t i = 0; i < m_block_size; ++i) {
+				m_output[i][lane.re] = m_sum_re[m_block_size + i];
+
+				if (lane.im != no_channel) {
+					m_output[i][lane.im] = m_sum_im[m_block_size + i];
+				}
+			}
+		}
+
+		++m_blocks;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_statistics.blocks;
+
+		if (m_head_partitions) {
+			m_posted = m_blocks;
+			m_cv.notify_all();
+		}
+	}
+
+	// Computes the tail of block `job + head_partitions` for each block `job` the render thread finished.
+	// Those only use the delay line slots of the blocks up to `job`, which the render thread won't overwrite until it got the result.
+	void run() {
+		const auto n = m_fft.size();
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (true) {
+			m_cv.wait(lock, [this]() { return m_exit || m_posted > m_done; });
+
+			if (m_exit) {
+				return;
+			}
+
+			const auto job = m_done;
+			lock.unlock();
+
+			const auto block = job + m_head_partitions;
+
+			for (size_t l = 0; l < m_lanes.size(); ++l) {
+				const auto t = (size_t(block % m_head_partitions) * m_lanes.size() + l) * n;
+				std::fill(&m_tail_re[t], &m_tail_re[t] + n, 0.0f);
+				std::fill(&m_tail_im[t], &m_tail_im[t] + n, 0.0f);
+				sum_partitions(l, block, m_head_partitions, m_partitions, &m_tail_re[t], &m_tail_im[t]);
+			}
+
+			lock.lock();
+			m_done = job + 1;
+			m_cv.notify_all();
+		}
+	}
+
+	size_t m_block_size;
+	fft m_fft;
+	std::atomic<float> m_dry;
+	std::atomic<float> m_wet;
+	size_t m_partitions = 0;
+	size_t m_head_partitions = 0;
+	std::vector<lane> m_lanes;
+
+	std::vector<float> m_filter_re;
+	std::vector<float> m_filter_im;
+
+	// Only used by the render thread, except for the delay line, whose older slots the worker thread reads.
+	std::vector<float> m_input_re;
+	std::vector<float> m_input_im;
+	std::vector<float> m_delay_re;
+	std::vector<float> m_delay_im;
+	std::vector<float> m_sum_re;
+	std::vector<float> m_sum_im;
+	std::vector<mix_frame<ChannelCount>> m_output;
+	size_t m_position = 0;
+	uint64_t m_blocks = 0;
+
+	// The worker thread's sums, one slot per block it may be ahead.
+	std::vector<float> m_tail_re;
+	std::vector<float> m_tail_im;
+	std::thread m_thread;
+
+	// Guards everything below.
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_exit = false;
+	uint64_t m_posted = 0;
+	uint64_t m_done = 0;
+	statistics m_statistics;
+};
+
+// Wraps `provider` and convolves its output with `convolver`.
+// Providers mixing in floating point anyways, like create_voice_allocator_provider(), should rather call
+// convolver::process() on their mix before converting it, which saves converting it back and forth.
+template<typename ValueType, size_t ChannelCount>
+auto create_convolution_provider(typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, std::shared_ptr<convolver<ChannelCount>> convolver) {
+	if (!provider) {
+		throw std::invalid_argument("provider must not be null");
+	}
+	if (!convolver) {
+		throw std::invalid_argument("convolver must not be null");
+	}
+
+	return [provider, convolver](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) {
+		constexpr auto scale = std::is_floating_point_v<ValueType> ? 1.0f : 1.0f / float(std::numeric_limits<ValueType>::max());
+		// The output is converted in chunks on the stack, so that fills of any size don't allocate.
+		constexpr size_t chunk_size = 256;
+		mix_frame<ChannelCount> mix[chunk_size];
+
+		provider(spans, info);
+
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(size - done, chunk_size);
+				const auto data = span.data() + done;
+
+				for (size_t i = 0; i < n; ++i) {
+					for (size_t channel = 0; channel < ChannelCount; ++channel) {
+						mix[i][channel] = float(data[i][channel]) * scale;
+					}
+				}
+
+				convolver->process(mix, n);
+				detail::convert_frames<ValueType, ChannelCount>(mix, data, n);
+				done += n;
+			}
+		}
+	};
+}
+
+} // namespace direct_sound
@@ -0,0 +1,368 @@
+#pragma once
+
+// Providers composed from expression templates.
+//
+// Instead of nesting std::function providers, each of which is an opaque call per fill, signals
+// are combined into a single type describing the whole pipeline:
+//
+//   using namespace direct_sound::expressions;
+//   auto provider = sine(440.0) * envelope(10ms, 200ms, 0.5f) | pan(0.3f) | to<int16_t, 2>();
+//
+// The resulting provider renders each block in one loop, with every stage inlined into it.
+//
+// A signal is any class deriving from signal<Derived> which provides:
+//   static constexpr size_t channels
+//   void prepare(double samples_per_second) - called before the first sample and whenever the rate changes
+//   mix_frame<channels> next() noexcept     - returns the next frame
+namespace direct_sound {
+
+namespace detail {
+
+// Repeats a mono frame on all channels, or passes a frame with the right channel count through.
+template<size_t ChannelCount, size_t InputCount>
+mix_frame<ChannelCount> broadcast(const mix_frame<InputCount>& frame) noexcept {
+	static_assert(InputCount == ChannelCount || InputCount == 1, "channel counts must match or the signal must be mono");
+
+	if constexpr (InputCount == ChannelCount) {
+		return frame;
+	} else {
+		mix_frame<ChannelCount> result;
+		result.fill(frame[0]);
+		return result;
+	}
+}
+
+} // namespace detail
+
+namespace expressions {
+
+template<typename Derived>
+class signal {
+public:
+	const Derived& derived() const noexcept {
+		return static_cast<const Derived&>(*this);
+	}
+};
+
+// A stage turns a signal into another signal, or into a provider in the case of to<>().
+// Each Derived needs to provide `template<typename Signal> auto bind(Signal signal) const`.
+template<typename Derived>
+class stage {
+public:
+	const Derived& derived() const noexcept {
+		return static_cast<const Derived&>(*this);
+	}
+};
+
+class constant : public signal<constant> {
+public:
+	static constexpr size_t channels = 1;
+
+	explicit constant(float value) noexcept : m_value(value) {
+	}
+
+	void prepare(double) noexcept {
+	}
+
+	mix_frame<1> next() noexcept {
+		return {m_value};
+	}
+
+private:
+	float m_value;
+};
+
+// A sine tone, generated by a recursive quadrature oscillator instead of calling std::sin() for each sample.
+class sine : public signal<sine> {
+public:
+	static constexpr size_t channels = 1;
+
+	explicit sine(double frequency, float amplitude = 1.0f) : m_frequency(frequency), m_amplitude(amplitude) {
+		if (!(frequency > 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+	}
+
+	void prepare(double samples_per_second) noexcept {
+		const auto increment = 2.0 * M_PI * m_frequency / samples_per_second;
+		m_cos = std::cos(increment);
+		m_sin = std::sin(increment);
+		m_x = 1.0;
+		m_y = 0.0;
+		m_countdown = renormalize_interval;
+	}
+
+	mix_frame<1> next() noexcept {
+		const auto value = float(m_y) * m_amplitude;
+		const auto x = m_x * m_cos - m_y * m_sin;
+		m_y = m_y * m_cos + m_x * m_sin;
+		m_x = x;
+
+		// Rounding errors slowly change the oscillator's amplitude. Pulling it back onto the
+		// unit circle every once in a while keeps it stable without costing a sqrt per sample.
+		if (--m_countdown == 0) {
+			const auto norm = 1.0 / std::sqrt(m_x * m_x + m_y * m_y);
+			m_x *= norm;
+			m_y *= norm;
+			m_countdown = renormalize_interval;
+		}
+
+		return {value};
+	}
+
+private:
+	static constexpr uint32_t renormalize_interval = 1024;
+
+	double m_frequency;
+	float m_amplitude;
+	double m_cos = 1.0;
+	double m_sin = 0.0;
+	double m_x = 1.0;
+	double m_y = 0.0;
+	uint32_t m_countdown = renormalize_interval;
+};
+
+// A linear attack/decay/sustain envelope, starting with the first rendered sample.
+class envelope : public signal<envelope> {
+public:
+	static constexpr size_t channels = 1;
+
+	explicit envelope(std::chrono::duration<double> attack, std::chrono::duration<double> decay, float sustain) : m_attack(attack.count()), m_decay(decay.count()), m_sustain(sustain) {
+		if (m_attack < 0.0 || m_decay < 0.0) {
+			throw std::invalid_argument("attack and decay must not be negative");
+		}
+		if (!(sustain >= 0.0f && sustain <= 1.0f)) {
+			throw std::invalid_argument(string_format("invalid argument for sustain: %f", sustain));
+		}
+	}
+
+	void prepare(double samples_per_second) noexcept {
+		m_attack_samples = uint64_t(m_attack * samples_per_second);
+		m_decay_samples = uint64_t(m_decay * samples_per_second);
+		m_attack_step = m_attack_samples ? 1.0f / float(m_attack_samples) : 0.0f;
+		m_decay_step = m_decay_samples ? (1.0f - m_sustain) / float(m_decay_samples) : 0.0f;
+		m_position = 0;
+		m_value = m_attack_samples ? 0.0f : 1.0f;
+	}
+
+	mix_frame<1> next() noexcept {
+		const auto value = m_value;
+
+		if (m_position < m_attack_samples) {
+			m_value += m_attack_step;
+		} else if (m_position < m_attack_samples + m_decay_samples) {
+			m_value -= m_decay_step;
+		} else {
+			m_value = m_sustain;
+		}
+
+		++m_position;
+		return {value};
+	}
+
+private:
+	double m_attack;
+	double m_decay;
+	float m_sustain;
+	uint64_t m_attack_samples = 0;
+	uint64_t m_decay_samples = 0;
+	float m_attack_step = 0.0f;
+	float m_decay_step = 0.0f;
+	uint64_t m_position = 0;
+	float m_value = 0.0f;
+};
+
+template<typename L, typename R>
+class product : public signal<product<L, R>> {
+public:
+	static constexpr size_t channels = std::max(L::channels, R::channels);
+
+	explicit product(L l, R r) : m_l(std::move(l)), m_r(std::move(r)) {
+	}
+
+	void prepare(double samples_per_second) {
+		m_l.prepare(samples_per_second);
+		m_r.prepare(samples_per_second);
+	}
+
+	mix_frame<channels> next() noexcept {
+		auto l = detail::broadcast<channels, L::channels>(m_l.next());
+		const auto r = detail::broadcast<channels, R::channels>(m_r.next());
+
+		for (size_t channel = 0; channel < channels; ++channel) {
+			l[channel] *= r[channel];
+		}
+
+		return l;
+	}
+
+private:
+	L m_l;
+	R m_r;
+};
+
+template<typename L, typename R>
+class sum : public signal<sum<L, R>> {
+public:
+	static constexpr size_t channels = std::max(L::channels, R::channels);
+
+	explicit sum(L l, R r) : m_l(std::move(l)), m_r(std::move(r)) {
+	}
+
+	void prepare(double samples_per_second) {
+		m_l.prepare(samples_per_second);
+		m_r.prepare(samples_per_second);
+	}
+
+	mix_frame<channels> next() noexcept {
+		auto l = detail::broadcast<channels, L::channels>(m_l.next());
+		const auto r = detail::broadcast<channels, R::channels>(m_r.next());
+
+		for (size_t channel = 0; channel < channels; ++channel) {
+			l[channel] += r[channel];
+		}
+
+		return l;
+	}
+
+private:
+	L m_l;
+	R m_r;
+};
+
+template<typename L, typename R>
+auto operator*(const signal<L>& l, const signal<R>& r) {
+	return product<L, R>(l.derived(), r.derived());
+}
+
+template<typename L>
+auto operator*(const signal<L>& l, float r) {
+	return product<L, constant>(l.derived(), constant(r));
+}
+
+template<typename R>
+auto operator*(float l, const signal<R>& r) {
+	return product<constant, R>(constant(l), r.derived());
+}
+
+template<typename L, typename R>
+auto operator+(const signal<L>& l, const signal<R>& r) {
+	return sum<L, R>(l.derived(), r.derived());
+}
+
+template<typename Signal, typename Stage>
+auto operator|(const signal<Signal>& s, const stage<Stage>& st) {
+	return st.derived().bind(s.derived());
+}
+
+// Places a mono signal in the stereo field, using a constant power pan law.
+template<typename Signal>
+class panned : public signal<panned<Signal>> {
+public:
+	static_assert(Signal::channels == 1, "only mono signals can be panned");
+
+	static constexpr size_t channels = 2;
+
+	explicit panned(Signal signal, float position) : m_signal(std::move(signal)) {
+		const auto angle = (double(position) + 1.0) * M_PI / 4.0;
+		m_left = float(std::cos(angle));
+		m_right = float(std::sin(angle));
+	}
+
+	void prepare(double samples_per_second) {
+		m_signal.prepare(samples_per_second);
+	}
+
+	mix_frame<2> next() noexcept {
+		const auto value = m_signal.next()[0];
+		return {value * m_left, value * m_right};
+	}
+
+private:
+	Signal m_signal;
+	float m_left;
+	float m_right;
+};
+
+class pan : public stage<pan> {
+public:
+	// -1 is fully left, +1 fully right.
+	explicit pan(float position) : m_position(position) {
+		if (!(position >= -1.0f && position <= 1.0f)) {
+			throw std::invalid_argument(string_format("invalid argument for position: %f", position));
+		}
+	}
+
+	template<typename Signal>
+	auto bind(Signal signal) const {
+		return panned<Signal>(std::move(signal), m_position);
+	}
+
+private:
+	float m_position;
+};
+
+class gain : public stage<gain> {
+public:
+	explicit gain(float factor) noexcept : m_factor(factor) {
+	}
+
+	template<typename Signal>
+	auto bind(Signal signal) const {
+		return product<Signal, constant>(std::move(signal), constant(m_factor));
+	}
+
+private:
+	float m_factor;
+};
+
+// The provider at the end of a pipeline, usable wherever a ProviderFunction is expected.
+template<typename ValueType, size_t ChannelCount, typename Signal>
+class pipeline_provider {
+public:
+	explicit pipeline_provider(Signal signal) : m_signal(std::move(signal)) {
+	}
+
+	void operator()(typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) {
+		if (info.samples_per_second != m_samples_per_second) {
+			m_signal.prepare(double(info.samples_per_second));
+			m_samples_per_second = info.samples_per_second;
+		}
+
+		// The signal is rendered in chunks on the stack, so that the conversion can use convert_frames()' vectorized path.
+		constexpr size_t chunk_size = 256;
+		std::array<mix_frame<ChannelCount>, chunk_size> chunk;
+
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(chunk_size, size - done);
+
+				for (size_t i = 0; i < n; ++i) {
+					chunk[i] = detail::broadcast<ChannelCount, Signal::channels>(m_signal.next());
+				}
+
+				detail::convert_frames<ValueType, ChannelCount>(chunk.data(), span.data() + done, n);
+				done += n;
+			}
+		}
+	}
+
+private:
+	Signal m_signal;
+	size_t m_samples_per_second = 0;
+};
+
+template<typename ValueType, size_t ChannelCount>
+class to : public stage<to<ValueType, ChannelCount>> {
+public:
+	template<typename Signal>
+	auto bind(Signal signal) const {
+		return pipeline_provider<ValueType, ChannelCount, Signal>(std::move(signal));
+	}
+};
+
+} // namespace expressions
+
+} // namespace direct_sound
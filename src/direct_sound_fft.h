@@ -0,0 +1,125 @@
+#pragma once
+
+namespace direct_sound {
+
+// An in-place radix-2 FFT of a fixed, power of two size.
+//
+// Complex values are passed in split form, with the real and imaginary parts in two separate arrays,
+// so that the butterflies of the later stages can be computed 4 at a time with SSE2.
+// The bit reversal permutation and the twiddle factors of all stages are computed up front.
+class fft {
+public:
+	explicit fft(size_t size) : m_size(size) {
+		if (size < 2 || (size & (size - 1)) != 0 || size > (size_t(1) << 24)) {
+			throw std::invalid_argument(string_format("invalid argument for size: %zu", size));
+		}
+
+		size_t bits = 0;
+		while ((size_t(1) << bits) < size) {
+			++bits;
+		}
+
+		m_bit_reverse.resize(size);
+		for (size_t i = 0; i < size; ++i) {
+			size_t reversed = 0;
+			for (size_t bit = 0; bit < bits; ++bit) {
+				reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+			}
+			m_bit_reverse[i] = uint32_t(reversed);
+		}
+
+		// The stage with butterflies of half size `half` uses the `half` factors starting at index `half - 1`.
+		m_cos.resize(size - 1);
+		m_sin.resize(size - 1);
+		for (size_t half = 1; half < size; half <<= 1) {
+			for (size_t k = 0; k < half; ++k) {
+				const auto angle = -M_PI * double(k) / double(half);
+				m_cos[half - 1 + k] = float(std::cos(angle));
+				m_sin[half - 1 + k] = float(std::sin(angle));
+			}
+		}
+	}
+
+	size_t size() const noexcept {
+		return m_size;
+	}
+
+	void forward(float* re, float* im) const noexcept {
+		permute(re, im);
+
+		for (size_t half = 1; half < m_size; half <<= 1) {
+			const auto wr = m_cos.data() + half - 1;
+			const auto wi = m_sin.data() + half - 1;
+
+			for (size_t start = 0; start < m_size; start += 2 * half) {
+				butterflies(re + start, im + start, wr, wi, half);
+			}
+		}
+	}
+
+	// The inverse transform, including the 1/size normalization.
+	void inverse(float* re, float* im) const noexcept {
+		// Swapping the real and imaginary parts before and after a forward transform yields the inverse one.
+		forward(im, re);
+
+		const auto scale = 1.0f / float(m_size);
+		for (size_t i = 0; i < m_size; ++i) {
+			re[i] *= scale;
+			im[i] *= scale;
+		}
+	}
+
+private:
+	void permute(float* re, float* im) const noexcept {
+		for (size_t i = 0; i < m_size; ++i) {
+			const auto j = m_bit_reverse[i];
+			if (i < j) {
+				std::swap(re[i], re[j]);
+				std::swap(im[i], im[j]);
+			}
+		}
+	}
+
+	// Combines the `half` values starting at `re`/`im` with the `half` following them.
+	static void butterflies(float* re, float* im, const float* wr, const float* wi, size_t half) noexcept {
+		size_t k = 0;
+
+#if DIRECT_SOUND_SSE2
+		for (; k + 4 <= half; k += 4) {
+			const auto ar = _mm_loadu_ps(re + k);
+			const auto ai = _mm_loadu_ps(im + k);
+			const auto br = _mm_loadu_ps(re + k + half);
+			const auto bi = _mm_loadu_ps(im + k + half);
+			const auto cr = _mm_loadu_ps(wr + k);
+			const auto ci = _mm_loadu_ps(wi + k);
+
+			const auto tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+			const auto ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+
+			_mm_storeu_ps(re + k, _mm_add_ps(ar, tr));
+			_mm_storeu_ps(im + k, _mm_add_ps(ai, ti));
+			_mm_storeu_ps(re + k + half, _mm_sub_ps(ar, tr));
+			_mm_storeu_ps(im + k + half, _mm_sub_ps(ai, ti));
+		}
+#endif
+
+		for (; k < half; ++k) {
+			const auto br = re[k + half];
+			const auto bi = im[k + half];
+			const auto tr = br * wr[k] - bi * wi[k];
+			const auto ti = br * wi[k] + bi * wr[k];
+
+			re[k + half] = re[k] - tr;
+			im[k + half] = im[k] - ti;
+			re[k] += tr;
+			im[k] += ti;
+		}
+	}
+
+	size_t m_size;
+	std::vector<uint32_t> m_bit_reverse;
+	std::vector<float> m_cos;
+	std::vector<float> m_sin;
+};
+
+} // namespace direct_sound
@@ -0,0 +1,299 @@
+#pragma once
+
+namespace direct_sound {
+
+// Describes the fixed-point format integer ValueTypes are synthesized in: int16_t as Q15 and int32_t as Q31,
+// i.e. signed fractions in [-1, +1) with 15 and 31 fractional bits.
+template<typename ValueType>
+class fixed_point_traits {
+public:
+	static constexpr bool enabled = false;
+};
+
+template<>
+class fixed_point_traits<int16_t> {
+public:
+	static constexpr bool enabled = true;
+	static constexpr int fraction_bits = 15;
+};
+
+template<>
+class fixed_point_traits<int32_t> {
+public:
+	static constexpr bool enabled = true;
+	static constexpr int fraction_bits = 31;
+};
+
+namespace detail {
+
+// Oscillators, envelopes and gains compute in Q31 internally, whatever the ValueType.
+// Even Q15 output needs that much headroom: A Q15 envelope moving by less than 1 LSB per sample would stall.
+constexpr int fixed_internal_bits = 31;
+constexpr int32_t fixed_one = std::numeric_limits<int32_t>::max();
+
+// 4096 entries of a full sine period plus a guard entry, which keeps the linear interpolation's
+// error below 3e-7 (-130 dB), less than the resolution of 16-bit output by far.
+constexpr int fixed_sine_table_bits = 12;
+
+template<typename ValueType>
+constexpr ValueType fixed_saturate(int64_t value) noexcept {
+	constexpr auto minimum = int64_t(std::numeric_limits<ValueType>::min());
+	constexpr auto maximum = int64_t(std::numeric_limits<ValueType>::max());
+	return ValueType(value < minimum ? minimum : value > maximum ? maximum : value);
+}
+
+// Multiplies a Q31 value by a Q31 factor, rounding to nearest.
+constexpr int32_t fixed_multiply_q31(int32_t value, int32_t factor) noexcept {
+	return fixed_saturate<int32_t>((int64_t(value) * int64_t(factor) + (int64_t(1) << 30)) >> 31);
+}
+
+// Converts a Q31 value into the ValueType's format, rounding to nearest.
+template<typename ValueType>
+constexpr ValueType fixed_from_q31(int32_t value) noexcept {
+	constexpr auto shift = fixed_internal_bits - fixed_point_traits<ValueType>::fraction_bits;
+
+	if constexpr (shift == 0) {
+		return ValueType(value);
+	} else {
+		return fixed_saturate<ValueType>((int64_t(value) + (int64_t(1) << (shift - 1))) >> shift);
+	}
+}
+
+inline int32_t fixed_from_double(double value) noexcept {
+	return fixed_saturate<int32_t>(std::llround(std::clamp(value, -1.0, 1.0) * 2147483648.0));
+}
+
+inline const std::array<int32_t, (size_t(1) << fixed_sine_table_bits) + 1>& fixed_sine_table() {
+	static const auto table = []() {
+		std::array<int32_t, (size_t(1) << fixed_sine_table_bits) + 1> result;
+		const auto size = double(result.size() - 1);
+
+		for (size_t i = 0; i < result.size(); ++i) {
+			result[i] = fixed_from_double(std::sin(2.0 * M_PI * double(i) / size));
+		}
+
+		return result;
+	}();
+
+	return table;
+}
+
+} // namespace detail
+
+// A sine oscillator using integer operations only.
+//
+// The phase is a 32-bit accumulator, which wraps around at the end of each period by itself. Its upper
+// bits index a sine table, the following 16 bits interpolate linearly between two of its entries.
+template<typename ValueType>
+class fixed_oscillator {
+public:
+	static_assert(fixed_point_traits<ValueType>::enabled, "fixed_oscillator requires int16_t or int32_t");
+
+	fixed_oscillator() = default;
+
+	explicit fixed_oscillator(double frequency, size_t samples_per_second) {
+		if (!(frequency > 0.0) || frequency >= double(samples_per_second)) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+
+		set_frequency(frequency, samples_per_second);
+	}
+
+	// Changes the frequency, keeping the phase. Unlike the constructor this doesn't validate anything and
+	// can be used on the render thread: Frequencies at or above samples_per_second simply alias.
+	void set_frequency(double frequency, size_t samples_per_second) noexcept {
+		m_table = detail::fixed_sine_table().data();
+		m_increment = uint32_t(std::llround(frequency / double(samples_per_second) * 4294967296.0));
+	}
+
+	// The phase as a fraction of a period, scaled to 2^32.
+	void set_phase(uint32_t phase) noexcept {
+		m_phase = phase;
+	}
+
+	uint32_t phase() const noexcept {
+		return m_phase;
+	}
+
+	// Returns the next sample in Q31.
+	int32_t next_q31() noexcept {
+		constexpr auto index_shift = 32 - detail::fixed_sine_table_bits;
+		constexpr auto fraction_shift = index_shift - 16;
+
+		const auto index = m_phase >> index_shift;
+		const auto fraction = int64_t((m_phase >> fraction_shift) & 0xffff);
+		const auto a = int64_t(m_table[index]);
+		const auto b = int64_t(m_table[index + 1]);
+
+		m_phase += m_increment;
+		return int32_t(a + (((b - a) * fraction) >> 16));
+	}
+
+	ValueType next() noexcept {
+		return detail::fixed_from_q31<ValueType>(next_q31());
+	}
+
+private:
+	const int32_t* m_table = nullptr;
+	uint32_t m_phase = 0;
+	uint32_t m_increment = 0;
+};
+
+// A gain in Q31, converted from hundredths of a decibel like DirectSound volumes.
+// Unity is 1 - 2^-31, which is still exact for 16-bit output after rounding.
+class fixed_gain {
+public:
+	explicit fixed_gain(int hundredths_db = 0) noexcept : m_gain(detail::fixed_from_double(attenuation_to_gain(std::min(0, hundredths_db)))) {
+	}
+
+	int32_t q31() const noexcept {
+		return m_gain;
+	}
+
+	template<typename ValueType>
+	ValueType apply(ValueType value) const noexcept {
+		static_assert(fixed_point_traits<ValueType>::enabled, "fixed_gain requires int16_t or int32_t");
+		return detail::fixed_saturate<ValueType>((int64_t(value) * int64_t(m_gain) + (int64_t(1) << 30)) >> 31);
+	}
+
+private:
+	int32_t m_gain;
+};
+
+// A linear attack followed by an exponential decay, in Q31. The decay is a multiplication per sample,
+// just like additive_voice's envelopes, only with integers.
+class fixed_envelope {
+public:
+	fixed_envelope() = default;
+
+	// `attack` is the time to reach full level and `decay` the time until the level fell by 60 dB after that,
+	// both in seconds. A decay of 0 sustains the full level forever.
+	explicit fixed_envelope(size_t samples_per_second, double attack, double decay) {
+		if (samples_per_second == 0 || !(attack >= 0.0) || !(decay >= 0.0)) {
+			throw std::invalid_argument(string_format("invalid envelope: attack %f, decay %f", attack, decay));
+		}
+
+		const auto attack_samples = uint32_t(attack * double(samples_per_second));
+		m_level = attack_samples ? 0 : detail::fixed_one;
+		m_attack_step = attack_samples ? detail::fixed_one / int32_t(attack_samples) : 0;
+		m_attack_remaining = attack_samples;
+		m_decay_factor = decay > 0.0 ? detail::fixed_from_double(std::pow(10.0, -3.0 / (decay * double(samples_per_second)))) : detail::fixed_one;
+		m_sustained = decay == 0.0;
+	}
+
+	bool finished() const noexcept {
+		return !m_sustained && m_attack_remaining == 0 && m_level == 0;
+	}
+
+	// Returns the current level in Q31 and advances by a sample.
+	int32_t next() noexcept {
+		const auto level = m_level;
+
+		if (m_attack_remaining) {
+			--m_attack_remaining;
+			m_level = m_attack_remaining ? m_level + m_attack_step : detail::fixed_one;
+		} else if (!m_sustained) {
+			// Rounding towards 0 makes sure the level reaches 0 eventually instead of getting stuck at a tiny value.
+			m_level = int32_t((int64_t(m_level) * int64_t(m_decay_factor)) >> 31);
+		}
+
+		return level;
+	}
+
+private:
+	int32_t m_level = 0;
+	int32_t m_attack_step = 0;
+	uint32_t m_attack_remaining = 0;
+	int32_t m_decay_factor = detail::fixed_one;
+	bool m_sustained = true;
+};
+
+// Adds `src` to `dst`, saturating instead of wrapping around on overflow.
+template<typename ValueType>
+void fixed_mix(ValueType* dst, const ValueType* src, size_t count) noexcept {
+	static_assert(fixed_point_traits<ValueType>::enabled, "fixed_mix requires int16_t or int32_t");
+	size_t i = 0;
+
+#if DIRECT_SOUND_SSE2
+	if constexpr (std::is_same_v<ValueType, int16_t>) {
+		for (; i + 8 <= count; i += 8) {
+			const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+			const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epi16(a, b));
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		dst[i] = detail::fixed_saturate<ValueType>(int64_t(dst[i]) + int64_t(src[i]));
+	}
+}
+
+// A sine voice rendered entirely in fixed point, for targets where floating point is slow.
+// Unlike the other voices it renders the buffer's samples right away instead of mix_frames.
+template<typename ValueType, size_t ChannelCount>
+class fixed_voice {
+public:
+	using SampleType = typename buffer_trait<ValueType, ChannelCount>::SampleType;
+
+	fixed_voice() = default;
+
+	explicit fixed_voice(double frequency, size_t samples_per_second, int volume = 0, double attack = 0.005, double decay = 0.0) : m_oscillator(frequency, samples_per_second), m_envelope(samples_per_second, attack, decay), m_gain(volume) {
+	}
+
+	bool finished() const noexcept {
+		return m_envelope.finished();
+	}
+
+	void render(SampleType* frames, size_t count) noexcept {
+		const auto gain = m_gain.q31();
+
+		for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+			const auto level = detail::fixed_multiply_q31(m_envelope.next(), gain);
+			frame->fill(detail::fixed_from_q31<ValueType>(detail::fixed_multiply_q31(m_oscillator.next_q31(), level)));
+		}
+	}
+
+private:
+	fixed_oscillator<ValueType> m_oscillator;
+	fixed_envelope m_envelope;
+	fixed_gain m_gain;
+};
+
+// Mixes fixed_voices with fixed_mix(). Finished voices are skipped.
+template<typename ValueType, size_t ChannelCount>
+auto create_fixed_voices_provider(std::vector<fixed_voice<ValueType, ChannelCount>> voices) {
+	using SampleType = typename buffer_trait<ValueType, ChannelCount>::SampleType;
+
+	if (voices.empty()) {
+		throw std::invalid_argument("voices must not be empty");
+	}
+
+	return [voices = std::move(voices)](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		UNREFERENCED_PARAMETER(info);
+
+		// The voices are rendered in chunks on the stack, so that fills of any size don't allocate.
+		constexpr size_t chunk_size = 256;
+		SampleType scratch[chunk_size];
+
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+			memset(span.data(), 0, size * sizeof(SampleType));
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(size - done, chunk_size);
+
+				for (auto& voice : voices) {
+					if (!voice.finished()) {
+						voice.render(scratch, n);
+						fixed_mix(span.data()[done].data(), scratch[0].data(), n * ChannelCount);
+					}
+				}
+
+				done += n;
+			}
+		}
+	};
+}
+
+} // namespace direct_sound
@@ -0,0 +1,459 @@
+#pragma once
+
+namespace direct_sound {
+
+// Mixes sources, like voices or whole voice_allocators, through a tree of buses on several threads.
+//
+// Every block, each source renders into a buffer of its own, and each bus sums up its children
+// once the last of them finished, applying its gain and pan. The master bus is the root of the tree
+// and sums into the output. Sources are independent of each other, which is what makes them parallel:
+// They're dealt out to the participating threads round-robin and the thread finishing the last child
+// of a bus processes that bus next. Threads running out of work steal from the others' queues, and
+// wait on a condition variable if there's nothing to steal either, until a bus becomes ready.
+// The thread calling render() participates as well, so `threads` = 1 renders without any workers.
+//
+// Like voice_allocator, each block is rendered against a CPU budget: Sources which haven't started
+// by then are skipped for the block (rendering silence), instead of letting the block miss its deadline.
+// A budget of 0 disables that, for offline renders. Sources whose render function throws render silence as well.
+//
+// All nodes must be added before the first call to render(). Their buffers are allocated as they're added,
+// `max_block_size` frames each, and render() splits larger counts into blocks of that size, so that it never allocates.
+template<size_t ChannelCount>
+class render_graph {
+public:
+	static constexpr size_t channel_count = ChannelCount;
+
+	// Overwrites `count` frames.
+	using RenderFunction = std::function<void(mix_frame<ChannelCount>* frames, size_t count, size_t samples_per_second)>;
+	using node_id = size_t;
+
+	static constexpr node_id master = 0;
+
+	class statistics {
+	public:
+		size_t blocks = 0;
+		size_t steals = 0;
+		size_t dropped_sources = 0;
+		// Sources whose render function threw, counted once per block.
+		size_t failed_sources = 0;
+		// Time spent rendering relative to the playback duration of the block.
+		double last_load = 0.0;
+		double peak_load = 0.0;
+		// The time each participating thread spent per block on anything but rendering nodes, on average:
+		// Waking up, looking for work and waiting for the others. Includes idle time due to an imbalance
+		// of the work, like that of a bus whose children all had to finish first.
+		std::chrono::duration<double> overhead{0.0};
+	};
+
+	// `threads` includes the one calling render(). 0 uses one per core.
+	explicit render_graph(size_t threads = 0, double cpu_budget = 0.5, size_t max_block_size = 4096) : m_cpu_budget(cpu_budget), m_max_block_size(max_block_size) {
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (threads > 64) {
+			throw std::invalid_argument(string_format("invalid argument for threads: %zu", threads));
+		}
+		if (!(cpu_budget >= 0.0) || cpu_budget > 1.0) {
+			throw std::invalid_argument(string_format("invalid argument for cpu_budget: %f", cpu_budget));
+		}
+		if (max_block_size == 0) {
+			throw std::invalid_argument("max_block_size must not be 0");
+		}
+
+		m_nodes.emplace_back();
+		m_queues = std::vector<queue>(threads);
+
+		for (auto& q : m_queues) {
+			q.tasks.reserve(m_nodes.size());
+		}
+
+		for (size_t i = 1; i < threads; ++i) {
+			m_workers.emplace_back([this, i]() {
+				run_worker(i);
+			});
+		}
+	}
+
+	render_graph(const render_graph&) = delete;
+	render_graph& operator=(const render_graph&) = delete;
+
+	~render_graph() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_wake.notify_all();
+
+		for (auto& worker : m_workers) {
+			worker.join();
+		}
+	}
+
+	size_t threads() const noexcept {
+		return m_queues.size();
+	}
+
+	size_t max_block_size() const noexcept {
+		return m_max_block_size;
+	}
+
+	// `controls`, if given, set the bus' gain and pan, which are ramped towards while rendering.
+	node_id add_bus(node_id parent, std::shared_ptr<const gain_pan> controls = nullptr) {
+		auto& n = add_node(parent);
+		n.controls = std::move(controls);
+		return m_nodes.size() - 1;
+	}
+
+	node_id add_source(node_id parent, RenderFunction render) {
+		if (!render) {
+			throw std::invalid_argument("render must not be null");
+		}
+
+		auto& n = add_node(parent);
+		n.render = std::move(render);
+		return m_nodes.size() - 1;
+	}
+
+	// Sets the master bus' gain and pan.
+	void set_master_controls(std::shared_ptr<const gain_pan> controls) {
+		m_nodes[master].controls = std::move(controls);
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count, size_t samples_per_second) {
+		for (size_t done = 0; done < count;) {
+			const auto n = std::min(count - done, m_max_block_size);
+			render_block(frames + done, n, samples_per_second);
+			done += n;
+		}
+	}
+
+	statistics stats() const {
+		std::lock_guard<std::mutex> lock(m_stats_mutex);
+		return m_statistics;
+	}
+
+private:
+	static constexpr std::chrono::microseconds min_budget{250};
+
+	class node {
+	public:
+		node_id parent = master;
+		std::vector<node_id> children;
+		RenderFunction render;
+		std::shared_ptr<const gain_pan> controls;
+		gain_pan_smoother smoother;
+		std::vector<mix_frame<ChannelCount>> buffer;
+		std::atomic<size_t> pending = 0;
+
+		explicit node() noexcept {
+		}
+
+		// Only moved while the graph is built.
+		node(node&& other) noexcept : parent(other.parent), children(std::move(other.children)), render(std::move(other.render)), controls(std::move(other.controls)), smoother(other.smoother), buffer(std::move(other.buffer)) {
+		}
+	};
+
+	// Ready nodes of a participating thread. It takes them from the back, thieves take them from the front.
+	// Its capacity is reserved as nodes are added, as no node is queued more than once per block.
+	class queue {
+	public:
+		void reset() noexcept {
+			tasks.clear();
+			front = 0;
+		}
+
+		std::mutex mutex;
+		std::vector<node_id> tasks;
+		size_t front = 0;
+
+		std::atomic<int64_t> busy = 0;
+		std::atomic<size_t> steals = 0;
+		std::atomic<size_t> dropped = 0;
+		std::atomic<size_t> failed = 0;
+	};
+
+	void render_block(mix_frame<ChannelCount>* frames, size_t count, size_t samples_per_second) {
+		const auto start = std::chrono::steady_clock::now();
+		const auto block_duration = std::chrono::duration<double>(double(count) / double(samples_per_second));
+		const auto budget = std::max<std::chrono::duration<double>>(block_duration * m_cpu_budget, min_budget);
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			// Workers may still be looking for work in the last block, even though there's none left.
+			m_idle.wait(lock, [this]() { return m_active == 0; });
+
+			m_started = true;
+			m_output = frames;
+			m_count = count;
+			m_samples_per_second = samples_per_second;
+			m_deadline = m_cpu_budget > 0.0 ? start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget) : std::chrono::steady_clock::time_point::max();
+
+			for (auto& q : m_queues) {
+				q.reset();
+			}
+
+			// Nodes without children, i.e. all sources and any empty buses, are ready right away.
+			size_t next_queue = 0;
+
+			for (node_id id = 0; id < m_nodes.size(); ++id) {
+				auto& n = m_nodes[id];
+				n.pending.store(n.children.size(), std::memory_order_relaxed);
+
+				if (n.children.empty()) {
+					m_queues[next_queue].tasks.push_back(id);
+					next_queue = (next_queue + 1) % m_queues.size();
+				}
+			}
+
+			m_remaining.store(m_nodes.size(), std::memory_order_release);
+			++m_generation;
+		}
+
+		m_wake.notify_all();
+		participate(0);
+
+		// Everything's done once m_remaining reached 0, but the counters of workers which
+		// are still looking for work could still change. They're only read below.
+		int64_t busy = 0;
+		size_t steals = 0;
+		size_t dropped = 0;
+		size_t failed = 0;
+
+		for (auto& q : m_queues) {
+			busy += q.busy.exchange(0, std::memory_order_relaxed);
+			steals += q.steals.exchange(0, std::memory_order_relaxed);
+			dropped += q.dropped.exchange(0, std::memory_order_relaxed);
+			failed += q.failed.exchange(0, std::memory_order_relaxed);
+		}
+
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const auto load = std::chrono::duration<double>(elapsed) / block_duration;
+		const auto overhead = std::chrono::duration<double>(elapsed) - std::chrono::duration<double>(std::chrono::nanoseconds(busy)) / double(m_queues.size());
+
+		std::lock_guard<std::mutex> lock(m_stats_mutex);
+		++m_statistics.blocks;
+		m_statistics.steals += steals;
+		m_statistics.dropped_sources += dropped;
+		m_statistics.failed_sources += failed;
+		m_statistics.last_load = load;
+		m_statistics.peak_load = std::max(m_statistics.peak_load, load);
+		// A running average over the blocks rendered so far.
+		m_statistics.overhead += (overhead - m_statistics.overhead) / double(m_statistics.blocks);
+	}
+
+	node& add_node(node_id parent) {
+		if (m_started) {
+			throw std::logic_error("nodes must be added before the first render()");
+		}
+		if (parent >= m_nodes.size() || m_nodes[parent].render) {
+			throw std::invalid_argument(string_format("invalid argument for parent: %zu is not a bus", parent));
+		}
+
+		m_nodes[parent].children.push_back(m_nodes.size());
+		m_nodes.emplace_back();
+		m_nodes.back().parent = parent;
+		m_nodes.back().buffer.resize(m_max_block_size);
+
+		for (auto& q : m_queues) {
+			q.tasks.reserve(m_nodes.size());
+		}
+
+		return m_nodes.back();
+	}
+
+	void run_worker(size_t index) {
+		uint64_t generation = 0;
+
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this, generation]() { return m_exit || m_generation != generation; });
+
+				if (m_exit) {
+					return;
+				}
+
+				generation = m_generation;
+				++m_active;
+			}
+
+			participate(index);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				--m_active;
+			}
+
+			m_idle.notify_all();
+		}
+	}
+
+	// Processes nodes until all of the block's are done.
+	void participate(size_t index) {
+		auto& own = m_queues[index];
+
+		while (m_remaining.load(std::memory_order_acquire) != 0) {
+			// Read before looking for work, so that a bus queued in between isn't missed by the wait below.
+			const auto queued = m_queued.load(std::memory_order_acquire);
+			node_id id;
+
+			if (pop(own, id) || steal(index, id)) {
+				process(id, index);
+				continue;
+			}
+
+			// Everything left is either being rendered or a bus waiting for its children.
+			std::unique_lock<std::mutex> lock(m_work_mutex);
+			m_work.wait(lock, [this, queued]() {
+				return m_remaining.load(std::memory_order_acquire) == 0 || m_queued.load(std::memory_order_acquire) != queued;
+			});
+		}
+	}
+
+	// Wakes the threads waiting for work in participate(). Taking the lock makes sure none of them
+	// is in between checking the condition and starting to wait, which would miss the notification.
+	void notify_work() {
+		{
+			std::lock_guard<std::mutex> lock(m_work_mutex);
+		}
+		m_work.notify_all();
+	}
+
+	static bool pop(queue& q, node_id& id) {
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		if (q.tasks.size() == q.front) {
+			return false;
+		}
+
+		id = q.tasks.back();
+		q.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(size_t index, node_id& id) {
+		for (size_t i = 1; i < m_queues.size(); ++i) {
+			auto& victim = m_queues[(index + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if (victim.tasks.size() != victim.front) {
+				id = victim.tasks[victim.front++];
+				m_queues[index].steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void process(node_id id, size_t index) {
+		auto& n = m_nodes[id];
+		auto& own = m_queues[index];
+		const auto count = m_count;
+		const auto start = std::chrono::steady_clock::now();
+		const auto frames = id == master ? m_output : n.buffer.data();
+
+		if (n.render) {
+			if (start > m_deadline) {
+				std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+				own.dropped.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				// The node must complete either way, or its bus and with it the whole block never would.
+				try {
+					n.render(frames, count, m_samples_per_second);
+				} catch (...) {
+					std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+					own.failed.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		} else {
+			std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+
+			for (const auto child : n.children) {
+				const auto src = reinterpret_cast<const float*>(m_nodes[child].buffer.data());
+				const auto dst = reinterpret_cast<float*>(frames);
+
+				for (size_t i = 0; i < count * ChannelCount; ++i) {
+					dst[i] += src[i];
+				}
+			}
+
+			if (n.controls) {
+				n.smoother.apply(*n.controls, frames, count, m_samples_per_second);
+			}
+		}
+
+		own.busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+		if (id != master && m_nodes[n.parent].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			{
+				std::lock_guard<std::mutex> lock(own.mutex);
+				own.tasks.push_back(n.parent);
+			}
+
+			m_queued.fetch_add(1, std::memory_order_acq_rel);
+			notify_work();
+		}
+
+		if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			notify_work();
+		}
+	}
+
+	std::vector<node> m_nodes;
+	std::vector<queue> m_queues;
+	std::vector<std::thread> m_workers;
+	double m_cpu_budget;
+	size_t m_max_block_size;
+	bool m_started = false;
+
+	// Set up by render() for each block, while holding m_mutex.
+	mix_frame<ChannelCount>* m_output = nullptr;
+	size_t m_count = 0;
+	size_t m_samples_per_second = 0;
+	std::chrono::steady_clock::time_point m_deadline;
+	std::atomic<size_t> m_remaining = 0;
+
+	// Counts the buses queued, which threads without work wait on.
+	std::atomic<uint64_t> m_queued = 0;
+	std::mutex m_work_mutex;
+	std::condition_variable m_work;
+
+	// Guards everything below.
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	uint64_t m_generation = 0;
+	size_t m_active = 0;
+	bool m_exit = false;
+
+	mutable std::mutex m_stats_mutex;
+	statistics m_statistics;
+};
+
+template<typename ValueType, size_t ChannelCount>
+auto create_render_graph_provider(std::shared_ptr<render_graph<ChannelCount>> graph) {
+	if (!graph) {
+		throw std::invalid_argument("graph must not be null");
+	}
+
+	// The graph renders at most max_block_size() frames at a time anyways, which is all the mix needs to hold.
+	std::vector<mix_frame<ChannelCount>> mix(graph->max_block_size());
+
+	return [graph, mix](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(size - done, mix.size());
+				graph->render(mix.data(), n, info.samples_per_second);
+				detail::convert_frames<ValueType, ChannelCount>(mix.data(), span.data() + done, n);
+				done += n;
+			}
+		}
+	};
+}
+
+} // namespace direct_sound
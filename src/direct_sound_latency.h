@@ -0,0 +1,124 @@
+#pragma once
+
+namespace direct_sound {
+
+// Measures the time from control events, like a key press or a slider tick, until their output is played.
+//
+// The control thread calls mark() right before acting on an event. The first fill of a buffer whose provider
+// was wrapped by create_latency_provider() starting after that is the first one which can contain the event's
+// output, so its first sample is tagged: It's played once the samples queued in front of it in the buffer,
+// buffer_info::samples_ahead, have been. The latency is the time until the fill started plus the time it
+// takes to play those. Neither the latency of the device behind the play cursor nor any a provider adds
+// itself, like a convolver's, are included.
+class latency_probe {
+public:
+	// All in seconds.
+	class statistics {
+	public:
+		size_t count = 0;
+		double min = 0.0;
+		double mean = 0.0;
+		double median = 0.0;
+		double p95 = 0.0;
+		double p99 = 0.0;
+		double max = 0.0;
+	};
+
+	explicit latency_probe() noexcept {
+	}
+
+	latency_probe(const latency_probe&) = delete;
+	latency_probe& operator=(const latency_probe&) = delete;
+
+	// Timestamps a control event. May be called from any thread.
+	void mark() {
+		const auto now = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.push_back(now);
+		m_has_pending.store(true, std::memory_order_release);
+	}
+
+	// Called by the provider at the start of each fill. Only takes the lock if there are pending events.
+	void tag(const buffer_info& info) {
+		if (!m_has_pending.load(std::memory_order_acquire)) {
+			return;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		const auto queued = info.samples_per_second ? double(info.samples_ahead) / double(info.samples_per_second) : 0.0;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (const auto& event : m_pending) {
+			m_latencies.push_back(std::chrono::duration<double>(now - event).count() + queued);
+		}
+
+		m_pending.clear();
+		m_has_pending.store(false, std::memory_order_relaxed);
+	}
+
+	// The latency of each event measured so far, in seconds.
+	std::vector<double> latencies() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_latencies;
+	}
+
+	statistics stats() const {
+		auto sorted = latencies();
+		statistics result;
+
+		if (sorted.empty()) {
+			return result;
+		}
+
+		std::sort(sorted.begin(), sorted.end());
+
+		const auto percentile = [&sorted](double p) {
+			return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))];
+		};
+
+		result.count = sorted.size();
+		result.min = sorted.front();
+		result.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / double(sorted.size());
+		result.median = percentile(0.5);
+		result.p95 = percentile(0.95);
+		result.p99 = percentile(0.99);
+		result.max = sorted.back();
+		return result;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.clear();
+		m_latencies.clear();
+		m_has_pending.store(false, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> m_has_pending = false;
+
+	// Guards everything below.
+	mutable std::mutex m_mutex;
+	std::vector<std::chrono::steady_clock::time_point> m_pending;
+	std::vector<double> m_latencies;
+};
+
+// Tags the fills of `provider` for `probe`. Wrap the outermost provider of a buffer, so that the tag is taken
+// before any of the work the fill does.
+template<typename ValueType, size_t ChannelCount>
+auto create_latency_provider(typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, std::shared_ptr<latency_probe> probe) {
+	if (!provider) {
+		throw std::invalid_argument("provider must not be null");
+	}
+	if (!probe) {
+		throw std::invalid_argument("probe must not be null");
+	}
+
+	return [provider = std::move(provider), probe = std::move(probe)](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) {
+		probe->tag(info);
+		provider(spans, info);
+	};
+}
+
+} // namespace direct_sound
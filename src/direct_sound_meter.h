@@ -0,0 +1,250 @@
+#pragma once
+
+namespace direct_sound {
+
+// Output levels and spectrum as computed by a meter.
+template<size_t ChannelCount>
+class meter_readings {
+public:
+	// Peak level with a falloff of meter::peak_falloff_db per second, linear.
+	std::array<float, ChannelCount> peak = {};
+	// RMS level, averaged over meter::rms_window, linear.
+	std::array<float, ChannelCount> rms = {};
+	// Samples of the mix beyond full scale, which were clipped when it was converted to the buffer's ValueType.
+	// Only counted for mixes passed to meter::count_clipped().
+	std::array<uint64_t, ChannelCount> clipped = {};
+	// Magnitudes of the fft_size / 2 frequency bins of the latest fft_size frames, in dBFS.
+	// Bin i is centered at i * samples_per_second / fft_size Hz. Empty until that many frames were analyzed.
+	std::vector<float> spectrum;
+	size_t samples_per_second = 0;
+	uint64_t frames = 0;
+	// Frames that didn't fit into the tap's queue because the worker thread fell behind.
+	uint64_t dropped_frames = 0;
+};
+
+// Converts a linear level into dBFS, with silence mapped to -inf.
+inline float level_to_db(float level) noexcept {
+	return level > 0.0f ? 20.0f * std::log10(level) : -std::numeric_limits<float>::infinity();
+}
+
+// Measures the levels and the spectrum of the output of a provider.
+//
+// The render thread only copies its blocks into a lock-free queue (see create_meter_provider()).
+// All the analysis happens on a worker thread owned by the meter, which wakes up every `period`.
+// Its results can be polled with readings() from any thread.
+template<typename ValueType, size_t ChannelCount>
+class meter {
+public:
+	using SampleType = typename buffer_trait<ValueType, ChannelCount>::SampleType;
+
+	static constexpr float peak_falloff_db = 20.0f;
+	static constexpr double rms_window = 0.3;
+
+	explicit meter(size_t fft_size = 2048, std::chrono::milliseconds period = std::chrono::milliseconds(30), size_t capacity = 65536) : m_fft(fft_size), m_queue(capacity), m_period(period) {
+		if (period.count() <= 0) {
+			throw std::invalid_argument("period must be positive");
+		}
+
+		m_incoming.resize(m_queue.capacity());
+		m_history.resize(fft_size);
+		m_re.resize(fft_size);
+		m_im.resize(fft_size);
+
+		// A Hann window, normalized so that a full scale sine reads as 0 dBFS in its bin.
+		m_window.resize(fft_size);
+		double sum = 0.0;
+		for (size_t i = 0; i < fft_size; ++i) {
+			m_window[i] = float(0.5 - 0.5 * std::cos(2.0 * M_PI * double(i) / double(fft_size)));
+			sum += m_window[i];
+		}
+		for (auto& w : m_window) {
+			w = float(double(w) * 2.0 / sum);
+		}
+
+		m_thread = std::thread([this]() {
+			run();
+		});
+	}
+
+	meter(const meter&) = delete;
+	meter& operator=(const meter&) = delete;
+
+	~meter() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_cv.notify_all();
+		m_thread.join();
+	}
+
+	// Called by the render thread. Never blocks.
+	void push(const SampleType* frames, size_t count, size_t samples_per_second) noexcept {
+		m_samples_per_second.store(samples_per_second, std::memory_order_relaxed);
+
+		const auto pushed = m_queue.push(frames, count);
+		if (pushed != count) {
+			m_dropped_frames.fetch_add(count - pushed, std::memory_order_relaxed);
+		}
+	}
+
+	// Counts the samples of a mix beyond full scale, before it's converted to ValueType. Clipping can't be told apart
+	// from a sample which just reached full scale after the conversion anymore. Called by the render thread.
+	void count_clipped(const mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		for (size_t channel = 0; channel < ChannelCount; ++channel) {
+			uint64_t clipped = 0;
+
+			for (size_t i = 0; i < count; ++i) {
+				clipped += std::abs(frames[i][channel]) > 1.0f ? 1 : 0;
+			}
+
+			if (clipped) {
+				m_clipped[channel].fetch_add(clipped, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	meter_readings<ChannelCount> readings() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto result = m_readings;
+		result.dropped_frames = m_dropped_frames.load(std::memory_order_relaxed);
+
+		for (size_t channel = 0; channel < ChannelCount; ++channel) {
+			result.clipped[channel] = m_clipped[channel].load(std::memory_order_relaxed);
+		}
+
+		return result;
+	}
+
+	// Resets the clip counters right away and the peak levels with the worker thread's next pass.
+	void reset() noexcept {
+		for (auto& clipped : m_clipped) {
+			clipped.store(0, std::memory_order_relaxed);
+		}
+
+		m_reset.store(true, std::memory_order_relaxed);
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (!m_cv.wait_for(lock, m_period, [this]() { return m_exit; })) {
+			lock.unlock();
+
+			if (m_reset.exchange(false, std::memory_order_relaxed)) {
+				m_result.peak = {};
+			}
+
+			if (const auto count = m_queue.pop(m_incoming.data(), m_incoming.size())) {
+				analyze(count);
+			}
+
+			lock.lock();
+			m_readings = m_result;
+		}
+	}
+
+	void analyze(size_t count) {
+		const auto samples_per_second = std::max<size_t>(1, m_samples_per_second.load(std::memory_order_relaxed));
+		const auto seconds = double(count) / double(samples_per_second);
+		const auto falloff = float(std::pow(10.0, -double(peak_falloff_db) * seconds / 20.0));
+		const auto rms_coefficient = std::min(1.0, seconds / rms_window);
+		constexpr auto scale = std::is_floating_point_v<ValueType> ? 1.0f : 1.0f / float(std::numeric_limits<ValueType>::max());
+
+		for (size_t channel = 0; channel < ChannelCount; ++channel) {
+			float peak = 0.0f;
+			double sum = 0.0;
+
+			for (size_t i = 0; i < count; ++i) {
+				const auto value = std::abs(float(m_incoming[i][channel]) * scale);
+				peak = std::max(peak, value);
+				sum += double(value) * double(value);
+			}
+
+			m_result.peak[channel] = std::max(peak, m_result.peak[channel] * falloff);
+			m_mean_square[channel] += (sum / double(count) - m_mean_square[channel]) * rms_coefficient;
+			m_result.rms[channel] = float(std::sqrt(m_mean_square[channel]));
+		}
+
+		m_result.frames += count;
+		m_result.samples_per_second = samples_per_second;
+
+		// The spectrum is computed over the mono sum of the latest fft_size frames.
+		const auto fft_size = m_history.size();
+
+		for (size_t i = 0; i < count; ++i) {
+			float mono = 0.0f;
+			for (size_t channel = 0; channel < ChannelCount; ++channel) {
+				mono += float(m_incoming[i][channel]) * scale;
+			}
+
+			m_history[m_history_pos] = mono / float(ChannelCount);
+			m_history_pos = (m_history_pos + 1) % fft_size;
+		}
+
+		if (m_result.frames < fft_size) {
+			return;
+		}
+
+		for (size_t i = 0; i < fft_size; ++i) {
+			m_re[i] = m_history[(m_history_pos + i) % fft_size] * m_window[i];
+			m_im[i] = 0.0f;
+		}
+
+		m_fft.forward(m_re.data(), m_im.data());
+
+		m_result.spectrum.resize(fft_size / 2);
+		for (size_t i = 0; i < fft_size / 2; ++i) {
+			m_result.spectrum[i] = level_to_db(std::sqrt(m_re[i] * m_re[i] + m_im[i] * m_im[i]));
+		}
+	}
+
+	fft m_fft;
+	spsc_queue<SampleType> m_queue;
+	std::chrono::milliseconds m_period;
+	std::atomic<size_t> m_samples_per_second = 0;
+	std::atomic<uint64_t> m_dropped_frames = 0;
+	std::atomic<bool> m_reset = false;
+	std::array<std::atomic<uint64_t>, ChannelCount> m_clipped = {};
+
+	// Only used by the worker thread.
+	std::vector<SampleType> m_incoming;
+	std::vector<float> m_history;
+	size_t m_history_pos = 0;
+	std::vector<float> m_window;
+	std::vector<float> m_re;
+	std::vector<float> m_im;
+	std::array<double, ChannelCount> m_mean_square = {};
+	meter_readings<ChannelCount> m_result;
+
+	std::thread m_thread;
+
+	// Guards everything below.
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_exit = false;
+	meter_readings<ChannelCount> m_readings;
+};
+
+// Wraps `provider` and copies its output into `meter`.
+template<typename ValueType, size_t ChannelCount>
+auto create_meter_provider(typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, std::shared_ptr<meter<ValueType, ChannelCount>> meter) {
+	if (!provider) {
+		throw std::invalid_argument("provider must not be null");
+	}
+	if (!meter) {
+		throw std::invalid_argument("meter must not be null");
+	}
+
+	return [provider, meter](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) {
+		provider(spans, info);
+
+		for (const auto span : spans) {
+			meter->push(span.data(), size_t(span.size()), info.samples_per_second);
+		}
+	};
+}
+
+} // namespace direct_sound
@@ -0,0 +1,356 @@
+#pragma once
+
+namespace direct_sound {
+
+// Estimates how much faster or slower a consumer clock runs compared to a producer clock,
+// from the fill level of the queue between them, and derives the resampling ratio
+// (input frames per output frame) keeping that level at its target.
+//
+// This is a PI controller: The integral part converges on the actual clock drift, while
+// the proportional part slowly pulls the level back to the target after it got off.
+// The level is low-pass filtered first, as it jitters by a whole block with every fill.
+//
+// The default gains make the loop about critically damped at 44.1 kHz, with both poles at ~0.66/s.
+// On the virtual device (see htw-avgp-cli --drift) the estimate of a 300 ppm drift reaches it after 7-10 s.
+// Scheduling jitter keeps it wandering around the drift by +-50-100 ppm after that, which averages out.
+class drift_estimator {
+public:
+	explicit drift_estimator(double target_level, double proportional = 3e-5, double integral = 1e-5, std::chrono::duration<double> smoothing = std::chrono::milliseconds(500)) : m_target(target_level), m_proportional(proportional), m_integral(integral), m_smoothing(smoothing.count()) {
+		if (!(target_level > 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for target_level: %f", target_level));
+		}
+	}
+
+	// Feeds the queue level observed right before `frames` output frames are rendered and
+	// returns the resampling ratio to render them with.
+	double update(double level, size_t frames, size_t samples_per_second) noexcept {
+		const auto seconds = double(frames) / double(samples_per_second);
+
+		if (!m_primed) {
+			m_level = level;
+			m_primed = true;
+		} else {
+			m_level += (level - m_level) * std::min(1.0, seconds / m_smoothing);
+		}
+
+		// While settling, the filtered level is still catching up with the actual one and becomes the target instead.
+		if (m_settling > 0.0) {
+			m_settling -= seconds;
+			m_target = m_level;
+		}
+
+		// Both gains are per frame of deviation and per second respectively, independent of the block size.
+		const auto error = m_level - m_target;
+		m_drift += m_integral * error * seconds;
+		m_ratio = 1.0 + m_drift + m_proportional * error;
+		return m_ratio;
+	}
+
+	// Adopts the level of the next few blocks as the new target, keeping the drift estimated so far.
+	// Used whenever the consumer (re)starts, as the level it starts at is the latency it should keep.
+	// The level only settles a second or two after starting, which is why the target follows it for that long.
+	void restart(double level) noexcept {
+		m_target = level;
+		m_level = level;
+		m_primed = true;
+		m_settling = 4.0 * m_smoothing;
+	}
+
+	double ratio() const noexcept {
+		return m_ratio;
+	}
+
+	// The estimated rate of the consumer clock relative to the producer's, minus 1.
+	// The consumer reads 1 + m_drift input frames per output frame to keep up with the producer.
+	double drift_ppm() const noexcept {
+		return (1.0 / (1.0 + m_drift) - 1.0) * 1e6;
+	}
+
+	double level() const noexcept {
+		return m_level;
+	}
+
+private:
+	double m_target;
+	double m_proportional;
+	double m_integral;
+	double m_smoothing;
+	bool m_primed = false;
+	double m_settling = 0.0;
+	double m_level = 0.0;
+	double m_drift = 0.0;
+	double m_ratio = 1.0;
+};
+
+// Resamples a stream of frames by a ratio that may change with every block,
+// using 4-point Hermite interpolation. Pulls its input from a queue.
+template<size_t ChannelCount>
+class adaptive_resampler {
+public:
+	// Renders `count` frames, advancing by `ratio` input frames per output frame.
+	// Returns the number of input frames which were missing from `input` and substituted by silence.
+	size_t process(spsc_queue<mix_frame<ChannelCount>>& input, mix_frame<ChannelCount>* output, size_t count, double ratio) {
+		// Count the input frames this block needs up front, using the same arithmetic as the loop
+		// below, so that they can be popped from the queue all at once.
+		size_t needed = 0;
+		auto phase = m_phase;
+		for (size_t i = 0; i < count; ++i) {
+			phase += ratio;
+			while (phase >= 1.0) {
+				phase -= 1.0;
+				++needed;
+			}
+		}
+
+		if (m_input.size() < needed) {
+			m_input.resize(needed);
+		}
+
+		const auto available = input.pop(m_input.data(), needed);
+		std::fill(m_input.begin() + available, m_input.begin() + needed, mix_frame<ChannelCount>{});
+
+		auto next = m_input.data();
+
+		for (auto frame = output, end = output + count; frame != end; ++frame) {
+			const auto t = float(m_phase);
+			const auto& h = m_history;
+
+			for (size_t channel = 0; channel < ChannelCount; ++channel) {
+				const auto y0 = h[0][channel], y1 = h[1][channel], y2 = h[2][channel], y3 = h[3][channel];
+				const auto c1 = 0.5f * (y2 - y0);
+				const auto c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+				const auto c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+				(*frame)[channel] = ((c3 * t + c2) * t + c1) * t + y1;
+			}
+
+			m_phase += ratio;
+			while (m_phase >= 1.0) {
+				m_phase -= 1.0;
+				m_history = {{m_history[1], m_history[2], m_history[3], *next++}};
+			}
+		}
+
+		return needed - available;
+	}
+
+private:
+	// Interpolation happens between m_history[1] and m_history[2].
+	std::array<mix_frame<ChannelCount>, 4> m_history = {};
+	double m_phase = 0.0;
+	std::vector<mix_frame<ChannelCount>> m_input;
+};
+
+// Plays the same mix on several outputs at once, each of which may run on its own clock.
+//
+// The first backend is the clock master: Its buffer renders the mix and forwards a copy to each
+// of the other outputs through a lock-free queue. These follow the master with an adaptive_resampler,
+// whose ratio a drift_estimator derives from the queue's fill level. Followers start out silent until
+// their queue is filled to its target level, which adds `samples` samples of latency to them.
+// Alternatively, each output plays a bus of its own, all of which the master renders and forwards.
+template<typename ValueType, size_t ChannelCount>
+class multi_output : public playable {
+public:
+	class statistics {
+	public:
+		double drift_ppm = 0.0;
+		double ratio = 1.0;
+		double level = 0.0;
+		size_t underruns = 0;
+		size_t overruns = 0;
+	};
+
+	explicit multi_output(const std::vector<const backend*>& backends, size_t samples_per_second, size_t samples, typename buffer_trait<float, ChannelCount>::ProviderFunction mix) {
+		if (!mix) {
+			throw std::invalid_argument("mix must not be null");
+		}
+
+		start(backends, samples_per_second, samples, {std::move(mix)});
+	}
+
+	// Plays `buses[i]` on `backends[i]`, e.g. separate mixes for the speakers and a pair of headphones.
+	// All buses are rendered in the master's fills, so that the followers still only resample.
+	explicit multi_output(const std::vector<const backend*>& backends, size_t samples_per_second, size_t samples, std::vector<typename buffer_trait<float, ChannelCount>::ProviderFunction> buses) {
+		if (buses.size() != backends.size()) {
+			throw std::invalid_argument(string_format("bus count mismatch: %zu buses for %zu backends", buses.size(), backends.size()));
+		}
+		if (std::find(buses.begin(), buses.end(), nullptr) != buses.end()) {
+			throw std::invalid_argument("buses must not contain null");
+		}
+
+		start(backends, samples_per_second, samples, std::move(buses));
+	}
+
+	size_t outputs() const noexcept {
+		return m_buffers.size();
+	}
+
+	// Returns the statistics of output `index`, which must be a follower (i.e. not 0).
+	statistics output_statistics(size_t index) const {
+		if (index == 0 || index >= m_buffers.size()) {
+			throw std::invalid_argument(string_format("invalid argument for index: %zu", index));
+		}
+
+		const auto& f = *m_followers[index - 1];
+		std::lock_guard<std::mutex> lock(f.mutex);
+		auto result = f.stats;
+		result.overruns = f.overruns.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	void play(bool looping = false) override {
+		for (auto& buffer : m_buffers) {
+			buffer.play(looping);
+		}
+	}
+
+	void stop() override {
+		for (auto& buffer : m_buffers) {
+			buffer.stop();
+		}
+	}
+
+	void set_volume(int volume) override {
+		for (auto& buffer : m_buffers) {
+			buffer.set_volume(volume);
+		}
+	}
+
+	void set_pan(int pan) override {
+		for (auto& buffer : m_buffers) {
+			buffer.set_pan(pan);
+		}
+	}
+
+private:
+	// With a single bus, it's played on all outputs. Otherwise there's one per output.
+	void start(const std::vector<const backend*>& backends, size_t samples_per_second, size_t samples, std::vector<typename buffer_trait<float, ChannelCount>::ProviderFunction> buses) {
+		if (backends.empty() || std::find(backends.begin(), backends.end(), nullptr) != backends.end()) {
+			throw std::invalid_argument("backends must not be empty or contain null");
+		}
+
+		for (size_t i = 1; i < backends.size(); ++i) {
+			m_followers.emplace_back(std::make_shared<follower>(samples));
+		}
+
+		m_buffers.reserve(backends.size());
+
+		m_buffers.emplace_back(*backends[0], samples_per_second, samples, [buses, followers = m_followers, scratch = std::vector<mix_frame<ChannelCount>>()](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+			for (const auto span : spans) {
+				const auto size = size_t(span.size());
+
+				if (scratch.size() < size) {
+					scratch.resize(size);
+				}
+
+				const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+
+				const auto render = [&](const typename buffer_trait<float, ChannelCount>::ProviderFunction& bus) {
+					bus({{{scratch.data(), ptrdiff_t(size)}, {}}}, info);
+				};
+
+				const auto push = [&](follower& f) {
+					if (f.queue.push(scratch.data(), size) != size) {
+						f.overruns.fetch_add(1, std::memory_order_relaxed);
+					}
+					f.last_push.store(now, std::memory_order_release);
+				};
+
+				if (buses.size() == 1) {
+					render(buses[0]);
+
+					for (const auto& f : followers) {
+						push(*f);
+					}
+				} else {
+					// The followers' buses pass through the scratch buffer first, so that the master's own ends up in it.
+					for (size_t i = 0; i < followers.size(); ++i) {
+						render(buses[i + 1]);
+						push(*followers[i]);
+					}
+
+					render(buses[0]);
+				}
+
+				detail::convert_frames<ValueType, ChannelCount>(scratch.data(), span.data(), size);
+			}
+		}, fill_mode::play_cursor);
+
+		for (size_t i = 1; i < backends.size(); ++i) {
+			m_buffers.emplace_back(*backends[i], samples_per_second, samples, [f = m_followers[i - 1]](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) {
+				for (const auto span : spans) {
+					f->render(span.data(), size_t(span.size()), info.samples_per_second);
+				}
+			}, fill_mode::play_cursor);
+		}
+	}
+
+	class follower {
+	public:
+		explicit follower(size_t samples) : queue(samples * 4), estimator(double(samples)), target(samples) {
+		}
+
+		void render(typename buffer_trait<ValueType, ChannelCount>::SampleType* out, size_t count, size_t samples_per_second) {
+			if (scratch.size() < count) {
+				scratch.resize(count);
+			}
+
+			// The master pushes whole blocks, so that the raw queue size is a staircase. Whenever the follower's period
+			// beats against the master's, sampling it would slowly wander up and down, which the estimator would
+			// mistake for drift. Adding what the master played since its last push gives a continuous level instead.
+			const auto pushed = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(last_push.load(std::memory_order_acquire)));
+			const auto level = queue.size();
+			const auto since_push = std::chrono::duration<double>(std::chrono::steady_clock::now() - pushed).count();
+			const auto continuous_level = double(level) + std::clamp(since_push, 0.0, 1.0) * double(samples_per_second);
+
+			// Only start once the queue stays at its target level after this block, too.
+			if (!running && level >= target + count) {
+				running = true;
+				estimator.restart(continuous_level);
+			}
+
+			size_t missing = 0;
+			double ratio = 1.0;
+
+			if (running) {
+				ratio = estimator.update(continuous_level, count, samples_per_second);
+				missing = resampler.process(queue, scratch.data(), count, ratio);
+			} else {
+				std::fill(scratch.begin(), scratch.begin() + count, mix_frame<ChannelCount>{});
+			}
+
+			// Start over with a fresh prefill after running dry, instead of stuttering along at the edge.
+			if (missing) {
+				running = false;
+			}
+
+			detail::convert_frames<ValueType, ChannelCount>(scratch.data(), out, count);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.drift_ppm = estimator.drift_ppm();
+			stats.ratio = ratio;
+			stats.level = estimator.level();
+			stats.underruns += missing ? 1 : 0;
+		}
+
+		spsc_queue<mix_frame<ChannelCount>> queue;
+		std::atomic<size_t> overruns = 0;
+		// The steady_clock time of the master's last push, in ticks since its epoch.
+		std::atomic<std::chrono::steady_clock::rep> last_push = 0;
+
+		mutable std::mutex mutex;
+		statistics stats;
+
+	private:
+		drift_estimator estimator;
+		adaptive_resampler<ChannelCount> resampler;
+		std::vector<mix_frame<ChannelCount>> scratch;
+		size_t target;
+		bool running = false;
+	};
+
+	// The buffers must be destroyed before the followers they feed into.
+	std::vector<std::shared_ptr<follower>> m_followers;
+	std::vector<double_buffer<ValueType, ChannelCount>> m_buffers;
+};
+
+} // namespace direct_sound
@@ -0,0 +1,227 @@
+#pragma once
+
+namespace direct_sound {
+
+enum class ramp_shape {
+	// Moves towards the target in equal steps, reaching it after the ramp time.
+	linear,
+	// Moves a constant fraction of the remaining distance each sample (a one-pole low-pass),
+	// getting within 1% of the target after the ramp time.
+	exponential,
+};
+
+// Interpolates a value towards its target sample by sample, which avoids the
+// "zipper noise" caused by applying parameter changes in steps. Only used by the render thread.
+class parameter_ramp {
+public:
+	explicit parameter_ramp(float value = 0.0f, std::chrono::duration<double> ramp_time = std::chrono::milliseconds(20), ramp_shape shape = ramp_shape::linear) : m_ramp_time(ramp_time.count()), m_shape(shape), m_current(value), m_target(value) {
+		if (m_ramp_time < 0.0) {
+			throw std::invalid_argument("ramp_time must not be negative");
+		}
+	}
+
+	void prepare(size_t samples_per_second) noexcept {
+		m_ramp_samples = std::max<uint32_t>(1, uint32_t(m_ramp_time * double(samples_per_second)));
+		m_coefficient = 1.0f - float(std::pow(0.01, 1.0 / double(m_ramp_samples)));
+		m_samples_per_second = samples_per_second;
+	}
+
+	size_t samples_per_second() const noexcept {
+		return m_samples_per_second;
+	}
+
+	void set_target(float target) noexcept {
+		if (target == m_target) {
+			return;
+		}
+
+		m_target = target;
+		m_remaining = m_ramp_samples;
+		m_step = (m_target - m_current) / float(m_ramp_samples);
+	}
+
+	// Jumps to the target right away.
+	void snap() noexcept {
+		m_current = m_target;
+		m_remaining = 0;
+	}
+
+	bool ramping() const noexcept {
+		return m_remaining != 0;
+	}
+
+	float value() const noexcept {
+		return m_current;
+	}
+
+	float next() noexcept {
+		if (m_remaining == 0) {
+			return m_current;
+		}
+
+		if (m_shape == ramp_shape::linear) {
+			m_current += m_step;
+		} else {
+			m_current += (m_target - m_current) * m_coefficient;
+		}
+
+		// The exponential ramp never quite arrives, so it's cut off once the linear one would have been done.
+		if (--m_remaining == 0 || (m_shape == ramp_shape::exponential && std::abs(m_target - m_current) < 1e-5f)) {
+			m_current = m_target;
+			m_remaining = 0;
+		}
+
+		return m_current;
+	}
+
+private:
+	double m_ramp_time;
+	ramp_shape m_shape;
+	float m_current;
+	float m_target;
+	float m_step = 0.0f;
+	float m_coefficient = 1.0f;
+	uint32_t m_ramp_samples = 1;
+	uint32_t m_remaining = 0;
+	size_t m_samples_per_second = 0;
+};
+
+// Volume and pan with the same value ranges and laws as IDirectSoundBuffer8::SetVolume() and SetPan(),
+// but applied to the samples while rendering instead of by the sound device.
+// Changing them is a single atomic store, no matter how many voices or buffers they apply to.
+class gain_pan {
+public:
+	explicit gain_pan() noexcept {
+	}
+
+	gain_pan(const gain_pan&) = delete;
+	gain_pan& operator=(const gain_pan&) = delete;
+
+	void set_volume(int volume) {
+		if (volume < volume_min || volume > volume_max) {
+			throw std::invalid_argument(string_format("invalid argument for volume: %i", volume));
+		}
+		m_volume.store(volume, std::memory_order_relaxed);
+	}
+
+	void set_pan(int pan) {
+		if (pan < pan_left || pan > pan_right) {
+			throw std::invalid_argument(string_format("invalid argument for pan: %i", pan));
+		}
+		m_pan.store(pan, std::memory_order_relaxed);
+	}
+
+	int volume() const noexcept {
+		return m_volume.load(std::memory_order_relaxed);
+	}
+
+	int pan() const noexcept {
+		return m_pan.load(std::memory_order_relaxed);
+	}
+
+	void reset() noexcept {
+		m_volume.store(volume_max, std::memory_order_relaxed);
+		m_pan.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<int> m_volume = volume_max;
+	std::atomic<int> m_pan = 0;
+};
+
+// Applies a gain_pan to samples, picking up changes at the start of each block and then ramping
+// towards them sample by sample. Each render thread applying the same gain_pan needs its own smoother.
+class gain_pan_smoother {
+public:
+	explicit gain_pan_smoother(std::chrono::duration<double> ramp_time = std::chrono::milliseconds(20), ramp_shape shape = ramp_shape::exponential) : m_gain(1.0f, ramp_time, shape), m_left(1.0f, ramp_time, shape), m_right(1.0f, ramp_time, shape) {
+	}
+
+	// Jumps to the current settings of `controls` without ramping, e.g. when a voice is started.
+	void snap(const gain_pan& controls) noexcept {
+		set_targets(controls);
+
+		for (auto ramp : {&m_gain, &m_left, &m_right}) {
+			ramp->snap();
+		}
+	}
+
+	// Scales `count` frames in place. Pan only applies to stereo frames.
+	template<typename ValueType, size_t ChannelCount>
+	void apply(const gain_pan& controls, std::array<ValueType, ChannelCount>* frames, size_t count, size_t samples_per_second) noexcept {
+		const bool first_block = m_gain.samples_per_second() == 0;
+
+		for (auto ramp : {&m_gain, &m_left, &m_right}) {
+			if (ramp->samples_per_second() != samples_per_second) {
+				ramp->prepare(samples_per_second);
+			}
+		}
+
+		// The first block starts right at the current settings instead of ramping from unity towards them.
+		if (first_block) {
+			snap(controls);
+		} else {
+			set_targets(controls);
+		}
+
+		if constexpr (ChannelCount == 2) {
+			// Fast path for the common case of unchanged unity settings.
+			if (!m_gain.ramping() && !m_left.ramping() && !m_right.ramping() && m_gain.value() == 1.0f && m_left.value() == 1.0f && m_right.value() == 1.0f) {
+				return;
+			}
+
+			for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+				const auto gain = m_gain.next();
+				(*frame)[0] = ValueType(float((*frame)[0]) * gain * m_left.next());
+				(*frame)[1] = ValueType(float((*frame)[1]) * gain * m_right.next());
+			}
+		} else {
+			if (!m_gain.ramping() && m_gain.value() == 1.0f) {
+				return;
+			}
+
+			for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+				const auto gain = m_gain.next();
+
+				for (auto& value : *frame) {
+					value = ValueType(float(value) * gain);
+				}
+			}
+		}
+	}
+
+private:
+	void set_targets(const gain_pan& controls) noexcept {
+		const auto pan = controls.pan();
+		m_gain.set_target(attenuation_to_gain(controls.volume()));
+		m_left.set_target(attenuation_to_gain(std::min(0, -pan)));
+		m_right.set_target(attenuation_to_gain(std::min(0, pan)));
+	}
+
+	parameter_ramp m_gain;
+	parameter_ramp m_left;
+	parameter_ramp m_right;
+};
+
+// Wraps `provider` and applies the volume and pan of `controls` to its output.
+// Multiple buffers can share the same controls, which then act as a master volume and pan.
+template<typename ValueType, size_t ChannelCount>
+auto create_gain_pan_provider(typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, std::shared_ptr<const gain_pan> controls) {
+	if (!provider) {
+		throw std::invalid_argument("provider must not be null");
+	}
+	if (!controls) {
+		throw std::invalid_argument("controls must not be null");
+	}
+
+	gain_pan_smoother smoother;
+
+	return [provider, controls, smoother](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		provider(spans, info);
+
+		for (const auto span : spans) {
+			smoother.apply(*controls, span.data(), size_t(span.size()), info.samples_per_second);
+		}
+	};
+}
+
+} // namespace direct_sound
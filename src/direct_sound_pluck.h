@@ -0,0 +1,459 @@
+#pragma once
+
+namespace direct_sound {
+
+// The sound of a plucked string, see pluck_voice.
+class pluck_parameters {
+public:
+	// Seconds until a note decayed by 60 dB.
+	double decay = 3.0;
+	// Lowpass filtering in the feedback loop, from 0 (none, a metallic sound) to 1 (the classic two-point average, the dullest).
+	double damping = 0.5;
+	// Where the string is picked, relative to its length and measured from the bridge.
+	// A string picked at 1/n of its length lacks every n-th harmonic.
+	double pick_position = 0.15;
+	// Level of a resonance modelling the guitar body, 0 disables it.
+	double body = 0.3;
+	double body_frequency = 110.0;
+	// Peak level of the noise burst exciting the string.
+	double velocity = 1.0;
+	// Seeds the noise burst. The same seed always yields the same sound.
+	uint32_t seed = 1;
+};
+
+namespace detail {
+
+// Everything pluck_voice and pluck_bank derive from the frequency and the pluck_parameters.
+//
+// The period of the string (samples_per_second / frequency) is the sum of the delay line's length,
+// the `stretch` samples the loop's lowpass delays by and the fractional delay of a first order allpass.
+class pluck_coefficients {
+public:
+	pluck_coefficients() = default;
+
+	explicit pluck_coefficients(double frequency, size_t samples_per_second, const pluck_parameters& p) {
+		if (!(frequency >= 20.0) || samples_per_second == 0 || frequency > double(samples_per_second) / 4.0) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+		if (!(p.decay > 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for decay: %f", p.decay));
+		}
+		if (!(p.damping >= 0.0 && p.damping <= 1.0)) {
+			throw std::invalid_argument(string_format("invalid argument for damping: %f", p.damping));
+		}
+		if (!(p.pick_position > 0.0 && p.pick_position <= 0.5)) {
+			throw std::invalid_argument(string_format("invalid argument for pick_position: %f", p.pick_position));
+		}
+		if (!(p.body >= 0.0) || !(p.body_frequency > 0.0) || p.body_frequency >= double(samples_per_second) / 2.0) {
+			throw std::invalid_argument(string_format("invalid argument for body: %f at %f Hz", p.body, p.body_frequency));
+		}
+		if (!(p.velocity >= 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for velocity: %f", p.velocity));
+		}
+
+		const auto period = double(samples_per_second) / frequency;
+		const auto s = 0.5 * p.damping;
+
+		// Allpass delays of about 0.1 to 1.1 samples keep its coefficient away from -1, where it'd barely be stable.
+		auto delay = period - s;
+		length = size_t(delay);
+		auto fraction = delay - double(length);
+		if (fraction < 0.1) {
+			--length;
+			fraction += 1.0;
+		}
+
+		stretch = float(s);
+		allpass = float((1.0 - fraction) / (1.0 + fraction));
+		// One pass through the loop takes a period, over which the string decays by that much.
+		gain = float(std::pow(10.0, -3.0 * period / (p.decay * double(samples_per_second))));
+
+		// A two-pole bandpass with unity gain at its center and a bandwidth of 50 Hz.
+		const auto r = std::exp(-M_PI * 50.0 / double(samples_per_second));
+		body_b0 = float((1.0 - r * r) / 2.0);
+		body_a1 = float(2.0 * r * std::cos(2.0 * M_PI * p.body_frequency / double(samples_per_second)));
+		body_a2 = float(r * r);
+		body_mix = float(p.body);
+	}
+
+	size_t length = 0;
+	float stretch = 0.0f;
+	float allpass = 0.0f;
+	float gain = 0.0f;
+	float body_b0 = 0.0f;
+	float body_a1 = 0.0f;
+	float body_a2 = 0.0f;
+	float body_mix = 0.0f;
+};
+
+// Fills the delay line of a string with a noise burst, as if it had just been picked.
+inline void pluck_excite(float* line, size_t length, const pluck_parameters& p) {
+	// xorshift32, which must not be seeded with 0.
+	auto state = p.seed ? p.seed : 0x9e3779b9u;
+	std::vector<float> noise(length);
+
+	for (auto& value : noise) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		value = float(state) / float(std::numeric_limits<uint32_t>::max()) * 2.0f - 1.0f;
+	}
+
+	// Picking the string at a fraction of its length cancels the harmonics having a node there, which is a comb filter.
+	const auto offset = std::max<size_t>(1, size_t(p.pick_position * double(length) + 0.5));
+	float mean = 0.0f;
+
+	for (size_t i = 0; i < length; ++i) {
+		line[i] = noise[i] - noise[(i + length - offset % length) % length];
+		mean += line[i];
+	}
+
+	// A DC offset would never decay, as the loop's lowpass passes it unattenuated.
+	mean /= float(length);
+	float peak = 0.0f;
+
+	for (size_t i = 0; i < length; ++i) {
+		line[i] -= mean;
+		peak = std::max(peak, std::abs(line[i]));
+	}
+
+	const auto scale = peak > 0.0f ? float(p.velocity) / peak : 0.0f;
+	for (size_t i = 0; i < length; ++i) {
+		line[i] *= scale;
+	}
+}
+
+// Voices are released once a whole block stays below this level, which is -80 dBFS.
+constexpr float pluck_silence = 1e-4f;
+
+} // namespace detail
+
+// A plucked string, synthesized with the Karplus-Strong algorithm.
+//
+// A delay line, one period long and filled with a noise burst, is fed back through a lowpass:
+// Its output is periodic at the string's frequency and loses its higher harmonics quicker than
+// the lower ones, just like a real string. An allpass tunes the loop to fractional periods and
+// a resonator adds the coloration of the guitar body.
+//
+// Unlike a sampler_voice playing a recording, the only state is the delay line of one period,
+// which is a few hundred bytes for the notes of a guitar.
+template<size_t ChannelCount>
+class pluck_voice {
+public:
+	pluck_voice() = default;
+
+	explicit pluck_voice(double frequency, size_t samples_per_second, const pluck_parameters& parameters = {}) : m_coefficients(frequency, samples_per_second, parameters), m_line(m_coefficients.length) {
+		detail::pluck_excite(m_line.data(), m_line.size(), parameters);
+	}
+
+	bool finished() const {
+		return m_finished;
+	}
+
+	// The memory used by the voice, including its delay line.
+	size_t size_bytes() const {
+		return sizeof(*this) + m_line.capacity() * sizeof(float);
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		if (m_finished) {
+			std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+			return;
+		}
+
+		const auto& c = m_coefficients;
+		const auto line = m_line.data();
+		const auto length = m_line.size();
+		float peak = 0.0f;
+
+		for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+			const auto x = line[m_position];
+
+			const auto lowpass = x + (m_x1 - x) * c.stretch;
+			m_x1 = x;
+
+			const auto allpass = c.allpass * (lowpass - m_allpass_y1) + m_allpass_x1;
+			m_allpass_x1 = lowpass;
+			m_allpass_y1 = allpass;
+
+			line[m_position] = allpass * c.gain;
+			if (++m_position == length) {
+				m_position = 0;
+			}
+
+			const auto body = c.body_b0 * (x - m_body_x2) + c.body_a1 * m_body_y1 - c.body_a2 * m_body_y2;
+			m_body_x2 = m_body_x1;
+			m_body_x1 = x;
+			m_body_y2 = m_body_y1;
+			m_body_y1 = body;
+
+			const auto value = x + body * c.body_mix;
+			frame->fill(value);
+			peak = std::max(peak, std::abs(value));
+		}
+
+		m_rendered += count;
+		m_finished = m_rendered > length && peak < detail::pluck_silence;
+	}
+
+private:
+	detail::pluck_coefficients m_coefficients;
+	std::vector<float> m_line;
+	size_t m_position = 0;
+	size_t m_rendered = 0;
+	bool m_finished = false;
+
+	float m_x1 = 0.0f;
+	float m_allpass_x1 = 0.0f;
+	float m_allpass_y1 = 0.0f;
+	float m_body_x1 = 0.0f;
+	float m_body_x2 = 0.0f;
+	float m_body_y1 = 0.0f;
+	float m_body_y2 = 0.0f;
+};
+
+// Several plucked strings rendered together, e.g. the six strings of a strummed chord.
+//
+// Each sample of 4 strings at a time is computed with SSE2: The strings' coefficients and filter states are
+// stored in groups of 4 (structure of arrays), and all the arithmetic of pluck_voice is done on them at once.
+// Only the delay line reads and writes are scalar, as their positions differ. All delay lines share
+// a single allocation. The strings are mixed into mono and copied into all channels.
+template<size_t ChannelCount>
+class pluck_bank {
+public:
+	pluck_bank() = default;
+
+	// Plucks one string per frequency. Each of them gets its own seed, derived from parameters.seed.
+	explicit pluck_bank(const std::vector<double>& frequencies, size_t samples_per_second, const pluck_parameters& parameters = {}) {
+		if (frequencies.empty()) {
+			throw std::invalid_argument("frequencies must not be empty");
+		}
+
+		const auto strings = (frequencies.size() + 3) / 4 * 4;
+		std::vector<detail::pluck_coefficients> coefficients;
+		size_t total = 0;
+
+		for (const auto frequency : frequencies) {
+			coefficients.emplace_back(frequency, samples_per_second, parameters);
+			total += coefficients.back().length;
+		}
+
+		// Unused lanes of the last group get a silent line of a single sample and no feedback.
+		m_lines.resize(total + (strings - frequencies.size()));
+		m_groups.resize(strings / 4);
+
+		size_t offset = 0;
+
+		for (size_t i = 0; i < strings; ++i) {
+			auto& g = m_groups[i / 4];
+			const auto lane = i % 4;
+
+			if (i < frequencies.size()) {
+				const auto& c = coefficients[i];
+
+				auto p = parameters;
+				p.seed = parameters.seed + uint32_t(i) * 0x9e3779b9u;
+				detail::pluck_excite(m_lines.data() + offset, c.length, p);
+
+				g.length[lane] = uint32_t(c.length);
+				g.stretch[lane] = c.stretch;
+				g.allpass[lane] = c.allpass;
+				g.gain[lane] = c.gain;
+				g.body_b0[lane] = c.body_b0;
+				g.body_a1[lane] = c.body_a1;
+				g.body_a2[lane] = c.body_a2;
+				g.body_mix[lane] = c.body_mix;
+			} else {
+				g.length[lane] = 1;
+			}
+
+			g.offset[lane] = uint32_t(offset);
+			offset += g.length[lane];
+		}
+
+		m_longest = std::max_element(coefficients.begin(), coefficients.end(), [](const auto& a, const auto& b) { return a.length < b.length; })->length;
+	}
+
+	bool finished() const {
+		return m_finished;
+	}
+
+	// The memory used by the bank, including its delay lines.
+	size_t size_bytes() const {
+		return sizeof(*this) + m_lines.capacity() * sizeof(float) + m_groups.capacity() * sizeof(group);
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		if (m_finished) {
+			std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+			return;
+		}
+
+		// The strings are mixed in chunks on the stack, so that blocks of any size render without allocating.
+		constexpr size_t chunk_size = 256;
+		float mono[chunk_size];
+		float peak = 0.0f;
+
+		for (size_t done = 0; done < count;) {
+			const auto n = std::min(count - done, chunk_size);
+			std::fill(mono, mono + n, 0.0f);
+
+			for (auto& g : m_groups) {
+				peak = std::max(peak, render_group(g, mono, n));
+			}
+
+			for (size_t i = 0; i < n; ++i) {
+				frames[done + i].fill(mono[i]);
+			}
+
+			done += n;
+		}
+
+		m_rendered += count;
+		m_finished = m_rendered > m_longest && peak < detail::pluck_silence;
+	}
+
+private:
+	class group {
+	public:
+		std::array<uint32_t, 4> offset = {};
+		std::array<uint32_t, 4> length = {};
+		std::array<uint32_t, 4> position = {};
+
+		std::array<float, 4> stretch = {};
+		std::array<float, 4> allpass = {};
+		std::array<float, 4> gain = {};
+		std::array<float, 4> body_b0 = {};
+		std::array<float, 4> body_a1 = {};
+		std::array<float, 4> body_a2 = {};
+		std::array<float, 4> body_mix = {};
+
+		std::array<float, 4> x1 = {};
+		std::array<float, 4> allpass_x1 = {};
+		std::array<float, 4> allpass_y1 = {};
+		std::array<float, 4> body_x1 = {};
+		std::array<float, 4> body_x2 = {};
+		std::array<float, 4> body_y1 = {};
+		std::array<float, 4> body_y2 = {};
+	};
+
+	// Adds the 4 strings of `g` to `mono` and returns the peak level of any of them.
+	float render_group(group& g, float* mono, size_t count) noexcept {
+		std::array<float*, 4> lines;
+		for (size_t lane = 0; lane < 4; ++lane) {
+			lines[lane] = m_lines.data() + g.offset[lane];
+		}
+
+		auto position = g.position;
+		float peak = 0.0f;
+
+#if DIRECT_SOUND_SSE2
+		const auto stretch = _mm_loadu_ps(g.stretch.data());
+		const auto allpass_c = _mm_loadu_ps(g.allpass.data());
+		const auto gain = _mm_loadu_ps(g.gain.data());
+		const auto b0 = _mm_loadu_ps(g.body_b0.data());
+		const auto a1 = _mm_loadu_ps(g.body_a1.data());
+		const auto a2 = _mm_loadu_ps(g.body_a2.data());
+		const auto mix = _mm_loadu_ps(g.body_mix.data());
+		const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		auto x1 = _mm_loadu_ps(g.x1.data());
+		auto allpass_x1 = _mm_loadu_ps(g.allpass_x1.data());
+		auto allpass_y1 = _mm_loadu_ps(g.allpass_y1.data());
+		auto body_x1 = _mm_loadu_ps(g.body_x1.data());
+		auto body_x2 = _mm_loadu_ps(g.body_x2.data());
+		auto body_y1 = _mm_loadu_ps(g.body_y1.data());
+		auto body_y2 = _mm_loadu_ps(g.body_y2.data());
+		auto peaks = _mm_setzero_ps();
+
+		alignas(16) float feedback[4];
+		alignas(16) float values[4];
+
+		for (size_t i = 0; i < count; ++i) {
+			const auto x = _mm_set_ps(lines[3][position[3]], lines[2][position[2]], lines[1][position[1]], lines[0][position[0]]);
+
+			const auto lowpass = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(x1, x), stretch));
+			x1 = x;
+
+			const auto allpass = _mm_add_ps(_mm_mul_ps(allpass_c, _mm_sub_ps(lowpass, allpass_y1)), allpass_x1);
+			allpass_x1 = lowpass;
+			allpass_y1 = allpass;
+
+			_mm_store_ps(feedback, _mm_mul_ps(allpass, gain));
+
+			const auto body = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_sub_ps(x, body_x2)), _mm_mul_ps(a1, body_y1)), _mm_mul_ps(a2, body_y2));
+			body_x2 = body_x1;
+			body_x1 = x;
+			body_y2 = body_y1;
+			body_y1 = body;
+
+			const auto value = _mm_add_ps(x, _mm_mul_ps(body, mix));
+			peaks = _mm_max_ps(peaks, _mm_and_ps(value, abs_mask));
+			_mm_store_ps(values, value);
+
+			for (size_t lane = 0; lane < 4; ++lane) {
+				lines[lane][position[lane]] = feedback[lane];
+				if (++position[lane] == g.length[lane]) {
+					position[lane] = 0;
+				}
+			}
+
+			mono[i] += (values[0] + values[1]) + (values[2] + values[3]);
+		}
+
+		_mm_storeu_ps(g.x1.data(), x1);
+		_mm_storeu_ps(g.allpass_x1.data(), allpass_x1);
+		_mm_storeu_ps(g.allpass_y1.data(), allpass_y1);
+		_mm_storeu_ps(g.body_x1.data(), body_x1);
+		_mm_storeu_ps(g.body_x2.data(), body_x2);
+		_mm_storeu_ps(g.body_y1.data(), body_y1);
+		_mm_storeu_ps(g.body_y2.data(), body_y2);
+
+		alignas(16) float lane_peaks[4];
+		_mm_store_ps(lane_peaks, peaks);
+		peak = std::max(std::max(lane_peaks[0], lane_peaks[1]), std::max(lane_peaks[2], lane_peaks[3]));
+#else
+		for (size_t i = 0; i < count; ++i) {
+			float values[4];
+
+			for (size_t lane = 0; lane < 4; ++lane) {
+				const auto x = lines[lane][position[lane]];
+
+				const auto lowpass = x + (g.x1[lane] - x) * g.stretch[lane];
+				g.x1[lane] = x;
+
+				const auto allpass = g.allpass[lane] * (lowpass - g.allpass_y1[lane]) + g.allpass_x1[lane];
+				g.allpass_x1[lane] = lowpass;
+				g.allpass_y1[lane] = allpass;
+
+				lines[lane][position[lane]] = allpass * g.gain[lane];
+				if (++position[lane] == g.length[lane]) {
+					position[lane] = 0;
+				}
+
+				const auto body = g.body_b0[lane] * (x - g.body_x2[lane]) + g.body_a1[lane] * g.body_y1[lane] - g.body_a2[lane] * g.body_y2[lane];
+				g.body_x2[lane] = g.body_x1[lane];
+				g.body_x1[lane] = x;
+				g.body_y2[lane] = g.body_y1[lane];
+				g.body_y1[lane] = body;
+
+				values[lane] = x + body * g.body_mix[lane];
+				peak = std::max(peak, std::abs(values[lane]));
+			}
+
+			mono[i] += (values[0] + values[1]) + (values[2] + values[3]);
+		}
+#endif
+
+		g.position = position;
+		return peak;
+	}
+
+	std::vector<float> m_lines;
+	std::vector<group> m_groups;
+	size_t m_longest = 0;
+	size_t m_rendered = 0;
+	bool m_finished = false;
+};
+
+} // namespace direct_sound
@@ -0,0 +1,216 @@
+#pragma once
+
+namespace direct_sound {
+
+// A backend recycling the buffers of another one.
+//
+// Creating a buffer is expensive with DirectSound: Besides CreateSoundBuffer() itself, a double_buffer
+// needs an event, a registered wait and its notification positions. Buffers created through a pool
+// aren't destroyed when released, but reset (stopped, rewound, silenced and back at full volume and
+// centered pan) and kept for the next request of the same format and size, along with their notifications.
+// Acquiring a buffer that way only takes a mutex, which keeps the latency of starting a sound near-constant.
+//
+// The pool must not outlive the backend it wraps. Buffers may outlive the pool, in which case they're simply destroyed.
+class buffer_pool : public backend {
+public:
+	class statistics {
+	public:
+		size_t created = 0;
+		size_t reused = 0;
+		size_t idle = 0;
+	};
+
+	// Up to `max_idle` released buffers are kept for each format and size.
+	explicit buffer_pool(const backend& backend, size_t max_idle = 8) : m_shared(std::make_shared<shared>(backend, max_idle)) {
+		if (max_idle == 0) {
+			throw std::invalid_argument("max_idle must not be 0");
+		}
+	}
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+
+	std::unique_ptr<backend_buffer> create_buffer(const wave_format& format, size_t bytes) const override {
+		auto buffer = m_shared->acquire(format, bytes);
+		return std::make_unique<pooled_buffer>(m_shared, format, std::move(buffer));
+	}
+
+	// Creates buffers up front, so that even the first `count` requests for them are served from the pool.
+	void reserve(const wave_format& format, size_t bytes, size_t count) {
+		std::vector<std::unique_ptr<backend_buffer>> buffers;
+
+		for (size_t i = 0; i < count; ++i) {
+			buffers.emplace_back(create_buffer(format, bytes));
+		}
+	}
+
+	// Destroys all idle buffers.
+	void clear() {
+		decltype(m_shared->idle) idle;
+
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+		idle.swap(m_shared->idle);
+	}
+
+	statistics stats() const {
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+
+		auto result = m_shared->stats;
+		for (const auto& entry : m_shared->idle) {
+			result.idle += entry.buffers.size();
+		}
+		return result;
+	}
+
+private:
+	class shared {
+	public:
+		explicit shared(const backend& source, size_t max_idle) : source(source), max_idle(max_idle) {
+		}
+
+		// There are only ever a few different formats and sizes, which makes a linear search the fastest lookup.
+		std::vector<std::unique_ptr<backend_buffer>>& idle_buffers(const wave_format& format, size_t bytes) {
+			const auto it = std::find_if(idle.begin(), idle.end(), [&](const idle_entry& entry) {
+				return entry.format == format && entry.bytes == bytes;
+			});
+
+			if (it != idle.end()) {
+				return it->buffers;
+			}
+
+			idle.push_back({format, bytes, {}});
+			return idle.back().buffers;
+		}
+
+		std::unique_ptr<backend_buffer> acquire(const wave_format& format, size_t bytes) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				auto& buffers = idle_buffers(format, bytes);
+				if (!buffers.empty()) {
+					auto buffer = std::move(buffers.back());
+					buffers.pop_back();
+					++stats.reused;
+					return buffer;
+				}
+			}
+
+			auto buffer = source.create_buffer(format, bytes);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			++stats.created;
+			return buffer;
+		}
+
+		void release(const wave_format& format, std::unique_ptr<backend_buffer> buffer) {
+			const auto bytes = buffer->size_bytes();
+
+			// A buffer that can't be reset properly is destroyed instead.
+			try {
+				buffer->set_notifications({}, nullptr);
+				buffer->stop();
+				buffer->set_position(0);
+				buffer->set_volume(volume_max);
+				buffer->set_pan(0);
+
+				// Unsigned 8-bit PCM is centered at 128, all other formats at 0.
+				const auto silence = format.bits_per_sample == 8 ? byte(0x80) : byte(0);
+				const auto regions = buffer->lock(0, bytes);
+				for (const auto region : regions) {
+					std::fill(region.begin(), region.end(), silence);
+				}
+				buffer->unlock(regions);
+			} catch (...) {
+				return;
+			}
+
+			std::unique_ptr<backend_buffer> discarded;
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto& buffers = idle_buffers(format, bytes);
+			if (buffers.size() < max_idle) {
+				buffers.emplace_back(std::move(buffer));
+			} else {
+				// Destroyed after the lock was released, as that may wait for running callbacks.
+				discarded = std::move(buffer);
+			}
+		}
+
+		class idle_entry {
+		public:
+			wave_format format;
+			size_t bytes;
+			std::vector<std::unique_ptr<backend_buffer>> buffers;
+		};
+
+		const backend& source;
+		const size_t max_idle;
+
+		// Guards everything below.
+		std::mutex mutex;
+		std::vector<idle_entry> idle;
+		statistics stats;
+	};
+
+	// Forwards everything to the actual buffer and hands it back to the pool when destroyed.
+	class pooled_buffer : public backend_buffer {
+	public:
+		explicit pooled_buffer(const std::shared_ptr<shared>& pool, const wave_format& format, std::unique_ptr<backend_buffer> buffer) noexcept : m_pool(pool), m_format(format), m_buffer(std::move(buffer)) {
+		}
+
+		~pooled_buffer() {
+			if (const auto pool = m_pool.lock()) {
+				pool->release(m_format, std::move(m_buffer));
+			}
+		}
+
+		size_t size_bytes() const override {
+			return m_buffer->size_bytes();
+		}
+
+		RegionPairType lock(size_t offset, size_t length) override {
+			return m_buffer->lock(offset, length);
+		}
+
+		void unlock(const RegionPairType& regions) override {
+			m_buffer->unlock(regions);
+		}
+
+		void play(bool looping) override {
+			m_buffer->play(looping);
+		}
+
+		void stop() override {
+			m_buffer->stop();
+		}
+
+		void set_volume(int volume) override {
+			m_buffer->set_volume(volume);
+		}
+
+		void set_pan(int pan) override {
+			m_buffer->set_pan(pan);
+		}
+
+		std::pair<size_t, size_t> position() const override {
+			return m_buffer->position();
+		}
+
+		void set_position(size_t offset) override {
+			m_buffer->set_position(offset);
+		}
+
+		void set_notifications(std::vector<size_t> offsets, std::function<void()> callback) override {
+			m_buffer->set_notifications(std::move(offsets), std::move(callback));
+		}
+
+	private:
+		std::weak_ptr<shared> m_pool;
+		wave_format m_format;
+		std::unique_ptr<backend_buffer> m_buffer;
+	};
+
+	std::shared_ptr<shared> m_shared;
+};
+
+} // namespace direct_sound
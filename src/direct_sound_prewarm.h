@@ -0,0 +1,176 @@
+#pragma once
+
+namespace direct_sound {
+
+// Runs independent startup tasks, like loading and decoding samples or rendering wavetables, in parallel.
+//
+// Tasks are added up front and then distributed over a number of worker threads by start().
+// Their progress can be polled from any thread, e.g. by a UI timer. Everything depending on the
+// results of the tasks must call wait() first, which returns right away once they're done.
+class prewarm {
+public:
+	class task_timing {
+	public:
+		std::string name;
+		std::chrono::duration<double> duration{};
+	};
+
+	explicit prewarm() noexcept {
+	}
+
+	prewarm(const prewarm&) = delete;
+	prewarm& operator=(const prewarm&) = delete;
+
+	~prewarm() {
+		join();
+	}
+
+	// Must be called before start().
+	void add(std::string name, std::function<void()> task) {
+		if (m_started) {
+			throw std::logic_error("tasks must be added before start()");
+		}
+		if (!task) {
+			throw std::invalid_argument("task must not be null");
+		}
+
+		m_tasks.push_back({std::move(name), std::move(task)});
+		m_timings.push_back({m_tasks.back().name, {}});
+	}
+
+	// Starts running the tasks on `threads` worker threads, by default one per core.
+	void start(size_t threads = 0) {
+		if (m_started) {
+			throw std::logic_error("start() must only be called once");
+		}
+
+		m_started = true;
+		m_start = std::chrono::steady_clock::now();
+
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threads = std::min(threads, m_tasks.size());
+
+		if (m_tasks.empty()) {
+			m_ready_time = m_start;
+		}
+
+		for (size_t i = 0; i < threads; ++i) {
+			m_threads.emplace_back([this]() {
+				run();
+			});
+		}
+	}
+
+	bool started() const noexcept {
+		return m_started;
+	}
+
+	// Whether all tasks finished. Returns false before start().
+	bool ready() const noexcept {
+		return m_started && m_done.load(std::memory_order_acquire) == m_tasks.size();
+	}
+
+	size_t done() const noexcept {
+		return m_done.load(std::memory_order_acquire);
+	}
+
+	size_t total() const noexcept {
+		return m_tasks.size();
+	}
+
+	// Blocks until all tasks finished and rethrows the first exception any of them threw.
+	// The exception is only thrown once. Later calls return right away, so that callers
+	// can do the work of the failed task themselves. Returns right away if start() wasn't called.
+	void wait() {
+		if (!m_started) {
+			return;
+		}
+
+		join();
+
+		std::exception_ptr error;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			error = std::exchange(m_error, nullptr);
+		}
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	// The time from start() until the last task finished. Only valid once ready().
+	std::chrono::duration<double> time_to_ready() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_ready_time - m_start;
+	}
+
+	// The time each task took, in the order they were added. Only valid once ready().
+	std::vector<task_timing> timings() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_timings;
+	}
+
+private:
+	class task {
+	public:
+		std::string name;
+		std::function<void()> function;
+	};
+
+	void run() {
+		while (true) {
+			const auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+			if (index >= m_tasks.size()) {
+				return;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			std::exception_ptr error;
+
+			try {
+				m_tasks[index].function();
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			const auto end = std::chrono::steady_clock::now();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_timings[index].duration = end - start;
+
+			if (error && !m_error) {
+				m_error = error;
+			}
+
+			if (m_done.fetch_add(1, std::memory_order_acq_rel) + 1 == m_tasks.size()) {
+				m_ready_time = end;
+			}
+		}
+	}
+
+	void join() {
+		for (auto& thread : m_threads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+	}
+
+	std::vector<task> m_tasks;
+	bool m_started = false;
+	std::chrono::steady_clock::time_point m_start;
+	std::vector<std::thread> m_threads;
+	std::atomic<size_t> m_next = 0;
+	std::atomic<size_t> m_done = 0;
+
+	// Guards everything below.
+	mutable std::mutex m_mutex;
+	std::vector<task_timing> m_timings;
+	std::chrono::steady_clock::time_point m_ready_time;
+	std::exception_ptr m_error;
+};
+
+} // namespace direct_sound
@@ -6,6 +6,24 @@ namespace detail {
 
 template<typename ValueType, size_t ChannelCount>
 uint32_t fill_with_sine_wave(typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info, size_t frequency, uint32_t sample_number) {
+	if constexpr (fixed_point_traits<ValueType>::enabled) {
+		// Integer ValueTypes are synthesized in fixed point. The phase of the first sample is computed exactly,
+		// so that consecutive fills line up, and accumulated from there on.
+		fixed_oscillator<ValueType> oscillator;
+		oscillator.set_frequency(double(frequency), info.samples_per_second);
+		oscillator.set_phase(uint32_t(((uint64_t(sample_number) * frequency % info.samples_per_second) << 32) / info.samples_per_second));
+
+		for (const auto span : spans) {
+			for (auto sample = span.data(), end = sample + span.size(); sample != end; ++sample) {
+				sample->fill(oscillator.next());
+			}
+
+			sample_number += uint32_t(span.size());
+		}
+
+		return sample_number % info.samples_per_second;
+	}
+
 	constexpr double amplitude = std::numeric_limits<ValueType>::max();
 	const auto radiant_periods_per_sample = 2.0 * M_PI * double(frequency) / double(info.samples_per_second);
 
@@ -29,10 +47,12 @@ uint32_t fill_with_sine_wave(typename buffer_trait<ValueType, ChannelCount>::Spa
 	return sample_number % info.samples_per_second;
 }
 
+// Copies `pcm` into `spans`, starting at the byte offset `pcm_pos`, and returns the position to continue at.
+// Without looping the spans are padded with silence once the end of `pcm` is reached.
 template<typename ValueType, size_t ChannelCount>
-uint32_t fill_with_pcm(typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info, std::vector<byte>& pcm, size_t pcm_pos, bool looping) {
+size_t fill_with_pcm(typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, gsl::span<const byte> pcm, size_t pcm_pos, bool looping) {
 	const auto pcm_data = pcm.data();
-	const auto pcm_size = pcm.size();
+	const auto pcm_size = size_t(pcm.size());
 
 	for (const auto span : spans) {
 		const auto span_data = reinterpret_cast<byte*>(span.data());
@@ -44,13 +64,13 @@ uint32_t fill_with_pcm(typename buffer_trait<ValueType, ChannelCount>::SpanPairT
 			const auto span_remaining = span_size - span_pos;
 
 			if (!looping && pcm_pos == pcm_size) {
-				memset(span_data, 0, span_remaining);
+				memset(span_data + span_pos, 0, span_remaining);
 				break;
 			}
 
 			const auto remaining = std::min(pcm_remaining, span_remaining);
 
-			memcpy(span_data + span_pos, pcm_data + span_pos, remaining);
+			memcpy(span_data + span_pos, pcm_data + pcm_pos, remaining);
 
 			span_pos += remaining;
 			pcm_pos += remaining;
@@ -60,6 +80,49 @@ uint32_t fill_with_pcm(typename buffer_trait<ValueType, ChannelCount>::SpanPairT
 			}
 		}
 	}
+
+	return pcm_pos;
+}
+
+// Converts a normalized [-1, +1] value into ValueType, clipping any overshoot.
+// Floating point buffers keep the normalized range. Integers are rounded to nearest, like convert_frames' SSE2 path.
+template<typename ValueType>
+ValueType convert_value(float value) noexcept {
+	if constexpr (std::is_floating_point_v<ValueType>) {
+		return ValueType(std::clamp(value, -1.0f, 1.0f));
+	} else {
+		constexpr float amplitude = float(std::numeric_limits<ValueType>::max());
+		constexpr float minimum = float(std::numeric_limits<ValueType>::min());
+		// float(INT32_MAX) rounds up to 2^31, which is why the result is clamped once more after rounding.
+		const auto rounded = std::llrint(std::clamp(value * amplitude, minimum, amplitude));
+		return ValueType(std::min<long long>(rounded, std::numeric_limits<ValueType>::max()));
+	}
+}
+
+// Converts normalized [-1, +1] mix frames into the buffer's ValueType, clipping any overshoot.
+template<typename ValueType, size_t ChannelCount>
+void convert_frames(const mix_frame<ChannelCount>* src, typename buffer_trait<ValueType, ChannelCount>::SampleType* dst, size_t count) {
+	auto in = reinterpret_cast<const float*>(src);
+	auto out = reinterpret_cast<ValueType*>(dst);
+	size_t i = 0;
+	const size_t n = count * ChannelCount;
+
+#if DIRECT_SOUND_SSE2
+	if constexpr (std::is_same_v<ValueType, int16_t>) {
+		// _mm_packs_epi32 saturates for us, which makes this the clipping step as well.
+		const auto scale = _mm_set1_ps(float(std::numeric_limits<int16_t>::max()));
+
+		for (; i + 8 <= n; i += 8) {
+			const auto lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), scale));
+			const auto hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+		}
+	}
+#endif
+
+	for (; i < n; ++i) {
+		out[i] = convert_value<ValueType>(in[i]);
+	}
 }
 
 // Maps asin's result space from [-M_PI_2, +M_PI_2] to [0, 2*M_PI]
@@ -79,40 +142,16 @@ inline double asin_2pi(double value, bool is_falling) {
 
 template<typename ValueType, size_t ChannelCount>
 auto create_pcm_provider(std::vector<byte> pcm, bool looping) {
+	if (pcm.empty()) {
+		throw std::invalid_argument("pcm must not be empty");
+	}
+
 	size_t pcm_pos = 0;
 
 	return [pcm, pcm_pos, looping](buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
 		UNREFERENCED_PARAMETER(info);
 
-		const auto pcm_data = pcm.data();
-		const auto pcm_size = pcm.size();
-
-		for (const auto span : spans) {
-			const auto span_data = reinterpret_cast<byte*>(span.data());
-			const auto span_size = size_t(span.size_bytes());
-			size_t span_pos = 0;
-
-			while (span_pos < span_size) {
-				const auto pcm_remaining = pcm_size - pcm_pos;
-				const auto span_remaining = span_size - span_pos;
-
-				if (!looping && pcm_pos == pcm_size) {
-					memset(span_data, 0, span_remaining);
-					break;
-				}
-
-				const auto remaining = std::min(pcm_remaining, span_remaining);
-
-				memcpy(span_data + span_pos, pcm_data + pcm_pos, remaining);
-
-				span_pos += remaining;
-				pcm_pos += remaining;
-
-				if (looping && pcm_pos == pcm_size) {
-					pcm_pos = 0;
-				}
-			}
-		}
+		pcm_pos = detail::fill_with_pcm<ValueType, ChannelCount>(spans, pcm, pcm_pos, looping);
 	};
 }
 
@@ -155,11 +194,38 @@ auto create_pcm_series_provider(std::vector<std::vector<byte>> pcms) {
 
 template<typename ValueType, size_t ChannelCount>
 auto create_sine_wave_provider(size_t frequency) {
-	uint32_t sample_number = 0;
+	if (frequency == 0) {
+		throw std::invalid_argument("invalid argument for frequency: 0");
+	}
 
-	return [frequency, sample_number](buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
-		sample_number = detail::fill_with_sine_wave<ValueType, ChannelCount>(spans, info, frequency, sample_number);
-	};
+	if constexpr (fixed_point_traits<ValueType>::enabled) {
+		// A single fixed point oscillator keeps running from fill to fill. It's only set up again when the rate
+		// changes, which can't fail, so that nothing is validated or thrown on the render thread.
+		fixed_oscillator<ValueType> oscillator;
+		size_t samples_per_second = 0;
+
+		// Computes the sine table now rather than in the first fill.
+		detail::fixed_sine_table();
+
+		return [frequency, oscillator, samples_per_second](buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+			if (info.samples_per_second != samples_per_second) {
+				oscillator.set_frequency(double(frequency), info.samples_per_second);
+				samples_per_second = info.samples_per_second;
+			}
+
+			for (const auto span : spans) {
+				for (auto sample = span.data(), end = sample + span.size(); sample != end; ++sample) {
+					sample->fill(oscillator.next());
+				}
+			}
+		};
+	} else {
+		uint32_t sample_number = 0;
+
+		return [frequency, sample_number](buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+			sample_number = detail::fill_with_sine_wave<ValueType, ChannelCount>(spans, info, frequency, sample_number);
+		};
+	}
 }
 
 template<typename ValueType, size_t ChannelCount>
@@ -167,6 +233,9 @@ auto create_sine_wave_toneladder_provider(std::vector<size_t> frequencies) {
 	if (frequencies.empty()) {
 		throw std::invalid_argument("frequencies must not be empty");
 	}
+	if (std::find(frequencies.begin(), frequencies.end(), size_t(0)) != frequencies.end()) {
+		throw std::invalid_argument("invalid argument for frequencies: 0");
+	}
 
 	size_t frequency_idx = 0;
 	uint32_t sample_number = 0;
@@ -219,7 +288,8 @@ auto create_sine_wave_toneladder_provider(std::vector<size_t> frequencies) {
 		const auto new_sample_rad = detail::asin_2pi(sample1d, sample1 < sample2);
 		const auto new_sample = uint32_t(round(new_sample_rad / radiant_periods_per_sample));
 
-		sample_number = new_sample;
+		// new_sample reproduces the value of the last sample we just wrote. The next fill starts one after it.
+		sample_number = new_sample + 1;
 	};
 }
 
@@ -0,0 +1,87 @@
+#pragma once
+
+namespace direct_sound {
+
+// A lock-free single-producer, single-consumer queue of trivially copyable values.
+// push() may only be called by one thread and pop() by one other thread.
+template<typename T>
+class spsc_queue {
+public:
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	// The capacity is rounded up to the next power of two.
+	explicit spsc_queue(size_t capacity) {
+		if (capacity == 0 || capacity > (size_t(1) << 30)) {
+			throw std::invalid_argument(string_format("invalid argument for capacity: %zu", capacity));
+		}
+
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+
+		m_items.resize(size);
+		m_mask = size - 1;
+	}
+
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue& operator=(const spsc_queue&) = delete;
+
+	size_t capacity() const noexcept {
+		return m_items.size();
+	}
+
+	// The number of queued items. Exact when called by either the producer or the consumer, in that their own
+	// operations are accounted for, but the other side may have changed it by the time the result is used.
+	size_t size() const noexcept {
+		return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+	}
+
+	// Appends as many of the `count` items as fit and returns how many that were.
+	size_t push(const T* items, size_t count) noexcept {
+		const auto head = m_head.load(std::memory_order_relaxed);
+		const auto tail = m_tail.load(std::memory_order_acquire);
+		count = std::min(count, capacity() - (head - tail));
+
+		for (size_t i = 0; i < count; ++i) {
+			m_items[(head + i) & m_mask] = items[i];
+		}
+
+		m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	bool push(const T& item) noexcept {
+		return push(&item, 1) == 1;
+	}
+
+	// Removes up to `count` items and returns how many were available.
+	size_t pop(T* items, size_t count) noexcept {
+		const auto tail = m_tail.load(std::memory_order_relaxed);
+		const auto head = m_head.load(std::memory_order_acquire);
+		count = std::min(count, head - tail);
+
+		for (size_t i = 0; i < count; ++i) {
+			items[i] = m_items[(tail + i) & m_mask];
+		}
+
+		m_tail.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Returns the oldest item without removing it. Consumer only.
+	const T* peek() const noexcept {
+		const auto tail = m_tail.load(std::memory_order_relaxed);
+		return tail == m_head.load(std::memory_order_acquire) ? nullptr : &m_items[tail & m_mask];
+	}
+
+private:
+	std::vector<T> m_items;
+	size_t m_mask = 0;
+
+	// Kept on separate cache lines, so that producer and consumer don't invalidate each other's.
+	alignas(64) std::atomic<size_t> m_head = 0;
+	alignas(64) std::atomic<size_t> m_tail = 0;
+};
+
+} // namespace direct_sound
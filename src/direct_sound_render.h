@@ -0,0 +1,218 @@
+#pragma once
+
+namespace direct_sound {
+
+// Renders a provider without any sound device.
+//
+// The provider is invoked exactly like a double_buffer would: `block_size` samples at a time,
+// written into a ring of info.samples samples. Whenever a block crosses the end of the
+// ring it's handed to the provider as 2 spans, just like a wrapped-around Lock() would be.
+// Running the same provider with different block sizes must thus yield identical output.
+template<typename ValueType, size_t ChannelCount>
+std::vector<typename buffer_trait<ValueType, ChannelCount>::SampleType> render_offline(typename buffer_trait<ValueType, ChannelCount>::ProviderFunction provider, buffer_info info, size_t samples, size_t block_size) {
+	using SampleType = typename buffer_trait<ValueType, ChannelCount>::SampleType;
+
+	if (!provider) {
+		throw std::invalid_argument("provider must not be null");
+	}
+	if (info.samples == 0 || block_size == 0 || block_size > info.samples) {
+		throw std::invalid_argument(string_format("invalid argument for block_size: %zu (ring of %zu samples)", block_size, info.samples));
+	}
+
+	std::vector<SampleType> ring(info.samples);
+	std::vector<SampleType> output;
+	output.reserve(samples);
+
+	for (size_t position = 0; position < samples;) {
+		const auto length = std::min(block_size, samples - position);
+		const auto offset = position % info.samples;
+		const auto first = std::min(length, info.samples - offset);
+
+		provider({{
+			{ring.data() + offset, ptrdiff_t(first)},
+			{ring.data(), ptrdiff_t(length - first)},
+		}}, info);
+
+		output.insert(output.end(), ring.data() + offset, ring.data() + offset + first);
+		output.insert(output.end(), ring.data(), ring.data() + (length - first));
+
+		position += length;
+	}
+
+	return output;
+}
+
+// 64-bit FNV-1a. Used to fingerprint rendered output.
+inline uint64_t fnv1a_hash(gsl::span<const byte> data, uint64_t hash = 0xcbf29ce484222325) noexcept {
+	for (auto it = data.data(), end = it + data.size(); it != end; ++it) {
+		hash = (hash ^ *it) * 0x100000001b3;
+	}
+	return hash;
+}
+
+template<typename SampleType>
+uint64_t hash_samples(const std::vector<SampleType>& samples) noexcept {
+	return fnv1a_hash({reinterpret_cast<const byte*>(samples.data()), ptrdiff_t(samples.size() * sizeof(SampleType))});
+}
+
+// Returns the largest absolute difference between any two values of `a` and `b`,
+// or infinity if their lengths differ. Useful for comparing optimized providers against
+// a reference implementation, where bit-exactness can't be expected.
+template<typename SampleType>
+double max_deviation(const std::vector<SampleType>& a, const std::vector<SampleType>& b) noexcept {
+	if (a.size() != b.size()) {
+		return std::numeric_limits<double>::infinity();
+	}
+
+	double deviation = 0.0;
+
+	for (size_t i = 0; i < a.size(); ++i) {
+		for (size_t channel = 0; channel < a[i].size(); ++channel) {
+			deviation = std::max(deviation, std::abs(double(a[i][channel]) - double(b[i][channel])));
+		}
+	}
+
+	return deviation;
+}
+
+// Writes PCM data into a RIFF/WAVE file. The header's size fields are patched once the writer is closed.
+class wav_writer {
+public:
+	explicit wav_writer(const std::filesystem::path& path, const wave_format& format) : m_out(path, std::ios::binary | std::ios::trunc), m_format(format) {
+		if (!m_out) {
+			throw std::runtime_error("failed to open wav file");
+		}
+
+		write_header();
+	}
+
+	wav_writer(const wav_writer&) = delete;
+	wav_writer& operator=(const wav_writer&) = delete;
+
+	~wav_writer() {
+		try {
+			close();
+		} catch (...) {
+		}
+	}
+
+	const wave_format& format() const {
+		return m_format;
+	}
+
+	size_t data_bytes() const {
+		return m_data_bytes;
+	}
+
+	void write(gsl::span<const byte> data) {
+		m_out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+		m_data_bytes += size_t(data.size());
+	}
+
+	void close() {
+		if (!m_out.is_open()) {
+			return;
+		}
+
+		m_out.seekp(0);
+		write_header();
+		m_out.close();
+	}
+
+private:
+	void write_header() {
+		const auto put16 = [this](uint16_t value) { m_out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+		const auto put32 = [this](uint32_t value) { m_out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+		const auto data_bytes = uint32_t(std::min<size_t>(m_data_bytes, std::numeric_limits<uint32_t>::max() - 36));
+
+		m_out.write("RIFF", 4);
+		put32(36 + data_bytes);
+		m_out.write("WAVEfmt ", 8);
+		put32(16);
+		put16(m_format.floating_point ? 3 : 1); // WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM
+		put16(uint16_t(m_format.channels));
+		put32(uint32_t(m_format.samples_per_second));
+		put32(uint32_t(m_format.bytes_per_second()));
+		put16(uint16_t(m_format.block_align()));
+		put16(uint16_t(m_format.bits_per_sample));
+		m_out.write("data", 4);
+		put32(data_bytes);
+	}
+
+	std::ofstream m_out;
+	wave_format m_format;
+	size_t m_data_bytes = 0;
+};
+
+// Reads the samples of a RIFF/WAVE file like the ones wav_writer writes, which must be in `format`.
+// Chunks other than the format and the data are skipped.
+template<typename SampleType>
+std::vector<SampleType> read_wav(const std::filesystem::path& path, const wave_format& format) {
+	if (sizeof(SampleType) != format.block_align()) {
+		throw std::invalid_argument(string_format("invalid sample type for %zu channels of %zu bits", format.channels, format.bits_per_sample));
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		throw std::runtime_error(string_format("failed to open %s", path.u8string().c_str()));
+	}
+
+	const auto get16 = [&in]() { uint16_t value = 0; in.read(reinterpret_cast<char*>(&value), sizeof(value)); return value; };
+	const auto get32 = [&in]() { uint32_t value = 0; in.read(reinterpret_cast<char*>(&value), sizeof(value)); return value; };
+	const auto invalid = [&path](const char* reason) { return std::runtime_error(string_format("invalid wav file %s: %s", path.u8string().c_str(), reason)); };
+
+	char id[4];
+	in.read(id, 4);
+	get32();
+	char type[4];
+	in.read(type, 4);
+
+	if (!in || memcmp(id, "RIFF", 4) != 0 || memcmp(type, "WAVE", 4) != 0) {
+		throw invalid("not a RIFF/WAVE file");
+	}
+
+	std::optional<wave_format> actual;
+
+	while (in.read(id, 4)) {
+		const auto size = get32();
+		const auto end = std::streamoff(in.tellg()) + std::streamoff(size) + std::streamoff(size & 1);
+
+		if (memcmp(id, "fmt ", 4) == 0) {
+			const auto tag = get16();
+			const auto channels = get16();
+			const auto samples_per_second = get32();
+			get32();
+			get16();
+			const auto bits_per_sample = get16();
+
+			// WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT
+			if (tag != 1 && tag != 3) {
+				throw invalid("unsupported format tag");
+			}
+
+			actual = wave_format(channels, bits_per_sample, samples_per_second, tag == 3);
+		} else if (memcmp(id, "data", 4) == 0) {
+			if (!actual || *actual != format) {
+				throw invalid("unexpected format");
+			}
+			if (size % sizeof(SampleType) != 0) {
+				throw invalid("truncated data");
+			}
+
+			std::vector<SampleType> samples(size / sizeof(SampleType));
+			in.read(reinterpret_cast<char*>(samples.data()), std::streamsize(size));
+
+			if (!in) {
+				throw invalid("truncated data");
+			}
+
+			return samples;
+		}
+
+		in.seekg(end);
+	}
+
+	throw invalid("no data chunk");
+}
+
+} // namespace direct_sound
@@ -0,0 +1,297 @@
+#pragma once
+
+namespace direct_sound {
+
+// An immutable recording of a single note, which sampler voices
+// can play back at arbitrary pitches.
+//
+// The PCM data is converted to planar, normalized floats once, so that
+// all voices sharing the sample can interpolate it without any conversion.
+class sampler_sample {
+public:
+	// loop_end == 0 means "until the end of the sample".
+	explicit sampler_sample(gsl::span<const int16_t> pcm, size_t channels, size_t samples_per_second, double root_frequency, size_t loop_start = 0, size_t loop_end = 0) {
+		if (channels < 1 || channels > 12) {
+			throw std::invalid_argument(string_format("invalid argument for channels: %zu", channels));
+		}
+		if (samples_per_second < 128 || samples_per_second > 192000) {
+			throw std::invalid_argument(string_format("invalid argument for samples_per_second: %zu > 192000", samples_per_second));
+		}
+		if (!(root_frequency > 0.0)) {
+			throw std::invalid_argument("root_frequency must be positive");
+		}
+
+		const auto frames = size_t(pcm.size()) / channels;
+
+		if (frames < 2 || frames > std::numeric_limits<uint32_t>::max() - 1) {
+			throw std::invalid_argument(string_format("invalid argument for pcm (frame count): %zu", frames));
+		}
+		if (loop_end == 0) {
+			loop_end = frames;
+		}
+		if (loop_start >= loop_end || loop_end > frames) {
+			throw std::invalid_argument(string_format("invalid loop points: [%zu, %zu) for %zu frames", loop_start, loop_end, frames));
+		}
+
+		m_frames = frames;
+		m_samples_per_second = samples_per_second;
+		m_root_frequency = root_frequency;
+		m_loop_start = loop_start;
+		m_loop_end = loop_end;
+		m_channels.resize(channels);
+
+		const auto data = pcm.data();
+		constexpr float scale = 1.0f / 32768.0f;
+
+		for (size_t channel = 0; channel < channels; ++channel) {
+			auto& dst = m_channels[channel];
+
+			// The additional guard frame allows the interpolation kernel to always
+			// read index+1 without any bounds checks. Past the end there's silence.
+			// Looping voices interpolate the last frame of the loop towards the loop start themselves.
+			dst.resize(frames + 1);
+
+			for (size_t i = 0; i < frames; ++i) {
+				dst[i] = float(data[i * channels + channel]) * scale;
+			}
+
+			dst[frames] = 0.0f;
+		}
+	}
+
+	size_t channels() const {
+		return m_channels.size();
+	}
+
+	size_t frames() const {
+		return m_frames;
+	}
+
+	size_t samples_per_second() const {
+		return m_samples_per_second;
+	}
+
+	double root_frequency() const {
+		return m_root_frequency;
+	}
+
+	size_t loop_start() const {
+		return m_loop_start;
+	}
+
+	size_t loop_end() const {
+		return m_loop_end;
+	}
+
+	const float* channel(size_t index) const {
+		return m_channels[index].data();
+	}
+
+	size_t size_bytes() const {
+		return m_channels.size() * (m_frames + 1) * sizeof(float);
+	}
+
+private:
+	std::vector<std::vector<float>> m_channels;
+	size_t m_frames = 0;
+	size_t m_samples_per_second = 0;
+	double m_root_frequency = 0.0;
+	size_t m_loop_start = 0;
+	size_t m_loop_end = 0;
+};
+
+namespace detail {
+
+// Positions are stored as 32.32 fixed point numbers:
+// The upper 32 bits are the frame index and the lower 32 bits the fraction in between two frames.
+constexpr uint64_t sampler_fraction_one = uint64_t(1) << 32;
+
+// Writes `count` linearly interpolated values read from `src` into `dst`,
+// starting at `position` and advancing by `increment` per value.
+// `src` must be readable up to and including index ((position + (count - 1) * increment) >> 32) + 1.
+inline void interpolate_linear(const float* src, uint64_t position, uint64_t increment, float* dst, size_t count) noexcept {
+	// Only the upper 24 bits of the fraction fit into a float's mantissa.
+	constexpr float fraction_scale = 1.0f / float(1 << 24);
+	size_t i = 0;
+
+#if DIRECT_SOUND_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const auto p0 = position;
+		const auto p1 = p0 + increment;
+		const auto p2 = p1 + increment;
+		const auto p3 = p2 + increment;
+		position = p3 + increment;
+
+		const auto i0 = size_t(p0 >> 32);
+		const auto i1 = size_t(p1 >> 32);
+		const auto i2 = size_t(p2 >> 32);
+		const auto i3 = size_t(p3 >> 32);
+
+		// There is no gather instruction in SSE2, which is why the loads are scalar.
+		// The fraction and lerp arithmetic is done 4 values at a time though.
+		const auto a = _mm_set_ps(src[i3], src[i2], src[i1], src[i0]);
+		const auto b = _mm_set_ps(src[i3 + 1], src[i2 + 1], src[i1 + 1], src[i0 + 1]);
+		const auto f = _mm_mul_ps(
+			_mm_cvtepi32_ps(_mm_set_epi32(int(uint32_t(p3) >> 8), int(uint32_t(p2) >> 8), int(uint32_t(p1) >> 8), int(uint32_t(p0) >> 8))),
+			_mm_set1_ps(fraction_scale)
+		);
+
+		_mm_storeu_ps(dst + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), f)));
+	}
+#endif
+
+	for (; i < count; ++i) {
+		const auto index = size_t(position >> 32);
+		const auto f = float(uint32_t(position) >> 8) * fraction_scale;
+		const auto a = src[index];
+		dst[i] = a + (src[index + 1] - a) * f;
+		position += increment;
+	}
+}
+
+} // namespace detail
+
+// Plays a sampler_sample at an arbitrary frequency by resampling it with a fractional rate.
+// Voices are cheap to copy: The sample data itself is shared between all of them.
+template<size_t ChannelCount>
+class sampler_voice {
+public:
+	explicit sampler_voice() noexcept {
+	}
+
+	explicit sampler_voice(std::shared_ptr<const sampler_sample> sample, double frequency, size_t samples_per_second, bool looping) : m_sample(std::move(sample)), m_looping(looping) {
+		if (!m_sample) {
+			throw std::invalid_argument("sample must not be null");
+		}
+
+		set_frequency(frequency, samples_per_second);
+	}
+
+	void set_frequency(double frequency, size_t samples_per_second) {
+		if (!(frequency > 0.0) || samples_per_second == 0) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+
+		const auto ratio = (frequency / m_sample->root_frequency()) * (double(m_sample->samples_per_second()) / double(samples_per_second));
+
+		// An increment of 0 would never advance and one that large is certainly inaudible anyways.
+		if (!(ratio > 0.0) || ratio >= 65536.0) {
+			throw std::invalid_argument(string_format("invalid playback ratio: %f", ratio));
+		}
+
+		m_increment = std::max(uint64_t(1), uint64_t(ratio * double(detail::sampler_fraction_one) + 0.5));
+	}
+
+	const std::shared_ptr<const sampler_sample>& sample() const {
+		return m_sample;
+	}
+
+	bool finished() const {
+		return m_finished;
+	}
+
+	// Overwrites `count` frames with the voice's output.
+	// Once a non-looping voice finished the remainder is filled with silence.
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		constexpr size_t chunk_size = 256;
+		float scratch[chunk_size];
+
+		const auto& sample = *m_sample;
+		const auto channels = sample.channels();
+		const auto end = uint64_t(m_looping ? sample.loop_end() : sample.frames()) << 32;
+		const auto loop_length = uint64_t(sample.loop_end() - sample.loop_start()) << 32;
+		// When looping, the last frame of the loop is followed by the loop start, not by the frame after it in the sample.
+		const auto seam = m_looping ? uint64_t(sample.loop_end() - 1) << 32 : end;
+
+		size_t done = 0;
+
+		while (done < count) {
+			if (m_finished) {
+				std::fill(frames + done, frames + count, mix_frame<ChannelCount>{});
+				return;
+			}
+
+			const auto out = frames + done;
+
+			if (m_position >= seam && m_position < end) {
+				const auto index = size_t(m_position >> 32);
+				const auto f = float(uint32_t(m_position) >> 8) * (1.0f / float(1 << 24));
+
+				for (size_t channel = 0; channel < ChannelCount; ++channel) {
+					const auto src = sample.channel(std::min(channel, channels - 1));
+					const auto a = src[index];
+					(*out)[channel] = a + (src[sample.loop_start()] - a) * f;
+				}
+
+				m_position += m_increment;
+				done += 1;
+			} else {
+				// The number of values we can produce before reaching the seam of the loop (or the end of the sample).
+				const auto until_seam = size_t((seam - m_position + m_increment - 1) / m_increment);
+				const auto n = std::min({count - done, chunk_size, until_seam});
+
+				for (size_t channel = 0; channel < ChannelCount; ++channel) {
+					// Samples with fewer channels than the output get their last channel duplicated.
+					// This way a mono sample is interpolated only once for all output channels.
+					if (channel < channels) {
+						detail::interpolate_linear(sample.channel(channel), m_position, m_increment, scratch, n);
+					}
+
+					for (size_t i = 0; i < n; ++i) {
+						out[i][channel] = scratch[i];
+					}
+				}
+
+				m_position += uint64_t(n) * m_increment;
+				done += n;
+			}
+
+			if (m_position >= end) {
+				if (m_looping) {
+					do {
+						m_position -= loop_length;
+					} while (m_position >= end);
+				} else {
+					m_finished = true;
+				}
+			}
+		}
+	}
+
+private:
+	std::shared_ptr<const sampler_sample> m_sample;
+	uint64_t m_position = 0;
+	uint64_t m_increment = detail::sampler_fraction_one;
+	bool m_looping = false;
+	bool m_finished = false;
+};
+
+template<typename ValueType, size_t ChannelCount>
+auto create_sampler_provider(std::shared_ptr<const sampler_sample> sample, double frequency, bool looping) {
+	if (!sample) {
+		throw std::invalid_argument("sample must not be null");
+	}
+
+	sampler_voice<ChannelCount> voice;
+	std::vector<mix_frame<ChannelCount>> mix;
+
+	return [sample, frequency, looping, voice, mix](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		// The voice can only be set up once the buffer's samples_per_second are known.
+		if (!voice.sample()) {
+			voice = sampler_voice<ChannelCount>(sample, frequency, info.samples_per_second, looping);
+		}
+
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			if (mix.size() < size) {
+				mix.resize(size);
+			}
+
+			voice.render(mix.data(), size);
+			detail::convert_frames<ValueType, ChannelCount>(mix.data(), span.data(), size);
+		}
+	};
+}
+
+} // namespace direct_sound
@@ -0,0 +1,237 @@
+#pragma once
+
+namespace direct_sound {
+
+// Refers to a note scheduled with sequencer::note_on(), both before and after it has started. 0 is never a valid handle.
+using note_handle = uint32_t;
+
+// Plays timestamped events into a voice_allocator with sample accuracy.
+//
+// Events are scheduled at absolute positions on the sequencer's timeline, which is the number of
+// samples it has rendered so far (see position()). The control thread passes them to the render
+// thread through a lock-free queue and each rendered block is split at the exact offsets its
+// events fall onto. Musical timing is thus independent of the buffer size. Events scheduled
+// for a position that was already rendered are applied at the start of the next block.
+//
+// The scheduling methods may only be called from a single thread.
+// A sequencer renders just like its allocator and can be passed to create_voice_allocator_provider().
+// The allocator itself may still be used directly at the same time, e.g. for notes played live.
+template<typename Allocator>
+class sequencer {
+public:
+	static constexpr size_t channel_count = Allocator::channel_count;
+
+	using VoiceType = typename Allocator::VoiceType;
+
+	// `capacity` bounds the number of events in flight between the two threads. Only the last
+	// `capacity` notes can be referred to by their handle, older ones are ignored just like finished voices.
+	// The render thread holds up to `capacity` received events as well, which it never allocates more room for:
+	// Once that many are pending, further ones wait in the queue until the earliest pending ones were applied.
+	// Scheduling more than `capacity` events ahead of time thus only works in chronological order.
+	explicit sequencer(std::shared_ptr<Allocator> allocator, size_t capacity = 4096) : m_allocator(std::move(allocator)), m_queue(capacity) {
+		if (!m_allocator) {
+			throw std::invalid_argument("allocator must not be null");
+		}
+
+		m_voices.resize(m_queue.capacity());
+		m_started.resize(m_queue.capacity());
+		m_pending.reserve(m_queue.capacity());
+		m_mask = m_queue.capacity() - 1;
+	}
+
+	sequencer(const sequencer&) = delete;
+	sequencer& operator=(const sequencer&) = delete;
+
+	// The position on the timeline up to which samples have been rendered.
+	// Events scheduled at or after it are guaranteed to be played on time.
+	uint64_t position() const noexcept {
+		return m_position.load(std::memory_order_acquire);
+	}
+
+	size_t max_block_size() const noexcept {
+		return m_allocator->max_block_size();
+	}
+
+	// The number of events that were scheduled for a position which had already been rendered.
+	size_t late_events() const noexcept {
+		return m_late_events.load(std::memory_order_relaxed);
+	}
+
+	note_handle note_on(uint64_t time, VoiceType voice) {
+		const auto note = m_next_note == std::numeric_limits<note_handle>::max() ? 1 : m_next_note + 1;
+
+		// The voice is handed over through a slot of its own, since it isn't trivially copyable.
+		// The render thread only pops an event after it's done with its slot, so that a queue which
+		// isn't full guarantees the oldest note_on using this slot was already received.
+		if (m_queue.size() == m_queue.capacity()) {
+			throw std::runtime_error("sequencer event queue is full");
+		}
+
+		m_voices[note & m_mask] = std::move(voice);
+		push({time, event_type::note_on, note, 0});
+		m_next_note = note;
+		return note;
+	}
+
+	// Releases the note, see voice_allocator::note_off().
+	void note_off(uint64_t time, note_handle note) {
+		push({time, event_type::note_off, note, 0});
+	}
+
+	void set_volume(uint64_t time, note_handle note, int volume) {
+		if (volume < volume_min || volume > volume_max) {
+			throw std::invalid_argument(string_format("invalid argument for volume: %i", volume));
+		}
+		push({time, event_type::volume, note, volume});
+	}
+
+	void set_pan(uint64_t time, note_handle note, int pan) {
+		if (pan < pan_left || pan > pan_right) {
+			throw std::invalid_argument(string_format("invalid argument for pan: %i", pan));
+		}
+		push({time, event_type::pan, note, pan});
+	}
+
+	// Drops all events scheduled so far and releases the notes already started by them.
+	// Takes effect at the start of the next block.
+	void clear() {
+		push({0, event_type::clear, 0, 0});
+	}
+
+	// Overwrites `count` frames with the mix of the allocator's voices, applying all events due within them.
+	void render(mix_frame<channel_count>* frames, size_t count, size_t samples_per_second) {
+		receive();
+
+		const auto begin = m_position.load(std::memory_order_relaxed);
+		const auto end = begin + count;
+		auto position = begin;
+		size_t applied = 0;
+
+		while (position < end) {
+			for (; applied < m_pending.size() && m_pending[applied].event.time <= position; ++applied) {
+				if (m_pending[applied].event.time < begin) {
+					m_late_events.fetch_add(1, std::memory_order_relaxed);
+				}
+				apply(m_pending[applied]);
+			}
+
+			const auto next = applied < m_pending.size() ? std::min(end, m_pending[applied].event.time) : end;
+			m_allocator->render(frames + (position - begin), size_t(next - position), samples_per_second);
+			position = next;
+		}
+
+		m_pending.erase(m_pending.begin(), m_pending.begin() + applied);
+		m_position.store(end, std::memory_order_release);
+	}
+
+private:
+	enum class event_type : uint8_t {
+		note_on,
+		note_off,
+		volume,
+		pan,
+		clear,
+	};
+
+	class timed_event {
+	public:
+		uint64_t time;
+		event_type type;
+		note_handle note;
+		int value;
+	};
+
+	class scheduled {
+	public:
+		timed_event event;
+		std::optional<VoiceType> voice;
+	};
+
+	void push(const timed_event& e) {
+		if (!m_queue.push(e)) {
+			throw std::runtime_error("sequencer event queue is full");
+		}
+	}
+
+	// Moves the events received from the control thread into m_pending, which is kept sorted by time.
+	// Events with the same time stay in the order they were scheduled in.
+	void receive() {
+		while (const auto e = m_queue.peek()) {
+			if (e->type != event_type::clear && m_pending.size() == m_pending.capacity()) {
+				break;
+			}
+
+			if (e->type == event_type::clear) {
+				m_pending.clear();
+
+				for (auto& started : m_started) {
+					if (started.first != 0) {
+						m_allocator->note_off(started.second);
+						started = {};
+					}
+				}
+			} else {
+				scheduled s{*e, std::nullopt};
+
+				if (e->type == event_type::note_on) {
+					auto& slot = m_voices[e->note & m_mask];
+					s.voice = std::move(slot);
+					slot.reset();
+				}
+
+				const auto it = std::upper_bound(m_pending.begin(), m_pending.end(), e->time, [](uint64_t time, const scheduled& other) {
+					return time < other.event.time;
+				});
+				m_pending.insert(it, std::move(s));
+			}
+
+			timed_event discarded;
+			m_queue.pop(&discarded, 1);
+		}
+	}
+
+	void apply(scheduled& s) {
+		auto& started = m_started[s.event.note & m_mask];
+
+		if (s.event.type == event_type::note_on) {
+			started = {s.event.note, s.voice ? m_allocator->note_on(std::move(*s.voice)) : 0};
+			return;
+		}
+
+		if (started.first != s.event.note) {
+			return;
+		}
+
+		switch (s.event.type) {
+		case event_type::note_off:
+			m_allocator->note_off(started.second);
+			started = {};
+			break;
+		case event_type::volume:
+			m_allocator->set_volume(started.second, s.event.value);
+			break;
+		case event_type::pan:
+			m_allocator->set_pan(started.second, s.event.value);
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::shared_ptr<Allocator> m_allocator;
+	spsc_queue<timed_event> m_queue;
+	size_t m_mask = 0;
+
+	// Written by the control thread before pushing the note_on event, read by the render thread before popping it.
+	std::vector<std::optional<VoiceType>> m_voices;
+	note_handle m_next_note = 0;
+
+	// Only used by the render thread.
+	std::vector<scheduled> m_pending;
+	std::vector<std::pair<note_handle, voice_id>> m_started;
+
+	std::atomic<uint64_t> m_position = 0;
+	std::atomic<size_t> m_late_events = 0;
+};
+
+} // namespace direct_sound
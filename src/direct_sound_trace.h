@@ -0,0 +1,202 @@
+#pragma once
+
+// Low-overhead tracing of the buffer fill hot path.
+//
+// Define DIRECT_SOUND_TRACING=1 to enable it. Otherwise DIRECT_SOUND_TRACE_SCOPE() expands to
+// nothing and none of the code below is compiled. Each thread records into its own fixed size
+// ring, which is only shared with the thread calling trace::export_chrome_trace(). The output
+// is the Chrome trace event format, which can be opened in chrome://tracing or ui.perfetto.dev.
+#ifndef DIRECT_SOUND_TRACING
+#define DIRECT_SOUND_TRACING 0
+#endif
+
+#define DIRECT_SOUND_TRACE_CONCAT_IMPL(a, b) a##b
+#define DIRECT_SOUND_TRACE_CONCAT(a, b) DIRECT_SOUND_TRACE_CONCAT_IMPL(a, b)
+
+#if DIRECT_SOUND_TRACING
+#define DIRECT_SOUND_TRACE_SCOPE(name, buffer_id, half, samples) const ::direct_sound::trace::scope DIRECT_SOUND_TRACE_CONCAT(_trace_scope_, __LINE__)(name, buffer_id, half, samples)
+#else
+#define DIRECT_SOUND_TRACE_SCOPE(name, buffer_id, half, samples) ((void)0)
+#endif
+
+#if DIRECT_SOUND_TRACING
+
+namespace direct_sound::trace {
+
+// Passed as `half` for spans that aren't tied to a half of a double_buffer.
+constexpr uint32_t no_half = std::numeric_limits<uint32_t>::max();
+
+class event {
+public:
+	const char* name;
+	std::chrono::steady_clock::time_point begin;
+	std::chrono::steady_clock::time_point end;
+	const void* buffer_id;
+	uint32_t thread_id;
+	uint32_t half;
+	size_t samples;
+};
+
+// A single-producer, single-consumer ring of events.
+// The producer is the thread owning the ring, the consumer whoever exports the trace.
+class thread_ring {
+public:
+	static constexpr size_t capacity = 4096;
+
+	explicit thread_ring(uint32_t thread_id) noexcept : thread_id(thread_id) {
+	}
+
+	void push(const event& e) noexcept {
+		const auto head = m_head.load(std::memory_order_relaxed);
+
+		if (head - m_tail.load(std::memory_order_acquire) >= capacity) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		m_events[head % capacity] = e;
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	template<typename F>
+	void drain(F&& func) {
+		const auto head = m_head.load(std::memory_order_acquire);
+		auto tail = m_tail.load(std::memory_order_relaxed);
+
+		for (; tail != head; ++tail) {
+			func(m_events[tail % capacity]);
+		}
+
+		m_tail.store(tail, std::memory_order_release);
+	}
+
+	size_t dropped() const noexcept {
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	const uint32_t thread_id;
+
+private:
+	std::array<event, capacity> m_events;
+	std::atomic<size_t> m_head = 0;
+	std::atomic<size_t> m_tail = 0;
+	std::atomic<size_t> m_dropped = 0;
+};
+
+namespace detail {
+
+class registry {
+public:
+	static registry& instance() {
+		static registry r;
+		return r;
+	}
+
+	std::shared_ptr<thread_ring> create_ring() {
+		auto ring = std::make_shared<thread_ring>(uint32_t(GetCurrentThreadId()));
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_rings.emplace_back(ring);
+		return ring;
+	}
+
+	template<typename F>
+	void for_each_ring(F&& func) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const auto& ring : m_rings) {
+			func(*ring);
+		}
+	}
+
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+private:
+	std::mutex m_mutex;
+	// Rings are kept alive after their thread exits, so that their events can still be exported.
+	std::vector<std::shared_ptr<thread_ring>> m_rings;
+};
+
+inline thread_ring& current_ring() {
+	// Only the first event on each thread takes the registry lock.
+	thread_local const auto ring = registry::instance().create_ring();
+	return *ring;
+}
+
+} // namespace detail
+
+class scope {
+public:
+	// The ring is looked up before taking the begin timestamp, so that the
+	// one-time registration of a thread isn't counted towards its first span.
+	explicit scope(const char* name, const void* buffer_id, uint32_t half, size_t samples) noexcept : m_ring(detail::current_ring()), m_name(name), m_buffer_id(buffer_id), m_half(half), m_samples(samples), m_begin(std::chrono::steady_clock::now()) {
+	}
+
+	scope(const scope&) = delete;
+	scope& operator=(const scope&) = delete;
+
+	~scope() {
+		m_ring.push({m_name, m_begin, std::chrono::steady_clock::now(), m_buffer_id, m_ring.thread_id, m_half, m_samples});
+	}
+
+private:
+	thread_ring& m_ring;
+	const char* m_name;
+	const void* m_buffer_id;
+	uint32_t m_half;
+	size_t m_samples;
+	std::chrono::steady_clock::time_point m_begin;
+};
+
+// Moves all events recorded so far into `out` as a Chrome trace JSON document.
+// Returns the number of events that were dropped because a thread's ring was full.
+inline size_t export_chrome_trace(std::ostream& out) {
+	using micros = std::chrono::duration<double, std::micro>;
+
+	auto& registry = detail::registry::instance();
+	const auto pid = GetCurrentProcessId();
+	size_t dropped = 0;
+	bool first = true;
+
+	out << "{\"traceEvents\":[";
+
+	registry.for_each_ring([&](thread_ring& ring) {
+		dropped += ring.dropped();
+
+		ring.drain([&](const event& e) {
+			out << (first ? "\n" : ",\n");
+			out << string_format(
+				"{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"buffer\":\"%p\",\"samples\":%zu",
+				e.name,
+				pid,
+				e.thread_id,
+				micros(e.begin - registry.epoch).count(),
+				micros(e.end - e.begin).count(),
+				e.buffer_id,
+				e.samples
+			).c_str();
+
+			if (e.half != no_half) {
+				out << ",\"half\":" << e.half;
+			}
+
+			out << "}}";
+			first = false;
+		});
+	});
+
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return dropped;
+}
+
+inline size_t export_chrome_trace(const std::filesystem::path& path) {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+	if (!out) {
+		throw std::runtime_error("failed to open trace file");
+	}
+
+	return export_chrome_trace(out);
+}
+
+} // namespace direct_sound::trace
+
+#endif // DIRECT_SOUND_TRACING
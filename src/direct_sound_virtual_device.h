@@ -0,0 +1,368 @@
+#pragma once
+
+namespace direct_sound {
+
+// A backend without any sound hardware behind it.
+//
+// A device thread advances the play cursors of all playing buffers in simulated real time,
+// measured against std::chrono::steady_clock and scaled by `clock_ratio`, and fires their
+// position notifications just like DirectSound would. This allows running and measuring the
+// whole playback stack, including its timing behavior, on machines without an audio device.
+//
+// Optionally the played-back audio of all 16-bit PCM buffers matching the capture format is
+// mixed (honoring their volume and pan) and written into a WAV file.
+//
+// It doesn't use DirectSound, but like the rest of the library it's compiled with the project's stdafx.h
+// (MFC, GSL, C++/WinRT) and utils.h (string_format), so it still requires a Windows build.
+class virtual_device : public backend {
+public:
+	explicit virtual_device(double clock_ratio = 1.0, std::chrono::microseconds period = std::chrono::milliseconds(1)) : m_shared(std::make_shared<shared>()) {
+		if (!(clock_ratio > 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for clock_ratio: %f", clock_ratio));
+		}
+		if (period.count() <= 0) {
+			throw std::invalid_argument("period must be positive");
+		}
+
+		m_shared->clock_ratio = clock_ratio;
+		m_shared->period = period;
+		m_thread = std::thread([shared = m_shared]() {
+			shared->run();
+		});
+	}
+
+	virtual_device(const virtual_device&) = delete;
+	virtual_device& operator=(const virtual_device&) = delete;
+
+	~virtual_device() {
+		{
+			std::lock_guard<std::mutex> lock(m_shared->mutex);
+			m_shared->exit = true;
+		}
+
+		m_shared->cv.notify_all();
+		m_thread.join();
+	}
+
+	std::unique_ptr<backend_buffer> create_buffer(const wave_format& format, size_t bytes) const override {
+		if (format.block_align() == 0 || bytes == 0 || bytes % format.block_align() != 0) {
+			throw std::invalid_argument(string_format("invalid argument for bytes: %zu", bytes));
+		}
+
+		auto state = std::make_shared<buffer_state>(format, bytes);
+
+		{
+			std::lock_guard<std::mutex> lock(m_shared->mutex);
+			m_shared->buffers.emplace_back(state);
+		}
+
+		return std::make_unique<buffer>(m_shared, std::move(state));
+	}
+
+	void start_capture(const std::filesystem::path& path, const wave_format& format) {
+		if (format.bits_per_sample != 16 || format.floating_point || format.channels == 0) {
+			throw std::invalid_argument("only 16-bit PCM can be captured");
+		}
+
+		auto writer = std::make_unique<wav_writer>(path, format);
+
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+		m_shared->capture = std::move(writer);
+		m_shared->capture_carry = 0.0;
+	}
+
+	void stop_capture() {
+		std::unique_ptr<wav_writer> writer;
+
+		{
+			std::lock_guard<std::mutex> lock(m_shared->mutex);
+			writer = std::move(m_shared->capture);
+		}
+	}
+
+	double clock_ratio() const {
+		return m_shared->clock_ratio;
+	}
+
+	// The simulated time that has passed on this device.
+	std::chrono::duration<double> elapsed() const {
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+		return m_shared->elapsed;
+	}
+
+private:
+	class buffer_state {
+	public:
+		explicit buffer_state(const wave_format& format, size_t bytes) : format(format), data(bytes) {
+		}
+
+		const wave_format format;
+
+		// Guards everything below, except for `callback`.
+		std::mutex mutex;
+		std::vector<byte> data;
+		size_t play_cursor = 0;
+		double carry = 0.0;
+		bool playing = false;
+		bool looping = false;
+		int volume = volume_max;
+		int pan = 0;
+		std::vector<size_t> offsets;
+		bool pending_notifications = false;
+
+		// Held while the callback runs, so that set_notifications() can wait for it.
+		std::mutex callback_mutex;
+		std::function<void()> callback;
+	};
+
+	class shared {
+	public:
+		void run() {
+			auto last = std::chrono::steady_clock::now();
+			std::vector<std::shared_ptr<buffer_state>> buffers;
+			std::vector<float> mix;
+
+			std::unique_lock<std::mutex> lock(mutex);
+
+			while (!cv.wait_for(lock, period, [this]() { return exit; })) {
+				const auto now = std::chrono::steady_clock::now();
+				const auto delta = std::chrono::duration<double>(now - last) * clock_ratio;
+				last = now;
+				elapsed += delta;
+
+				// Drop buffers that were destroyed and take a snapshot of the remaining ones,
+				// since the callbacks below must run without holding the device lock.
+				buffers.clear();
+				for (auto it = this->buffers.begin(); it != this->buffers.end();) {
+					if (auto state = it->lock()) {
+						buffers.emplace_back(std::move(state));
+						++it;
+					} else {
+						it = this->buffers.erase(it);
+					}
+				}
+
+				size_t capture_frames = 0;
+				if (capture) {
+					const auto frames = delta.count() * double(capture->format().samples_per_second) + capture_carry;
+					capture_frames = size_t(frames);
+					capture_carry = frames - double(capture_frames);
+					mix.assign(capture_frames * capture->format().channels, 0.0f);
+				}
+
+				for (const auto& state : buffers) {
+					advance(*state, delta, capture_frames, mix);
+				}
+
+				if (capture && capture_frames) {
+					std::vector<int16_t> pcm(mix.size());
+					for (size_t i = 0; i < mix.size(); ++i) {
+						pcm[i] = int16_t(std::clamp(mix[i], -32768.0f, 32767.0f));
+					}
+					capture->write({reinterpret_cast<const byte*>(pcm.data()), ptrdiff_t(pcm.size() * sizeof(int16_t))});
+				}
+
+				lock.unlock();
+
+				for (const auto& state : buffers) {
+					notify(*state);
+				}
+
+				lock.lock();
+			}
+		}
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool exit = false;
+		double clock_ratio = 1.0;
+		std::chrono::microseconds period{1000};
+		std::chrono::duration<double> elapsed{0.0};
+		std::vector<std::weak_ptr<buffer_state>> buffers;
+		std::unique_ptr<wav_writer> capture;
+		double capture_carry = 0.0;
+
+	private:
+		// Moves the play cursor of `state` forward and records which notifications are due.
+		void advance(buffer_state& state, std::chrono::duration<double> delta, size_t capture_frames, std::vector<float>& mix) {
+			std::lock_guard<std::mutex> lock(state.mutex);
+
+			if (!state.playing) {
+				return;
+			}
+
+			const auto block_align = state.format.block_align();
+			const auto size = state.data.size();
+			const auto captured = capture && capture->format().channels == state.format.channels && capture->format().samples_per_second == state.format.samples_per_second && state.format.bits_per_sample == 16 && !state.format.floating_point;
+			size_t frames;
+
+			if (captured) {
+				// Buffers running at the capture rate share its clock, so that they stay frame-aligned in the mix.
+				frames = capture_frames;
+			} else {
+				const auto exact = delta.count() * double(state.format.samples_per_second) + state.carry;
+				frames = size_t(exact);
+				state.carry = exact - double(frames);
+			}
+
+			if (!state.looping) {
+				frames = std::min(frames, (size - state.play_cursor) / block_align);
+			}
+
+			const auto begin = state.play_cursor;
+			const auto bytes = frames * block_align;
+
+			if (captured) {
+				const auto channels = state.format.channels;
+				const auto gain = attenuation_to_gain(state.volume);
+				const auto left = gain * attenuation_to_gain(std::min(0, -state.pan));
+				const auto right = gain * attenuation_to_gain(std::min(0, state.pan));
+				for (size_t frame = 0; frame < frames; ++frame) {
+					const auto src = reinterpret_cast<const int16_t*>(state.data.data() + (begin + frame * block_align) % size);
+
+					for (size_t channel = 0; channel < channels; ++channel) {
+						const auto g = channels != 2 ? gain : channel == 0 ? left : right;
+						mix[frame * channels + channel] += float(src[channel]) * g;
+					}
+				}
+			}
+
+			// DirectSound signals a position once the play cursor reaches it.
+			for (const auto offset : state.offsets) {
+				const auto distance = (offset + size - begin) % size;
+
+				if (distance < bytes) {
+					state.pending_notifications = true;
+				}
+			}
+
+			state.play_cursor = (begin + bytes) % size;
+
+			if (!state.looping && begin + bytes >= size) {
+				state.playing = false;
+				state.play_cursor = 0;
+			}
+		}
+
+		static void notify(buffer_state& state) {
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+
+				if (!state.pending_notifications) {
+					return;
+				}
+
+				state.pending_notifications = false;
+			}
+
+			// Like an auto-reset event, multiple positions passed during one tick coalesce into one callback.
+			std::lock_guard<std::mutex> lock(state.callback_mutex);
+
+			if (state.callback) {
+				state.callback();
+			}
+		}
+	};
+
+	class buffer : public backend_buffer {
+	public:
+		explicit buffer(std::shared_ptr<shared> device, std::shared_ptr<buffer_state> state) noexcept : m_device(std::move(device)), m_state(std::move(state)) {
+		}
+
+		~buffer() {
+			// Waits for a running callback, just like UnregisterWaitEx(INVALID_HANDLE_VALUE) does.
+			std::lock_guard<std::mutex> lock(m_state->callback_mutex);
+			m_state->callback = nullptr;
+		}
+
+		size_t size_bytes() const override {
+			return m_state->data.size();
+		}
+
+		RegionPairType lock(size_t offset, size_t length) override {
+			const auto size = m_state->data.size();
+
+			if (offset >= size || length > size) {
+				throw std::invalid_argument(string_format("invalid lock range: %zu + %zu > %zu", offset, length, size));
+			}
+
+			const auto data = m_state->data.data();
+			const auto first = std::min(length, size - offset);
+
+			return {{
+				{data + offset, ptrdiff_t(first)},
+				{data, ptrdiff_t(length - first)},
+			}};
+		}
+
+		void unlock(const RegionPairType& regions) override {
+			UNREFERENCED_PARAMETER(regions);
+		}
+
+		void play(bool looping) override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			m_state->playing = true;
+			m_state->looping = looping;
+		}
+
+		void stop() override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			m_state->playing = false;
+		}
+
+		void set_volume(int volume) override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			m_state->volume = volume;
+		}
+
+		void set_pan(int pan) override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			m_state->pan = pan;
+		}
+
+		std::pair<size_t, size_t> position() const override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+
+			// Like with real hardware, the write cursor is a little ahead of the play cursor.
+			const auto& format = m_state->format;
+			const auto size = m_state->data.size();
+			const auto ahead = std::min(size, size_t(double(format.samples_per_second) * std::chrono::duration<double>(m_device->period).count() + 1.0) * format.block_align());
+
+			return {m_state->play_cursor, (m_state->play_cursor + ahead) % size};
+		}
+
+		void set_position(size_t offset) override {
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+
+			if (offset >= m_state->data.size() || offset % m_state->format.block_align() != 0) {
+				throw std::invalid_argument(string_format("invalid argument for offset: %zu", offset));
+			}
+
+			m_state->play_cursor = offset;
+			m_state->carry = 0.0;
+		}
+
+		void set_notifications(std::vector<size_t> offsets, std::function<void()> callback) override {
+			std::lock_guard<std::mutex> callback_lock(m_state->callback_mutex);
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+
+			// Mirrors DirectSound, so that code which would fail on a real device fails on the virtual one too.
+			if (m_state->playing && !offsets.empty() && callback && offsets != m_state->offsets) {
+				throw std::logic_error("notification positions can only be changed while the buffer is stopped");
+			}
+
+			m_state->offsets = std::move(offsets);
+			m_state->callback = std::move(callback);
+			m_state->pending_notifications = false;
+		}
+
+	private:
+		std::shared_ptr<shared> m_device;
+		std::shared_ptr<buffer_state> m_state;
+	};
+
+	std::shared_ptr<shared> m_shared;
+	std::thread m_thread;
+};
+
+} // namespace direct_sound
@@ -0,0 +1,343 @@
+#pragma once
+
+namespace direct_sound {
+
+// A pure sine tone, synthesized on the fly.
+template<size_t ChannelCount>
+class sine_voice {
+public:
+	explicit sine_voice() noexcept {
+	}
+
+	explicit sine_voice(double frequency, size_t samples_per_second) {
+		if (!(frequency > 0.0) || samples_per_second == 0) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+
+		m_phase_increment = 2.0 * M_PI * frequency / double(samples_per_second);
+	}
+
+	bool finished() const {
+		return false;
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+			frame->fill(float(std::sin(m_phase)));
+
+			m_phase += m_phase_increment;
+			if (m_phase >= 2.0 * M_PI) {
+				m_phase -= 2.0 * M_PI;
+			}
+		}
+	}
+
+private:
+	double m_phase = 0.0;
+	double m_phase_increment = 0.0;
+};
+
+// Identifies a voice started by voice_allocator::note_on(). 0 is never a valid id.
+using voice_id = uint64_t;
+
+enum class steal_policy {
+	// Replace the voice that was started first.
+	oldest,
+	// Replace the voice with the lowest peak level during the last block.
+	quietest,
+};
+
+// Mixes a fixed number of voices into a single buffer.
+//
+// All voice slots are allocated up front. If all of them are in use,
+// note_on() steals one according to the steal_policy. While rendering,
+// the time spent is checked against a CPU budget (a fraction of the block's
+// playback duration) and voices that don't fit into it anymore are dropped
+// by releasing them, instead of letting the whole block miss its deadline.
+// A budget of 0 disables the check, for offline renders that must not depend on timing.
+// Scratch memory for up to `max_block_size` frames is allocated up front as well,
+// larger blocks are rendered in pieces of that size.
+//
+// Each VoiceType needs to provide:
+//   void render(mix_frame<ChannelCount>* frames, size_t count) - overwrites `count` frames
+//   bool finished() const - whether the voice can be released
+template<size_t ChannelCount, typename... VoiceTypes>
+class voice_allocator {
+public:
+	static constexpr size_t channel_count = ChannelCount;
+
+	using VoiceType = std::variant<VoiceTypes...>;
+
+	class statistics {
+	public:
+		size_t blocks = 0;
+		size_t active_voices = 0;
+		size_t stolen_voices = 0;
+		size_t dropped_voices = 0;
+		// Time spent rendering relative to the playback duration of the block.
+		double last_load = 0.0;
+		double peak_load = 0.0;
+	};
+
+	explicit voice_allocator(size_t polyphony, steal_policy policy = steal_policy::oldest, double cpu_budget = 0.5, size_t max_block_size = 4096) : m_slots(polyphony), m_order(polyphony), m_policy(policy), m_cpu_budget(cpu_budget) {
+		if (polyphony < 1 || polyphony > 1024) {
+			throw std::invalid_argument(string_format("invalid argument for polyphony: %zu", polyphony));
+		}
+		if (!(cpu_budget >= 0.0) || cpu_budget > 1.0) {
+			throw std::invalid_argument(string_format("invalid argument for cpu_budget: %f", cpu_budget));
+		}
+		if (max_block_size < 1 || max_block_size > 65536) {
+			throw std::invalid_argument(string_format("invalid argument for max_block_size: %zu", max_block_size));
+		}
+
+		m_scratch.resize(max_block_size);
+	}
+
+	voice_allocator(const voice_allocator&) = delete;
+	voice_allocator& operator=(const voice_allocator&) = delete;
+
+	size_t polyphony() const {
+		return m_slots.size();
+	}
+
+	size_t max_block_size() const noexcept {
+		return m_scratch.size();
+	}
+
+	voice_id note_on(VoiceType voice) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto target = std::find_if(m_slots.begin(), m_slots.end(), [](const slot& s) { return s.id == 0; });
+
+		if (target == m_slots.end()) {
+			target = std::min_element(m_slots.begin(), m_slots.end(), [this](const slot& a, const slot& b) {
+				return steal_priority(a) < steal_priority(b);
+			});
+			++m_statistics.stolen_voices;
+		}
+
+		target->voice = std::move(voice);
+		target->id = ++m_next_id;
+		target->started = target->id;
+		target->level = std::numeric_limits<float>::max();
+		target->gain = 1.0f;
+		target->releasing = false;
+		target->controls.reset();
+		target->smoother.snap(target->controls);
+
+		return target->id;
+	}
+
+	// Fades the voice out over a few milliseconds. Ids of voices that
+	// finished or were stolen in the meantime are silently ignored.
+	void note_off(voice_id id) {
+		with_voice(id, [](slot& s) { s.releasing = true; });
+	}
+
+	// Sets the volume or pan of a single voice, ramping towards it while rendering.
+	// Ids of voices that finished or were stolen in the meantime are silently ignored.
+	void set_volume(voice_id id, int volume) {
+		with_voice(id, [volume](slot& s) { s.controls.set_volume(volume); });
+	}
+
+	void set_pan(voice_id id, int pan) {
+		with_voice(id, [pan](slot& s) { s.controls.set_pan(pan); });
+	}
+
+	void all_notes_off() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (auto& s : m_slots) {
+			s.releasing = true;
+		}
+	}
+
+	statistics stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_statistics;
+	}
+
+	// Overwrites `count` frames with the mix of all active voices.
+	void render(mix_frame<ChannelCount>* frames, size_t count, size_t samples_per_second) {
+		for (size_t offset = 0; offset < count; offset += m_scratch.size()) {
+			render_block(frames + offset, std::min(count - offset, m_scratch.size()), samples_per_second);
+		}
+	}
+
+private:
+	static constexpr float release_seconds = 0.005f;
+	static constexpr std::chrono::microseconds min_budget{250};
+
+	class slot {
+	public:
+		VoiceType voice;
+		voice_id id = 0;
+		uint64_t started = 0;
+		float level = 0.0f;
+		float gain = 1.0f;
+		bool releasing = false;
+		gain_pan controls;
+		gain_pan_smoother smoother{std::chrono::milliseconds(5)};
+	};
+
+	// Renders at most max_block_size() frames.
+	void render_block(mix_frame<ChannelCount>* frames, size_t count, size_t samples_per_second) {
+		// An empty block has no playback duration, which would make every voice miss the deadline below.
+		if (count == 0) {
+			return;
+		}
+
+		std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// The budget starts once the lock is held, so that waiting for a note_on() doesn't count against it.
+		const auto start = std::chrono::steady_clock::now();
+		const auto block_duration = std::chrono::duration<double>(double(count) / double(samples_per_second));
+		// Very short blocks, like those a sequencer splits off at event boundaries, get a minimum budget,
+		// since scheduling jitter alone could otherwise make them miss it.
+		const auto budget = std::max<std::chrono::duration<double>>(block_duration * m_cpu_budget, min_budget);
+		const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget);
+
+		// Render the voices we'd least like to lose first,
+		// so that the budget check below drops the least important ones.
+		for (size_t i = 0; i < m_slots.size(); ++i) {
+			m_order[i] = &m_slots[i];
+		}
+		std::sort(m_order.begin(), m_order.end(), [this](const slot* a, const slot* b) {
+			return steal_priority(*a) > steal_priority(*b);
+		});
+
+		const auto release_step = 1.0f / (float(samples_per_second) * release_seconds);
+		size_t active_voices = 0;
+
+		for (const auto s : m_order) {
+			if (s->id == 0) {
+				continue;
+			}
+
+			// Voices over budget are released instead of being cut off, which would click.
+			// The release is short, so they only cost a little more time until they're gone.
+			if (m_cpu_budget > 0.0 && !s->releasing && std::chrono::steady_clock::now() > deadline) {
+				s->releasing = true;
+				++m_statistics.dropped_voices;
+			}
+
+			// A releasing voice is silent once its gain reached 0, so the rest of the block isn't rendered at all.
+			// This keeps the voices dropped above from costing a whole block's worth of time each.
+			const auto rendered = s->releasing ? std::min(count, size_t(std::ceil(s->gain / release_step))) : count;
+
+			std::visit([this, rendered](auto& voice) { voice.render(m_scratch.data(), rendered); }, s->voice);
+			s->smoother.apply(s->controls, m_scratch.data(), rendered, samples_per_second);
+
+			float level = 0.0f;
+			float gain = s->gain;
+			const float step = s->releasing ? release_step : 0.0f;
+
+			for (size_t i = 0; i < rendered; ++i) {
+				for (size_t channel = 0; channel < ChannelCount; ++channel) {
+					const auto value = m_scratch[i][channel] * gain;
+					frames[i][channel] += value;
+					level = std::max(level, std::abs(value));
+				}
+
+				gain = std::max(0.0f, gain - step);
+			}
+
+			// Rounding may leave a residue the skipped frames would have faded out.
+			if (rendered < count) {
+				gain = 0.0f;
+			}
+
+			s->gain = gain;
+			s->level = level;
+
+			const bool finished = std::visit([](const auto& voice) { return voice.finished(); }, s->voice);
+
+			if (finished || gain <= 0.0f) {
+				s->id = 0;
+			} else {
+				++active_voices;
+			}
+		}
+
+		const auto load = std::chrono::duration<double>(std::chrono::steady_clock::now() - start) / block_duration;
+
+		++m_statistics.blocks;
+		m_statistics.active_voices = active_voices;
+		m_statistics.last_load = load;
+		m_statistics.peak_load = std::max(m_statistics.peak_load, load);
+	}
+
+	template<typename F>
+	void with_voice(voice_id id, F&& func) {
+		if (id == 0) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (auto& s : m_slots) {
+			if (s.id == id) {
+				func(s);
+				break;
+			}
+		}
+	}
+
+	// The slot with the lowest priority is stolen first.
+	// Voices which are already fading out are always preferred.
+	std::pair<bool, double> steal_priority(const slot& s) const {
+		const auto value = m_policy == steal_policy::oldest ? double(s.started) : double(s.level);
+		return {s.id != 0 && !s.releasing, value};
+	}
+
+	std::vector<slot> m_slots;
+	std::vector<slot*> m_order;
+	std::vector<mix_frame<ChannelCount>> m_scratch;
+	steal_policy m_policy;
+	double m_cpu_budget;
+	voice_id m_next_id = 0;
+	statistics m_statistics;
+	mutable std::mutex m_mutex;
+};
+
+// `master`, if given, is applied to the mix before it's converted to ValueType.
+// `process`, if given, is called with the mix after that, and may modify it in place (e.g. with effects) or analyze it.
+template<typename ValueType, typename Allocator>
+auto create_voice_allocator_provider(std::shared_ptr<Allocator> allocator, std::shared_ptr<const gain_pan> master = nullptr, std::function<void(mix_frame<Allocator::channel_count>* frames, size_t count, size_t samples_per_second)> process = nullptr) {
+	constexpr auto ChannelCount = Allocator::channel_count;
+
+	if (!allocator) {
+		throw std::invalid_argument("allocator must not be null");
+	}
+
+	// Allocated here rather than on the render thread, larger spans are mixed in pieces of this size.
+	std::vector<mix_frame<ChannelCount>> mix(allocator->max_block_size());
+	gain_pan_smoother smoother;
+
+	return [allocator, master, process, mix, smoother](typename buffer_trait<ValueType, ChannelCount>::SpanPairType spans, buffer_info info) mutable {
+		for (const auto span : spans) {
+			const auto size = size_t(span.size());
+
+			for (size_t done = 0; done < size;) {
+				const auto n = std::min(size - done, mix.size());
+
+				allocator->render(mix.data(), n, info.samples_per_second);
+
+				if (master) {
+					smoother.apply(*master, mix.data(), n, info.samples_per_second);
+				}
+
+				if (process) {
+					process(mix.data(), n, info.samples_per_second);
+				}
+
+				detail::convert_frames<ValueType, ChannelCount>(mix.data(), span.data() + done, n);
+				done += n;
+			}
+		}
+	};
+}
+
+} // namespace direct_sound
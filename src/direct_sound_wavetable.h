@@ -0,0 +1,143 @@
+#pragma once
+
+namespace direct_sound {
+
+// One period of a sine tone that can be looped seamlessly, rendered once up front.
+//
+// A tone of integer frequency f repeats exactly after samples_per_second / gcd(f, samples_per_second) samples,
+// e.g. 264 Hz at 44100 Hz after 3675 samples (22 cycles) and 440 Hz after 2205. Any other frequency is
+// approximated by the shortest loop whose pitch deviates by at most `max_cents` from it.
+class sine_loop {
+public:
+	explicit sine_loop(double frequency, size_t samples_per_second, double max_cents = 0.1, size_t max_samples = 0) {
+		if (!(frequency > 0.0) || samples_per_second == 0 || frequency >= double(samples_per_second) / 2.0) {
+			throw std::invalid_argument(string_format("invalid argument for frequency: %f", frequency));
+		}
+		if (!(max_cents >= 0.0)) {
+			throw std::invalid_argument(string_format("invalid argument for max_cents: %f", max_cents));
+		}
+
+		if (max_samples == 0) {
+			max_samples = samples_per_second;
+		}
+
+		if (!find_exact(frequency, samples_per_second, max_samples) && !find_approximate(frequency, samples_per_second, max_cents, max_samples)) {
+			throw std::invalid_argument(string_format("no loop of at most %zu samples approximates %f Hz within %f cents", max_samples, frequency, max_cents));
+		}
+
+		m_frequency = double(m_cycles) * double(samples_per_second) / double(m_samples);
+
+		// Reducing the phase modulo the loop length first keeps the argument of sin() small and exact.
+		auto table = std::make_shared<std::vector<float>>(m_samples);
+		for (size_t i = 0; i < m_samples; ++i) {
+			const auto phase = uint64_t(i) * uint64_t(m_cycles) % uint64_t(m_samples);
+			(*table)[i] = float(std::sin(2.0 * M_PI * double(phase) / double(m_samples)));
+		}
+		m_table = std::move(table);
+	}
+
+	size_t samples() const noexcept {
+		return m_samples;
+	}
+
+	size_t cycles() const noexcept {
+		return m_cycles;
+	}
+
+	// The frequency the loop actually plays at.
+	double frequency() const noexcept {
+		return m_frequency;
+	}
+
+	const std::shared_ptr<const std::vector<float>>& table() const noexcept {
+		return m_table;
+	}
+
+private:
+	bool find_exact(double frequency, size_t samples_per_second, size_t max_samples) noexcept {
+		if (frequency != std::floor(frequency)) {
+			return false;
+		}
+
+		const auto f = uint64_t(frequency);
+		const auto divisor = std::gcd(f, uint64_t(samples_per_second));
+		const auto samples = size_t(uint64_t(samples_per_second) / divisor);
+
+		if (samples > max_samples) {
+			return false;
+		}
+
+		m_samples = samples;
+		m_cycles = size_t(f / divisor);
+		return true;
+	}
+
+	bool find_approximate(double frequency, size_t samples_per_second, double max_cents, size_t max_samples) noexcept {
+		const auto cycles_per_sample = frequency / double(samples_per_second);
+
+		for (size_t samples = 1; samples <= max_samples; ++samples) {
+			const auto cycles = std::llround(double(samples) * cycles_per_sample);
+
+			if (cycles == 0) {
+				continue;
+			}
+
+			const auto cents = 1200.0 * std::log2(double(cycles) / (double(samples) * cycles_per_sample));
+
+			if (std::abs(cents) <= max_cents) {
+				m_samples = samples;
+				m_cycles = size_t(cycles);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	size_t m_samples = 0;
+	size_t m_cycles = 0;
+	double m_frequency = 0.0;
+	std::shared_ptr<const std::vector<float>> m_table;
+};
+
+// Plays a single-cycle (or any other seamlessly looping) wavetable, e.g. that of a sine_loop.
+// Rendering is a copy from the table, and the table itself is shared between all voices using it.
+template<size_t ChannelCount>
+class wavetable_voice {
+public:
+	wavetable_voice() = default;
+
+	explicit wavetable_voice(std::shared_ptr<const std::vector<float>> table) : m_table(std::move(table)) {
+		if (!m_table || m_table->empty()) {
+			throw std::invalid_argument("table must not be empty");
+		}
+	}
+
+	bool finished() const {
+		return !m_table;
+	}
+
+	void render(mix_frame<ChannelCount>* frames, size_t count) noexcept {
+		if (!m_table) {
+			std::fill(frames, frames + count, mix_frame<ChannelCount>{});
+			return;
+		}
+
+		const auto table = m_table->data();
+		const auto size = m_table->size();
+
+		for (auto frame = frames, end = frames + count; frame != end; ++frame) {
+			frame->fill(table[m_position]);
+
+			if (++m_position == size) {
+				m_position = 0;
+			}
+		}
+	}
+
+private:
+	std::shared_ptr<const std::vector<float>> m_table;
+	size_t m_position = 0;
+};
+
+} // namespace direct_sound
@@ -53,12 +53,28 @@
 
 #include <mmsystem.h>
 #include <dsound.h>
+#include <ksmedia.h>
 
 #pragma warning(pop)
 
 #include <gsl/gsl>
 #include <winrt/Windows.Foundation.h>
 
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <variant>
+
+// SSE2 is part of the x64 baseline and enabled by default for x86 since VS2012.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DIRECT_SOUND_SSE2 1
+#include <emmintrin.h>
+#endif
+
 #include "defer.h"
 #include "utils.h"
 